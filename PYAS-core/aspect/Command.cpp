@@ -1,4 +1,5 @@
 #include <iostream>
+#include <utility>
 
 #include "Command.hpp"
 
@@ -151,8 +152,7 @@ void CommandPacket::writePayloadLength()
 
 void CommandPacket::writeChecksum()
 {
-    replace(INDEX_CHECKSUM, (uint16_t)0);
-    replace(INDEX_CHECKSUM, (uint16_t)checksum());
+    replace(INDEX_CHECKSUM, (uint16_t)checksum(INDEX_CHECKSUM, sizeof(uint16_t)));
 }
 
 bool CommandPacket::valid()
@@ -204,7 +204,8 @@ int CommandQueue::add_packet(CommandPacket &cp)
 
     while(cp.remainingBytes() > 0) {
         cp.readNextCommandTo(cm);
-        *this << cm;
+        cm.setStamp(cp.getStamp());
+        *this << std::move(cm);
         count++;
     }
 
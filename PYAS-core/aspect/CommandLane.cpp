@@ -0,0 +1,133 @@
+#include "CommandLane.hpp"
+#include <stdio.h>
+#include <errno.h>
+
+CommandLane::CommandLane(const char *name, unsigned int capacity)
+    : name(name)
+    , capacity(capacity)
+    , maxDepth(0)
+    , refused(0)
+    , keys(0)
+    , wakeCount(0)
+{
+    pthread_mutex_init(&mutex, NULL);
+
+    //Timed waits are measured against the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+CommandLane::~CommandLane()
+{
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool CommandLane::push(const SASCommand &command)
+{
+    bool queued = false;
+
+    pthread_mutex_lock(&mutex);
+    if (queue.size() < capacity)
+    {
+        queue.push_back(command);
+        if (queue.size() > maxDepth) maxDepth = queue.size();
+        pthread_cond_signal(&cond);
+        queued = true;
+    }
+    else refused++;
+    pthread_mutex_unlock(&mutex);
+    return queued;
+}
+
+bool CommandLane::pop(SASCommand &command, long usec)
+{
+    unsigned int startCount;
+    timespec deadline;
+    int result = 0;
+    bool available;
+
+    if (usec >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += usec / 1000000;
+        deadline.tv_nsec += (usec % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&mutex);
+    startCount = wakeCount;
+    while (queue.empty() && wakeCount == startCount && result != ETIMEDOUT)
+    {
+        if (usec < 0) pthread_cond_wait(&cond, &mutex);
+        else result = pthread_cond_timedwait(&cond, &mutex, &deadline);
+    }
+    available = !queue.empty() && wakeCount == startCount;
+    if (available)
+    {
+        command = queue.front();
+        queue.pop_front();
+    }
+    pthread_mutex_unlock(&mutex);
+    return available;
+}
+
+void CommandLane::wake()
+{
+    pthread_mutex_lock(&mutex);
+    wakeCount++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+void CommandLane::finished(const SASCommand &command, const timespec &started)
+{
+    timespec now;
+    int k = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mutex);
+    while (k < keys && statistics[k].key != command.key && k < LANE_MAX_KEYS - 1) k++;
+    if (k == keys)
+    {
+        statistics[k].key = command.key;
+        statistics[k].wait.clear();
+        statistics[k].run.clear();
+        keys++;
+    }
+    statistics[k].wait.add(Microseconds(command.received, started));
+    statistics[k].run.add(Microseconds(started, now));
+    pthread_mutex_unlock(&mutex);
+}
+
+unsigned int CommandLane::depth()
+{
+    unsigned int size;
+
+    pthread_mutex_lock(&mutex);
+    size = queue.size();
+    pthread_mutex_unlock(&mutex);
+    return size;
+}
+
+void CommandLane::report()
+{
+    pthread_mutex_lock(&mutex);
+    printf("%s: %u queued, at most %u of %u, %lu refused\n", name, (unsigned int) queue.size(), maxDepth,
+           capacity, refused);
+    for (int k = 0; k < keys; k++)
+    {
+        const KeyStatistics &key = statistics[k];
+        printf("%s 0x%04x%s: %lu handled, waited mean %.1f us max %.1f us, ran mean %.1f us max %.1f us\n",
+               name, key.key, (k == LANE_MAX_KEYS - 1 ? " and others" : ""), key.run.count,
+               key.wait.mean(), key.wait.max, key.run.mean(), key.run.max);
+    }
+    pthread_mutex_unlock(&mutex);
+}
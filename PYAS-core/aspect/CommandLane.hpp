@@ -0,0 +1,93 @@
+/*
+
+  CommandLane
+
+  A bounded queue of SAS commands served by a fixed set of handler threads,
+  in place of a thread per command.  The dispatcher pushes commands and the
+  handlers pop them:
+
+      CommandLane lane("FastCommands", 16);
+      if (!lane.push(command)) ...   // full, so the command is refused
+
+      SASCommand command;
+      if (lane.pop(command, 100000)) {
+          clock_gettime(CLOCK_MONOTONIC, &started);
+          ... handle command ...
+          lane.finished(command, started);
+      }
+
+  pop() blocks for up to the given number of microseconds (negative to wait
+  indefinitely), and wake() releases every handler blocked in it, e.g., to
+  stop them.
+
+  The lane keeps how deep the queue has been, how many commands it refused,
+  and for each command key histograms of how long the commands waited from
+  receipt to a handler and how long they then took, which report() prints.
+
+*/
+
+#ifndef _COMMANDLANE_HPP_
+#define _COMMANDLANE_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <deque>
+
+#include "PeriodicTask.hpp"
+
+#define LANE_MAX_KEYS 16 // command keys with their own statistics, the rest share the last
+
+struct SASCommand
+{
+    uint16_t key;
+    uint8_t num_vars;
+    uint16_t vars[15];
+    timespec received;  //CLOCK_MONOTONIC, when its packet arrived
+};
+
+class CommandLane
+{
+public:
+    CommandLane(const char *name, unsigned int capacity);
+    ~CommandLane();
+
+    //Queues command, returning false if the lane is full
+    bool push(const SASCommand &command);
+    //Takes the oldest command, returning false if the timeout (in us) was
+    //reached or wake() was called first
+    bool pop(SASCommand &command, long usec = -1);
+    void wake();
+
+    //Records the statistics of a command that a handler started at started
+    //(CLOCK_MONOTONIC) and has just finished
+    void finished(const SASCommand &command, const timespec &started);
+
+    unsigned int depth();
+    const char *getName() const { return name; };
+    //Prints the statistics since the lane was created
+    void report();
+
+private:
+    struct KeyStatistics
+    {
+        uint16_t key;
+        TimingHistogram wait, run;
+    };
+
+    const char *name;
+    unsigned int capacity;
+    std::deque<SASCommand> queue;
+    unsigned int maxDepth;
+    unsigned long refused;
+    KeyStatistics statistics[LANE_MAX_KEYS];
+    int keys;
+    unsigned int wakeCount;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    CommandLane(const CommandLane &other);            //not copyable
+    CommandLane &operator=(const CommandLane &other); //not copyable
+};
+
+#endif
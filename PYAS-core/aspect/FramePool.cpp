@@ -0,0 +1,113 @@
+#include "FramePool.hpp"
+
+FramePool::FramePool() : latest_index(-1), dropped(0)
+{
+    for (int i = 0; i < FRAME_POOL_SIZE; i++) slots[i].refs = 0;
+}
+
+void FramePool::addRef(int index)
+{
+    slots[index].refs.fetch_add(1);
+}
+
+void FramePool::release(int index)
+{
+    slots[index].refs.fetch_sub(1);
+}
+
+void FramePool::allocate(int rows, int cols, int type)
+{
+    for (int i = 0; i < FRAME_POOL_SIZE; i++) {
+        int expected = 0;
+        if (slots[i].refs.compare_exchange_strong(expected, 1)) {
+            slots[i].image.create(rows, cols, type);
+            release(i);
+        }
+    }
+}
+
+Frame FramePool::acquire()
+{
+    //A buffer is free when nothing refers to it, and claiming it takes its
+    //count from 0 to 1 in one step
+    for (int i = 0; i < FRAME_POOL_SIZE; i++) {
+        int expected = 0;
+        if (slots[i].refs.compare_exchange_strong(expected, 1)) return Frame(this, i);
+    }
+
+    dropped++;
+    return Frame();
+}
+
+void FramePool::publish(const Frame &frame)
+{
+    if (frame.empty()) return;
+
+    //The pool's own reference to the latest frame moves from the old one to
+    //the new one, and the exchange releases the frame's contents to consumers
+    addRef(frame.index);
+    int previous = latest_index.exchange(frame.index);
+    if (previous >= 0) release(previous);
+}
+
+Frame FramePool::latest()
+{
+    while (1) {
+        int index = latest_index.load();
+        if (index < 0) return Frame();
+
+        //Count the reference first, then make sure the frame was not replaced
+        //in the meantime, in which case its buffer may already be reused
+        addRef(index);
+        if (latest_index.load() == index) return Frame(this, index);
+        release(index);
+    }
+}
+
+Frame::Frame(const Frame &other) : pool(other.pool), index(other.index)
+{
+    if (pool != NULL) pool->addRef(index);
+}
+
+Frame::Frame(Frame &&other) : pool(other.pool), index(other.index)
+{
+    other.pool = NULL;
+    other.index = -1;
+}
+
+Frame::~Frame()
+{
+    release();
+}
+
+Frame &Frame::operator=(const Frame &other)
+{
+    if (this != &other) {
+        if (other.pool != NULL) other.pool->addRef(other.index);
+        release();
+        pool = other.pool;
+        index = other.index;
+    }
+    return *this;
+}
+
+Frame &Frame::operator=(Frame &&other)
+{
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        index = other.index;
+        other.pool = NULL;
+        other.index = -1;
+    }
+    return *this;
+}
+
+void Frame::release()
+{
+    if (pool != NULL) {
+        pool->release(index);
+        pool = NULL;
+        index = -1;
+    }
+}
@@ -0,0 +1,112 @@
+/*
+
+  FramePool and Frame
+
+  A fixed set of preallocated image buffers for handing camera frames to any
+  number of consumers without copying and without locks.  A Frame is a
+  reference-counted handle to one buffer; copying a Frame shares the buffer, and
+  the buffer returns to the pool once the last Frame referring to it is gone.
+
+  The camera thread acquires a free buffer, fills it, and publishes it:
+      Frame next = pool.acquire();
+      if (!next.empty()) {
+          camera.Snap(next.image());
+          next.keys().frameCount = ++count;
+          pool.publish(next);
+      }
+  acquire() never blocks.  If every buffer is still held by a consumer, it
+  returns an empty Frame and the frame should be dropped (see getDropped()).
+
+  Consumers take a reference to the most recently published frame:
+      Frame current = pool.latest();
+      if (!current.empty()) process(current.image());
+  The buffer is not reused while current exists, so the image must be treated
+  as read-only.  Any cv::Mat headers made from it share its memory and should
+  not be used after current is gone.
+
+  The pool holds one reference to the latest frame, so FRAME_POOL_SIZE needs to
+  be at least two more than the number of frames consumers hold at once.
+
+*/
+
+#ifndef _FRAMEPOOL_HPP_
+#define _FRAMEPOOL_HPP_
+
+#include <atomic>
+#include <opencv.hpp>
+
+#include "compression.hpp" //for HeaderData
+
+#define FRAME_POOL_SIZE 6
+
+class Frame;
+
+class FramePool {
+private:
+    struct Slot {
+        cv::Mat image;
+        HeaderData keys;
+        std::atomic<int> refs;
+    };
+
+    Slot slots[FRAME_POOL_SIZE];
+    std::atomic<int> latest_index;      //-1 when nothing has been published
+    std::atomic<unsigned long> dropped;
+
+    void addRef(int index);
+    void release(int index);
+
+    FramePool(const FramePool &other);              //not copyable
+    FramePool &operator=(const FramePool &other);   //not copyable
+
+    friend class Frame;
+
+public:
+    FramePool();
+
+    //Allocates every buffer that is not in use, so that later frames of the
+    //same size do not allocate
+    void allocate(int rows, int cols, int type);
+
+    //For the producer: a free buffer, or an empty Frame if none is free
+    Frame acquire();
+
+    //For the producer: makes this frame the one returned by latest()
+    void publish(const Frame &frame);
+
+    //For consumers: the most recently published frame, or an empty Frame
+    Frame latest();
+
+    //Number of times acquire() found no free buffer
+    unsigned long getDropped() { return dropped; }
+};
+
+class Frame {
+private:
+    FramePool *pool;
+    int index;
+
+    //Takes over a reference that has already been counted
+    Frame(FramePool *owner, int slot) : pool(owner), index(slot) {};
+
+    friend class FramePool;
+
+public:
+    Frame() : pool(NULL), index(-1) {};
+    Frame(const Frame &other);
+    Frame(Frame &&other);
+    ~Frame();
+
+    Frame &operator=(const Frame &other);
+    Frame &operator=(Frame &&other);
+
+    bool empty() const { return pool == NULL; }
+
+    cv::Mat &image() { return pool->slots[index].image; }
+    HeaderData &keys() { return pool->slots[index].keys; }
+
+    //Gives up the reference early
+    void release();
+};
+
+#endif
@@ -0,0 +1,408 @@
+#include "FrameSource.hpp"
+#include "processing.hpp"   //for fiducialIDtoScreen()
+#include "compression.hpp"  //for readFITSImage()
+#include "utilities.hpp"    //for TimespecDiff()
+#include <CCfits>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+//Synthetic Sun, matching the defaults in Aspect
+#define SYNTHETIC_RADIUS          105       // pixels
+#define SYNTHETIC_PLATE_SCALE     (15.5/90) // pixels per screen unit, from the fiducial spacing
+#define SYNTHETIC_FIDUCIAL_LENGTH 15        // pixels
+#define SYNTHETIC_FIDUCIAL_WIDTH  2         // pixels
+#define SYNTHETIC_FIDUCIAL_DEPTH  0.3       // fraction of the disk brightness left on a fiducial
+#define SYNTHETIC_LIMB_DARKENING  0.6       // linear limb-darkening coefficient
+#define SYNTHETIC_SKY             10        // DN
+#define SYNTHETIC_DISK            200       // DN at disk center for SYNTHETIC_EXPOSURE
+#define SYNTHETIC_EXPOSURE        15000     // microseconds
+#define SYNTHETIC_NOISE           2         // DN
+#define SYNTHETIC_DRIFT_PERIOD_X  600       // frames
+#define SYNTHETIC_DRIFT_PERIOD_Y  450       // frames
+
+/*****************************************************
+
+SimulatedSource
+
+*****************************************************/
+
+SimulatedSource::SimulatedSource()
+    : roiSize(0, 0)
+    , roiOffset(0, 0)
+    , exposure(SYNTHETIC_EXPOSURE)
+    , streaming(false)
+    , frameTime(0)
+    , pacer("SimulatedSource", 0)
+    , frames(0)
+    , late(0)
+{
+    clock_gettime(CLOCK_MONOTONIC, &reportStart);
+    interrupt = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+SimulatedSource::~SimulatedSource()
+{
+    if (interrupt >= 0) close(interrupt);
+}
+
+int SimulatedSource::Configure(cv::Size size, cv::Point offset, int frameTime)
+{
+    roiSize = size;
+    roiOffset = offset;
+    this->frameTime = (long)frameTime*1000;
+    pacer.setPeriod(frameTime);
+    return 0;
+}
+
+int SimulatedSource::StartStream()
+{
+    uint64_t count;
+
+    if (interrupt >= 0) while (read(interrupt, &count, sizeof(count)) > 0);
+    pacer.start();
+    streaming = true;
+    return 0;
+}
+
+void SimulatedSource::Stop()
+{
+    streaming = false;
+}
+
+void SimulatedSource::Interrupt()
+{
+    uint64_t one = 1;
+
+    if (interrupt >= 0 && write(interrupt, &one, sizeof(one)) < 0) perror("SimulatedSource: write() failed");
+}
+
+int SimulatedSource::SetExposure(int exposureTime)
+{
+    if (exposureTime <= 0) return -1;
+    exposure = exposureTime;
+    return 0;
+}
+
+bool SimulatedSource::Pace(timespec &captureTime)
+{
+    //If we have fallen behind, the frames that were due are skipped rather
+    //than produced in a burst to catch up
+    if (frameTime > 0)
+    {
+        int missed = pacer.wait(interrupt);
+        if (missed < 0) return false;
+        late += missed;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &captureTime);
+    frames++;
+    return true;
+}
+
+void SimulatedSource::Report(const char *name)
+{
+    timespec now, elapsed;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = TimespecDiff(reportStart, now);
+    double seconds = elapsed.tv_sec + elapsed.tv_nsec/1e9;
+
+    TimingHistogram jitter, execution;
+    unsigned long missed;
+    pacer.getStatistics(jitter, execution, missed);
+
+    printf("%s: %lu frames, %.1f frames/s, %lu late, pacing jitter mean %.1f us max %.1f us\n", name, frames,
+           (seconds > 0 ? frames/seconds : 0), late, jitter.mean(), jitter.max);
+
+    frames = 0;
+    late = 0;
+    pacer.clear();
+    reportStart = now;
+}
+
+/*****************************************************
+
+ReplaySource
+
+*****************************************************/
+
+ReplaySource::ReplaySource(const std::string &directory)
+    : directory(directory)
+    , imageSize(0, 0)
+    , next(0)
+{
+}
+
+int ReplaySource::Connect()
+{
+    files.clear();
+    cache.clear();
+    next = 0;
+
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL)
+    {
+        std::cout << "ReplaySource::Connect Cannot open " << directory << std::endl;
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        size_t dot = name.rfind('.');
+        if (dot == std::string::npos) continue;
+
+        std::string extension = name.substr(dot);
+        if (extension == ".fits" || extension == ".fit" || extension == ".png")
+            files.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+
+    if (files.empty())
+    {
+        std::cout << "ReplaySource::Connect No FITS or PNG images in " << directory << std::endl;
+        return -1;
+    }
+    std::sort(files.begin(), files.end());
+
+    cv::Mat first;
+    if (Load(files[0], first) != 0) return -1;
+    imageSize = first.size();
+
+    std::cout << "ReplaySource::Connect Found " << files.size() << " images of "
+              << imageSize.width << "x" << imageSize.height << std::endl;
+    return 0;
+}
+
+int ReplaySource::Initialize()
+{
+    cache.clear();
+    if (files.size() <= REPLAY_MAX_CACHED)
+    {
+        cache.resize(files.size());
+        for (unsigned int k = 0; k < files.size(); k++)
+        {
+            if (Load(files[k], cache[k]) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+cv::Size ReplaySource::GetROISize()
+{
+    return Crop().size();
+}
+
+int ReplaySource::Retrieve(cv::Mat &frame, timespec &captureTime)
+{
+    if (!streaming || files.empty()) return 1;
+
+    cv::Mat image;
+    if (!cache.empty()) image = cache[next];
+    else if (Load(files[next], image) != 0) return 1;
+    next = (next+1) % files.size();
+
+    if (image.size() != imageSize)
+    {
+        std::cout << "ReplaySource::Retrieve Image size changed, skipping" << std::endl;
+        return 1;
+    }
+
+    if (!Pace(captureTime)) return 1;
+    image(Crop()).copyTo(frame);
+    return 0;
+}
+
+int ReplaySource::Load(const std::string &file, cv::Mat &image)
+{
+    if (file.substr(file.rfind('.')) == ".png")
+    {
+        image = cv::imread(file, 0);
+    }
+    else
+    {
+        try
+        {
+            readFITSImage(file, image);
+        }
+        catch (CCfits::FitsException &)
+        {
+            image.release();
+        }
+    }
+
+    if (image.empty() || image.type() != CV_8UC1)
+    {
+        std::cout << "ReplaySource::Load Cannot read " << file << " as an 8-bit image" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+cv::Rect ReplaySource::Crop()
+{
+    //The ROI is applied when it fits in the images, otherwise they are
+    //played back whole
+    if (roiSize.width > 0 && roiSize.height > 0 &&
+        roiOffset.x >= 0 && roiOffset.x + roiSize.width <= imageSize.width &&
+        roiOffset.y >= 0 && roiOffset.y + roiSize.height <= imageSize.height)
+    {
+        return cv::Rect(roiOffset.x, roiOffset.y, roiSize.width, roiSize.height);
+    }
+    return cv::Rect(0, 0, imageSize.width, imageSize.height);
+}
+
+/*****************************************************
+
+SyntheticSun
+
+*****************************************************/
+
+SyntheticSun::SyntheticSun()
+    : sunCenter(-1, -1)
+    , screenOffset(0, 0)
+    , sunRadius(SYNTHETIC_RADIUS)
+    , drift(0)
+    , noise(SYNTHETIC_NOISE)
+    , count(0)
+    , seed(2463534242U)
+{
+}
+
+void SyntheticSun::SetSun(cv::Point2f center, float radius)
+{
+    sunCenter = center;
+    sunRadius = radius;
+}
+
+void SyntheticSun::SetScreenOffset(cv::Point2f offset)
+{
+    screenOffset = offset;
+}
+
+void SyntheticSun::SetDrift(float amplitude)
+{
+    drift = amplitude;
+}
+
+void SyntheticSun::SetNoise(float sigma)
+{
+    noise = sigma;
+}
+
+int SyntheticSun::Retrieve(cv::Mat &frame, timespec &captureTime)
+{
+    if (!streaming || roiSize.width <= 0 || roiSize.height <= 0) return 1;
+
+    //The Sun starts in the middle of the frame unless told otherwise, and
+    //wanders around that point
+    cv::Point2f center = sunCenter;
+    if (center.x < 0 || center.y < 0)
+        center = cv::Point2f(roiSize.width/2.0, roiSize.height/2.0);
+    center.x += drift*sin(2*M_PI*count/SYNTHETIC_DRIFT_PERIOD_X);
+    center.y += drift*sin(2*M_PI*count/SYNTHETIC_DRIFT_PERIOD_Y);
+    count++;
+
+    Render(frame, center);
+    if (!Pace(captureTime)) return 1;
+    return 0;
+}
+
+void SyntheticSun::Render(cv::Mat &frame, cv::Point2f center)
+{
+    frame.create(roiSize.height, roiSize.width, CV_8UC1);
+
+    float disk = (float)SYNTHETIC_DISK*exposure/SYNTHETIC_EXPOSURE;
+    float u = SYNTHETIC_LIMB_DARKENING;
+    float R = sunRadius;
+    int rowStart = std::max(0, (int)floor(center.y - R - 1));
+    int rowStop = std::min(roiSize.height, (int)ceil(center.y + R + 2));
+    int colStart = std::max(0, (int)floor(center.x - R - 1));
+    int colStop = std::min(roiSize.width, (int)ceil(center.x + R + 2));
+
+    std::vector<float> level(roiSize.width);
+    for (int m = 0; m < roiSize.height; m++)
+    {
+        std::fill(level.begin(), level.end(), (float)SYNTHETIC_SKY);
+
+        //Linear limb darkening, with the limb antialiased over a pixel
+        if (m >= rowStart && m < rowStop)
+        {
+            float dy = m - center.y;
+            for (int n = colStart; n < colStop; n++)
+            {
+                float dx = n - center.x;
+                float r = sqrt(dx*dx + dy*dy);
+                if (r >= R + 0.5) continue;
+
+                float coverage = std::min(1.0f, R + 0.5f - r);
+                float mu = sqrt(std::max(0.0f, 1 - (r*r)/(R*R)));
+                level[n] += coverage*disk*(1 - u*(1 - mu));
+            }
+        }
+
+        unsigned char *row = frame.ptr<unsigned char>(m);
+        for (int n = 0; n < roiSize.width; n++)
+        {
+            float value = level[n];
+            if (noise > 0)
+            {
+                //Sum of four uniform deviates, close enough to Gaussian
+                float sum = 0;
+                for (int k = 0; k < 4; k++)
+                {
+                    seed ^= seed << 13;
+                    seed ^= seed >> 17;
+                    seed ^= seed << 5;
+                    sum += seed / 4294967296.0f;
+                }
+                value += (sum - 2)*sqrt(3.0f)*noise;
+            }
+            row[n] = (unsigned char)std::max(0.0f, std::min(255.0f, value + 0.5f));
+        }
+    }
+
+    //Fiducials are shadows on the screen, so only the ones on the disk show.
+    //The image is mirrored in x relative to the screen, as Aspect expects.
+    cv::Point2f origin(roiSize.width/2.0 + screenOffset.x, roiSize.height/2.0 + screenOffset.y);
+    int half = SYNTHETIC_FIDUCIAL_LENGTH/2;
+    for (int i = -7; i <= 7; i++)
+    {
+        for (int j = -7; j <= 7; j++)
+        {
+            cv::Point2f screen = fiducialIDtoScreen(cv::Point2i(i, j));
+            cv::Point position(cvRound(origin.x - screen.x*SYNTHETIC_PLATE_SCALE),
+                               cvRound(origin.y + screen.y*SYNTHETIC_PLATE_SCALE));
+
+            float dx = position.x - center.x, dy = position.y - center.y;
+            if (sqrt(dx*dx + dy*dy) > R - half) continue;
+
+            for (int t = -half; t <= half; t++)
+            {
+                for (int w = 0; w < SYNTHETIC_FIDUCIAL_WIDTH; w++)
+                {
+                    int offset = w - SYNTHETIC_FIDUCIAL_WIDTH/2;
+                    //Horizontal arm, then the vertical arm without the overlap
+                    cv::Point points[2] = {cv::Point(position.x + t, position.y + offset),
+                                           cv::Point(position.x + offset, position.y + t)};
+                    for (int k = 0; k < 2; k++)
+                    {
+                        if (k == 1 && t >= -SYNTHETIC_FIDUCIAL_WIDTH/2 &&
+                            t < SYNTHETIC_FIDUCIAL_WIDTH - SYNTHETIC_FIDUCIAL_WIDTH/2) continue;
+                        if (points[k].x < 0 || points[k].x >= roiSize.width ||
+                            points[k].y < 0 || points[k].y >= roiSize.height) continue;
+
+                        unsigned char &pixel = frame.at<unsigned char>(points[k].y, points[k].x);
+                        if (pixel > SYNTHETIC_SKY)
+                            pixel = (unsigned char)(SYNTHETIC_SKY + (pixel - SYNTHETIC_SKY)*SYNTHETIC_FIDUCIAL_DEPTH);
+                    }
+                }
+            }
+        }
+    }
+}
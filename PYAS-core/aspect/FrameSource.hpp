@@ -0,0 +1,167 @@
+/*
+
+  FrameSource, ReplaySource, and SyntheticSun
+
+  FrameSource is the interface between the camera thread and whatever is
+  producing frames, so that the flight code can run without the camera.
+  ImperxStream implements it for the real camera, and there are two stand-ins:
+
+    ReplaySource  plays back the FITS and PNG images in a directory, in name
+                  order, looping at the end
+    SyntheticSun  renders a limb-darkened Sun with the fiducial pattern from
+                  fiducialIDtoScreen(), drifting slowly across the frame
+
+  The stand-ins produce a frame every frameTime microseconds, or as fast as
+  they can for a frameTime of 0.
+
+  Usage follows the camera:
+      source->Connect();
+      source->Configure(size, offset, frameTime);
+      cv::Size size = source->GetROISize();
+      source->Initialize();
+      source->StartStream();
+      while (...) source->Retrieve(frame, captureTime);
+      source->Stop();
+      source->Disconnect();
+  Functions returning int return 0 on success, nonzero otherwise.
+
+  Another thread can call Interrupt() to release a Retrieve() that is waiting
+  for its frame time, which then fails, so that the camera thread can be
+  stopped promptly.  Sources stay interrupted until StartStream().  The
+  stand-ins are released at once, the camera within RETRIEVE_SLICE.
+
+*/
+
+#ifndef _FRAMESOURCE_HPP_
+#define _FRAMESOURCE_HPP_
+
+#include <opencv.hpp>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "PeriodicTask.hpp"
+
+#define REPLAY_MAX_CACHED 64 // replays of this many images or fewer are decoded only once
+
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {};
+
+    virtual int Connect() = 0;
+    virtual int Configure(cv::Size size, cv::Point offset, int frameTime) = 0;
+    virtual int Initialize() = 0;
+    virtual int StartStream() = 0;
+
+    //Copies the next frame into frame and its capture time (CLOCK_REALTIME)
+    //into captureTime, blocking until it is available.  The camera gives the
+    //middle of the exposure, and the stand-ins the time the frame was due.
+    virtual int Retrieve(cv::Mat &frame, timespec &captureTime) = 0;
+
+    virtual void Stop() = 0;
+    virtual void Disconnect() = 0;
+
+    //Releases a blocked Retrieve(), if the source can
+    virtual void Interrupt() {};
+
+    virtual int SetExposure(int exposureTime) = 0;
+    virtual int SetAnalogGain(int gain) = 0;
+    virtual int SetPreAmpGain(int gain) = 0;
+    virtual cv::Size GetROISize() = 0;
+    virtual float getTemperature() = 0;
+
+    //Prints the source's statistics since the last report
+    virtual void Report(const char *name) = 0;
+};
+
+//Common pacing and settings for the stand-ins
+class SimulatedSource : public FrameSource
+{
+public:
+    SimulatedSource();
+    virtual ~SimulatedSource();
+
+    virtual int Configure(cv::Size size, cv::Point offset, int frameTime);
+    virtual int StartStream();
+    virtual void Stop();
+    virtual void Disconnect() {};
+    virtual void Interrupt();
+
+    virtual int SetExposure(int exposureTime);
+    virtual int SetAnalogGain(int gain) { return 0; };
+    virtual int SetPreAmpGain(int gain) { return 0; };
+    virtual cv::Size GetROISize() { return roiSize; };
+    virtual float getTemperature() { return 0; };
+
+    virtual void Report(const char *name);
+
+protected:
+    cv::Size roiSize;
+    cv::Point roiOffset;
+    int exposure;
+    bool streaming;
+
+    //Waits for the next frame time, then returns the capture time, or
+    //returns false if interrupted
+    bool Pace(timespec &captureTime);
+
+private:
+    long frameTime;         //nanoseconds
+    PeriodicTask pacer;
+    int interrupt;          //eventfd, readable once interrupted
+    timespec reportStart;   //CLOCK_MONOTONIC
+    unsigned long frames, late;
+};
+
+class ReplaySource : public SimulatedSource
+{
+public:
+    ReplaySource(const std::string &directory);
+
+    //Finds the images, and sizes the ROI to the first one
+    virtual int Connect();
+    //Decodes all of the images if there are few enough
+    virtual int Initialize();
+    virtual int Retrieve(cv::Mat &frame, timespec &captureTime);
+    virtual cv::Size GetROISize();
+
+private:
+    std::string directory;
+    std::vector<std::string> files;
+    std::vector<cv::Mat> cache;
+    cv::Size imageSize;
+    unsigned int next;
+
+    int Load(const std::string &file, cv::Mat &image);
+    cv::Rect Crop();
+};
+
+class SyntheticSun : public SimulatedSource
+{
+public:
+    SyntheticSun();
+
+    virtual int Connect() { return 0; };
+    virtual int Initialize() { return 0; };
+    virtual int Retrieve(cv::Mat &frame, timespec &captureTime);
+
+    //Where the Sun starts, in pixels, and its radius
+    void SetSun(cv::Point2f center, float radius);
+    //Pixels from the center of the frame to the screen origin
+    void SetScreenOffset(cv::Point2f offset);
+    //Amplitude of the drift in pixels, 0 to hold the Sun still
+    void SetDrift(float amplitude);
+    //Standard deviation of the added noise in DN
+    void SetNoise(float sigma);
+
+private:
+    cv::Point2f sunCenter, screenOffset;
+    float sunRadius, drift, noise;
+    unsigned long count;
+    uint32_t seed;
+
+    void Render(cv::Mat &frame, cv::Point2f center);
+};
+
+#endif
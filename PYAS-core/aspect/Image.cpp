@@ -7,15 +7,19 @@
 
 #include "Image.hpp"
 #include "types.hpp" //for bitread and bitwrite
+#include "crc16.hpp"
 
 #define SAS_TARGET_ID 0x30
 #define IMAGE_DATA 0x82
 #define IMAGE_TAG 0x83
 
+#define INDEX_PAYLOAD_LENGTH 4
+#define INDEX_CHECKSUM 6
 #define INDEX_NANOSECONDS 8
 #define INDEX_SECONDS 12
 #define INDEX_DATA_OFFSET_FIELD 16
 #define INDEX_IMAGE_FORMAT_FIELD 20
+#define INDEX_PAYLOAD 16
 #define INDEX_IMAGE_DATA 24
 
 using std::ostream;
@@ -113,6 +117,20 @@ ImageSectionPacket::ImageSectionPacket(const void *ptr)
     //Assumes that NULL was passed in
 }
 
+void ImageSectionPacket::finishHeader(const timeval &time, const uint8_t *data, uint16_t num)
+{
+    if(getLength()+num > TELEMETRY_PACKET_MAX_SIZE) throw ipInvalidException;
+
+    replace(INDEX_PAYLOAD_LENGTH, (uint16_t)(getLength()+num-INDEX_PAYLOAD));
+    replace(INDEX_NANOSECONDS, (uint32_t)time.tv_usec*1000);
+    replace(INDEX_SECONDS, (uint32_t)time.tv_sec);
+
+    //Continue the CRC of the header (with the checksum field zeroed) over the data
+    uint16_t value = checksum(INDEX_CHECKSUM, sizeof(uint16_t));
+    value = crc16_update((uint16_t)((value << 8) | (value >> 8)), data, num);
+    replace(INDEX_CHECKSUM, (uint16_t)((value << 8) | (value >> 8)));
+}
+
 uint8_t ImageSectionPacket::getCamera()
 {
     uint32_t image_format;
@@ -193,10 +211,11 @@ void ImagePacketQueue::add_array(uint8_t camera,
         offset = i*SECTION_MAX_PIXELS;
         isp = ImageSectionPacket(camera, xpixels, ypixels,
                                  offset, last);
+        isp.reserve(isp.getLength() + (last ? last_length : SECTION_MAX_PIXELS));
         isp.append_bytes(array+offset,
                          (last ? last_length : SECTION_MAX_PIXELS));
         isp.setTimeAndFinish(now);
-        *this << isp;
+        *this << std::move(isp);
     }
 
     //No actual header information exists, so let's make some up
@@ -249,12 +268,16 @@ void ImagePacketQueue::synchronize()
 
     lock();
 
-    if(empty()) throw iqEmptyException;
+    if(empty()) {
+        unlock();
+        throw iqEmptyException;
+    }
     for (ImagePacketQueue::iterator it=begin(); it != end(); ++it) {
         //Have to go through some contortions to make sure derived finish() is called
-        im = ImagePacket(*((ImagePacket *)&(*it)));
+        //The buffer handle is moved out and back, so no bytes are copied
+        im = std::move(*((ImagePacket *)&(*it)));
         im.setTimeAndFinish(now);
-        *it = im;
+        *it = std::move(im);
     }
 
     unlock();
@@ -64,6 +64,13 @@ public:
     uint32_t getOffset();
 
     bool last();
+
+    //For streaming, where the pixel data is sent straight after this header
+    //rather than being appended to the packet
+    //Writes the timestamp, the payload length, and the checksum including the
+    //num bytes of data in a single pass over the data
+    //Do not use outputTo() afterward, which would recompute the fields
+    void finishHeader(const timeval &time, const uint8_t *data, uint16_t num);
 };
 
 class ImageTagPacket : public ImagePacket {
@@ -1,9 +1,103 @@
 #include "ImperxStream.hpp"
 #include <iostream>
+#include <time.h>
+
+// GigE Vision 1.x block IDs are 16 bits and skip 0 when they wrap
+#define BLOCK_ID_MAX 65535
+// A block ID this close to the start after one this close to the end has
+// wrapped, while any other backward jump is the camera's count restarting
+#define BLOCK_ID_WRAP_WINDOW 1024
+
+// Longest single wait on the pipeline in Retrieve, in milliseconds, and so
+// the longest before it sees Interrupt()
+#define RETRIEVE_SLICE 50
+
+// Seconds between latches of the camera's timestamp, so that the drift of
+// its clock from ours stays well under a millisecond
+#define TIMESTAMP_RELATCH 10
+
+// time plus seconds, which may be negative
+static timespec Offset(const timespec &time, double seconds)
+{
+    timespec result;
+    long long nsec = (long long) time.tv_sec * 1000000000LL + time.tv_nsec + (long long) (seconds * 1e9);
+    result.tv_sec = nsec / 1000000000LL;
+    result.tv_nsec = nsec % 1000000000LL;
+    return result;
+}
+
+StreamFrame::StreamFrame()
+    : blockID( 0 )
+    , lPipeline( NULL )
+    , lBuffer( NULL )
+{
+    arrival.tv_sec = 0;
+    arrival.tv_nsec = 0;
+    exposure = arrival;
+}
+
+StreamFrame::StreamFrame(StreamFrame &&other)
+    : image( other.image )
+    , blockID( other.blockID )
+    , arrival( other.arrival )
+    , exposure( other.exposure )
+    , lPipeline( other.lPipeline )
+    , lBuffer( other.lBuffer )
+{
+    other.image.release();
+    other.lPipeline = NULL;
+    other.lBuffer = NULL;
+}
+
+StreamFrame &StreamFrame::operator=(StreamFrame &&other)
+{
+    if (this != &other)
+    {
+        Release();
+        image = other.image;
+        blockID = other.blockID;
+        arrival = other.arrival;
+        exposure = other.exposure;
+        lPipeline = other.lPipeline;
+        lBuffer = other.lBuffer;
+        other.image.release();
+        other.lPipeline = NULL;
+        other.lBuffer = NULL;
+    }
+    return *this;
+}
+
+StreamFrame::~StreamFrame()
+{
+    Release();
+}
+
+void StreamFrame::Release()
+{
+    image.release();
+    if (lBuffer != NULL)
+    {
+        lPipeline->ReleaseBuffer( lBuffer );
+        lBuffer = NULL;
+        lPipeline = NULL;
+    }
+}
 
 ImperxStream::ImperxStream()
     : lStream()
     , lPipeline( &lStream )
+    , streaming( false )
+    , interrupted( false )
+    , exposureTime( 0 )
+    , timestampValid( false )
+    , tickFrequency( 0 )
+    , latchTicks( 0 )
+    , nextLatch( 0 )
+    , lastBlockID( 0 )
+    , framesStreamed( 0 )
+    , blockIDGaps( 0 )
+    , blockIDResyncs( 0 )
+    , failedBuffers( 0 )
 {
     lDeviceInfo = NULL;
     lDeviceParams = NULL;
@@ -283,6 +377,208 @@ int ImperxStream::Snap(cv::Mat &frame, int timeout)
     return result;
 }
 
+int ImperxStream::StartStream()
+{
+    if (lDeviceParams == NULL || !lPipeline.IsStarted())
+    {
+        std::cout << "ImperxStream::StartStream Not initialized!" << std::endl;
+        return 1;
+    }
+
+    lastBlockID = 0;
+    framesStreamed = 0;
+    blockIDGaps = 0;
+    blockIDResyncs = 0;
+    failedBuffers = 0;
+    interrupted = false;
+    exposureTime = GetExposure();
+    timestampValid = LatchTimestamp();
+
+    // The pipeline is already "armed", so one command starts the camera
+    // sending frames until Stop
+    PvResult lResult = lDeviceParams->ExecuteCommand( "AcquisitionStart" );
+    if (!lResult.IsOK())
+    {
+        std::cout << "ImperxStream::StartStream AcquisitionStart failed: " << lResult << std::endl;
+        return 1;
+    }
+    streaming = true;
+    return 0;
+}
+
+int ImperxStream::Retrieve(StreamFrame &frame)
+{
+    return Retrieve(frame, 1000);
+}
+
+int ImperxStream::Retrieve(StreamFrame &frame, int timeout)
+{
+    frame.Release();
+    if (!streaming)
+    {
+        std::cout << "ImperxStream::Retrieve Not streaming!" << std::endl;
+        return 1;
+    }
+
+    PvBuffer *lBuffer = NULL;
+    PvResult lOperationResult;
+    PvResult lResult;
+    int waited = 0, slice;
+
+    // The SDK offers no way to release a thread waiting on the pipeline, so
+    // wait in slices and check for Interrupt() between them
+    do
+    {
+        if (interrupted)
+        {
+            std::cout << "ImperxStream::Retrieve Interrupted" << std::endl;
+            return 1;
+        }
+        slice = (timeout - waited < RETRIEVE_SLICE ? timeout - waited : RETRIEVE_SLICE);
+        lResult = lPipeline.RetrieveNextBuffer( &lBuffer, slice, &lOperationResult );
+        waited += slice;
+    } while ( lResult.GetCode() == PvResult::Code::TIMEOUT && waited < timeout );
+
+    if ( !lResult.IsOK() )
+    {
+        std::cout << "ImperxStream::Retrieve Timeout: " << lResult << std::endl;
+        failedBuffers++;
+        return 1;
+    }
+
+    // Count the block IDs that never made it to us, whether the camera, the
+    // network or the pipeline lost them.  A repeated block ID counts for
+    // nothing, and after a restarted count we pick up from the new ID.
+    PvUInt64 lBlockID = lBuffer->GetBlockID();
+    if (lastBlockID != 0 && lBlockID != lastBlockID)
+    {
+        if (lBlockID > lastBlockID) blockIDGaps += lBlockID - lastBlockID - 1;
+        else if (lBlockID != 0 && lBlockID <= BLOCK_ID_WRAP_WINDOW && lastBlockID > BLOCK_ID_MAX - BLOCK_ID_WRAP_WINDOW)
+            blockIDGaps += (BLOCK_ID_MAX - lastBlockID) + (lBlockID - 1);
+        else blockIDResyncs++;
+    }
+    lastBlockID = lBlockID;
+
+    if ( !lOperationResult.IsOK() )
+    {
+        std::cout << "ImperxStream::Retrieve Operation result: " << lOperationResult << std::endl;
+        failedBuffers++;
+        lPipeline.ReleaseBuffer( lBuffer );
+        return 1;
+    }
+
+    if ( lBuffer->GetPayloadType() != PvPayloadTypeImage )
+    {
+        std::cout << "ImperxStream::Retrieve No image in buffer" << std::endl;
+        failedBuffers++;
+        lPipeline.ReleaseBuffer( lBuffer );
+        return 1;
+    }
+
+    // Hand out a view of the buffer, which goes back to the pipeline when
+    // the frame is released
+    PvImage *lImage = lBuffer->GetImage();
+    frame.image = cv::Mat((int) lImage->GetHeight(), (int) lImage->GetWidth(), CV_8UC1,
+                          lImage->GetDataPointer(), cv::Mat::AUTO_STEP);
+    frame.blockID = lBlockID;
+    clock_gettime(CLOCK_REALTIME, &frame.arrival);
+    frame.lPipeline = &lPipeline;
+    frame.lBuffer = lBuffer;
+
+    // Readout starts as the exposure ends
+    PvUInt64 lTimestamp = lBuffer->GetTimestamp();
+    if (timestampValid && lTimestamp != 0)
+        frame.exposure = Offset(latchTime, (double)(PvInt64)(lTimestamp - latchTicks) / tickFrequency);
+    else frame.exposure = frame.arrival;
+    frame.exposure = Offset(frame.exposure, -exposureTime / 2e6);
+
+    if (timestampValid && time(NULL) >= nextLatch) timestampValid = LatchTimestamp();
+
+    framesStreamed++;
+    return 0;
+}
+
+bool ImperxStream::LatchTimestamp()
+{
+    PvInt64 lTicks;
+    timespec before, after;
+
+    // Our clock is taken as the middle of the round trip to the camera
+    clock_gettime(CLOCK_REALTIME, &before);
+    PvResult lResult = lDeviceParams->ExecuteCommand( "GevTimestampControlLatch" );
+    clock_gettime(CLOCK_REALTIME, &after);
+
+    if ( !lResult.IsOK()
+         || !lDeviceParams->GetIntegerValue( "GevTimestampValue", lTicks ).IsOK()
+         || !lDeviceParams->GetIntegerValue( "GevTimestampTickFrequency", tickFrequency ).IsOK()
+         || tickFrequency <= 0 )
+    {
+        std::cout << "ImperxStream::LatchTimestamp Failed, using arrival times" << std::endl;
+        return false;
+    }
+
+    latchTicks = lTicks;
+    latchTime = Offset(before, ((after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9) / 2);
+    nextLatch = time(NULL) + TIMESTAMP_RELATCH;
+    return true;
+}
+
+int ImperxStream::Configure(cv::Size size, cv::Point offset, int frameTime)
+{
+    ConfigureStream(frameTime);
+    if (SetROISize(size) != 0 || SetROIOffset(offset) != 0) return -1;
+    return 0;
+}
+
+int ImperxStream::Retrieve(cv::Mat &frame, timespec &captureTime)
+{
+    StreamFrame streamed;
+    if (Retrieve(streamed) != 0) return 1;
+
+    streamed.image.copyTo(frame);
+    captureTime = streamed.exposure;
+    return 0;
+}
+
+void ImperxStream::Report(const char *name)
+{
+    printf("%s: %llu frames, %llu block IDs missed, %llu resyncs, %llu failed, %llu dropped by pipeline\n", name,
+           (unsigned long long)GetFramesStreamed(), (unsigned long long)GetBlockIDGaps(),
+           (unsigned long long)GetBlockIDResyncs(), (unsigned long long)GetFailedBuffers(),
+           (unsigned long long)GetDroppedBuffers());
+}
+
+void ImperxStream::Interrupt()
+{
+    interrupted = true;
+}
+
+PvUInt64 ImperxStream::GetFramesStreamed()
+{
+    return framesStreamed;
+}
+
+PvUInt64 ImperxStream::GetBlockIDGaps()
+{
+    return blockIDGaps;
+}
+
+PvUInt64 ImperxStream::GetBlockIDResyncs()
+{
+    return blockIDResyncs;
+}
+
+PvUInt64 ImperxStream::GetFailedBuffers()
+{
+    return failedBuffers;
+}
+
+PvUInt64 ImperxStream::GetDroppedBuffers()
+{
+    PvInt64 dropped = 0;
+    if (lStreamParams != NULL) lStreamParams->GetIntegerValue( "PipelineBlocksDropped", dropped );
+    return (PvUInt64) dropped;
+}
 
 float ImperxStream::getTemperature()
 {               
@@ -296,6 +592,8 @@ float ImperxStream::getTemperature()
 
 void ImperxStream::Stop()
 {
+    streaming = false;
+
     if (lDeviceParams != NULL)
     {
         // Tell the device to stop sending images
@@ -343,6 +641,27 @@ void ImperxStream::ConfigureSnap()
     lDeviceParams->SetBooleanValue("AgcEnable", false);
 }
 
+void ImperxStream::ConfigureStream(int frameTime)
+{
+    lDeviceParams->SetEnumValue("AcquisitionMode","Continuous");
+    lDeviceParams->SetEnumValue("ExposureMode","Timed");
+    lDeviceParams->SetEnumValue("PixelFormat","Mono8");
+    lDeviceParams->SetBooleanValue("AecEnable", false);
+    lDeviceParams->SetBooleanValue("AgcEnable", false);
+
+    // The programmable frame time holds the camera to a fixed rate, otherwise
+    // it runs as fast as the exposure and readout allow
+    if (frameTime > 0)
+    {
+        lDeviceParams->SetBooleanValue("ProgFrameTimeEnable", true);
+        lDeviceParams->SetIntegerValue("ProgFrameTimeAbs", frameTime);
+    }
+    else
+    {
+        lDeviceParams->SetBooleanValue("ProgFrameTimeEnable", false);
+    }
+}
+
 int ImperxStream::SetExposure(int exposureTime)
 {
     PvResult outcome;
@@ -351,6 +670,7 @@ int ImperxStream::SetExposure(int exposureTime)
         outcome = lDeviceParams->SetIntegerValue("ExposureTimeRaw",exposureTime);
         if (outcome.IsSuccess())
         {
+            this->exposureTime = exposureTime;
             return 0;
         }
     }
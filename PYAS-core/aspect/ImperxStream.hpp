@@ -10,7 +10,39 @@
 #include <string>
 #include <opencv.hpp>
 
-class ImperxStream
+#include "FrameSource.hpp"
+
+/* A frame from the streaming mode that views a pipeline buffer directly.
+   The buffer goes back to the pipeline when the frame is released or goes out
+   of scope, so image must not be used after that.  The pipeline only has so
+   many buffers, so frames should not be held for long.
+*/
+class StreamFrame
+{
+public:
+    StreamFrame();
+    StreamFrame(StreamFrame &&other);
+    StreamFrame &operator=(StreamFrame &&other);
+    ~StreamFrame();
+    void Release();
+    bool empty() const { return lBuffer == NULL; }
+
+    cv::Mat image;
+    PvUInt64 blockID;
+    timespec arrival;   // CLOCK_REALTIME when the frame was retrieved
+    timespec exposure;  // CLOCK_REALTIME at the middle of the exposure, see Retrieve
+
+private:
+    StreamFrame(const StreamFrame &other);              //not copyable
+    StreamFrame &operator=(const StreamFrame &other);   //not copyable
+
+    PvPipeline *lPipeline;
+    PvBuffer *lBuffer;
+
+    friend class ImperxStream;
+};
+
+class ImperxStream : public FrameSource
 {
 public:
     ImperxStream();
@@ -22,6 +54,41 @@ public:
     void ConfigureSnap();
     int Snap(cv::Mat &frame, int timeout);
     int Snap(cv::Mat &frame);
+
+    /* Streaming mode: acquisition starts once and the camera free-runs
+       (frameTime = 0) or produces a frame every frameTime microseconds.
+       Use Retrieve instead of Snap.  Returns 0 on success, 1 on failure.
+    */
+    void ConfigureStream(int frameTime);
+    int StartStream();
+    int Retrieve(StreamFrame &frame, int timeout);
+    int Retrieve(StreamFrame &frame);
+
+    /* A frame's exposure time is worked out from the buffer's timestamp,
+       which the camera takes at the start of readout, i.e., at the end of
+       the exposure, less half the exposure time.  The camera's clock is
+       mapped to CLOCK_REALTIME by latching it at StartStream and every
+       TIMESTAMP_RELATCH seconds.  If it cannot be latched, the arrival time
+       is used instead, which is late by the readout and transfer.
+    */
+
+    /* FrameSource: Configure sets the ROI and sets up streaming, and
+       Retrieve copies the frame out of the pipeline buffer, with the
+       exposure time as its capture time
+    */
+    int Configure(cv::Size size, cv::Point offset, int frameTime);
+    int Retrieve(cv::Mat &frame, timespec &captureTime);
+    void Report(const char *name);
+    /* Makes Retrieve fail within RETRIEVE_SLICE ms, until StartStream */
+    void Interrupt();
+
+    /* Streaming statistics, counted since StartStream */
+    PvUInt64 GetFramesStreamed();
+    PvUInt64 GetBlockIDGaps();      //block IDs skipped between retrieved frames
+    PvUInt64 GetBlockIDResyncs();   //backward jumps in block ID other than wraps
+    PvUInt64 GetFailedBuffers();    //buffers retrieved incomplete or not at all
+    PvUInt64 GetDroppedBuffers();   //blocks dropped by the pipeline for lack of buffers
+
     void Stop();
     void Disconnect();
     
@@ -63,5 +130,22 @@ private:
     PvStream lStream;
     PvGenParameterArray *lStreamParams;
     PvPipeline lPipeline;
+
+    bool streaming;
+    volatile bool interrupted;
+    int exposureTime;       //microseconds, as last set
+
+    bool LatchTimestamp();
+    bool timestampValid;
+    PvInt64 tickFrequency;  //camera timestamp ticks per second
+    PvUInt64 latchTicks;    //camera timestamp at latchTime
+    timespec latchTime;     //CLOCK_REALTIME
+    time_t nextLatch;
+
+    PvUInt64 lastBlockID;
+    PvUInt64 framesStreamed;
+    PvUInt64 blockIDGaps;
+    PvUInt64 blockIDResyncs;
+    PvUInt64 failedBuffers;
 };
 
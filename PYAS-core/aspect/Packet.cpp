@@ -1,14 +1,17 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <new>
+#include <utility>
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <time.h>
+#include <errno.h>
 
 #include "Packet.hpp"
-#include "lib_crc/lib_crc.h"
+#include "crc16.hpp"
 
 #define INDEX_CHECKSUM 6
 
@@ -46,18 +49,181 @@ class ByteStringQueueMutexException : public std::exception
         }
 } bqMutexException;
 
-ByteString::ByteString() : length(0), read_index(0)
+/* Pool of packet buffers
+
+   Blocks are kept on a free list for each power-of-two size class from
+   POOL_MIN_SIZE to PACKET_MAX_SIZE, with the link stored in the block itself.
+   Released blocks are reused rather than freed, up to POOL_MAX_FREE per class.
+*/
+
+#define POOL_MIN_SIZE 32
+#define POOL_CLASSES 6 // 32, 64, 128, 256, 512, 1024
+#define POOL_MAX_FREE 2048
+
+struct PoolBlock {
+    PoolBlock *next;
+};
+
+static PoolBlock *pool_free[POOL_CLASSES];
+static int pool_free_count[POOL_CLASSES];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int pool_class(uint16_t size)
+{
+    int c = 0;
+    while ((c < POOL_CLASSES-1) && ((POOL_MIN_SIZE << c) < size)) c++;
+    return c;
+}
+
+PacketBuffer::PacketBuffer(uint16_t size)
+{
+    if(size > PACKET_MAX_SIZE) throw bsFullException;
+
+    int c = pool_class(size);
+    capacity = POOL_MIN_SIZE << c;
+
+    PoolBlock *block = NULL;
+    pthread_mutex_lock(&pool_mutex);
+    if(pool_free[c] != NULL) {
+        block = pool_free[c];
+        pool_free[c] = block->next;
+        pool_free_count[c]--;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    data = (block != NULL) ? (uint8_t *)block : (uint8_t *)malloc(capacity);
+    if(data == NULL) {
+        capacity = 0;
+        throw std::bad_alloc();
+    }
+}
+
+PacketBuffer::PacketBuffer(PacketBuffer &&other) : data(other.data), capacity(other.capacity)
+{
+    other.data = NULL;
+    other.capacity = 0;
+}
+
+PacketBuffer::~PacketBuffer()
+{
+    release();
+}
+
+PacketBuffer &PacketBuffer::operator=(PacketBuffer &&other)
+{
+    if(this != &other) {
+        release();
+        data = other.data;
+        capacity = other.capacity;
+        other.data = NULL;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+void PacketBuffer::release()
+{
+    if(data == NULL) return;
+
+    int c = pool_class(capacity);
+    bool keep = false;
+
+    pthread_mutex_lock(&pool_mutex);
+    if(pool_free_count[c] < POOL_MAX_FREE) {
+        PoolBlock *block = (PoolBlock *)data;
+        block->next = pool_free[c];
+        pool_free[c] = block;
+        pool_free_count[c]++;
+        keep = true;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if(!keep) free(data);
+    data = NULL;
+    capacity = 0;
+}
+
+ByteString::ByteString() : length(0), read_index(0), running_crc(CRC16_INIT)
 {
+    time_stamp.tv_sec = 0;
+    time_stamp.tv_nsec = 0;
 }
 
-ByteString::ByteString(const char *str) : length(0), read_index(0)
+ByteString::ByteString(const char *str) : length(0), read_index(0), running_crc(CRC16_INIT)
 {
+    time_stamp.tv_sec = 0;
+    time_stamp.tv_nsec = 0;
     std::string sstr(str);
     for (uint16_t i=0;i<(uint16_t)sstr.length()/2;i++) {
         *this << (uint8_t)strtol(sstr.substr(i*2, 2).c_str(), NULL, 16);
     }
 }
 
+ByteString::ByteString(const ByteString &other)
+    : length(0), read_index(other.read_index), running_crc(other.running_crc),
+      time_stamp(other.time_stamp)
+{
+    if(other.length > 0) {
+        buffer = PacketBuffer(other.length);
+        memcpy(buffer.getData(), other.buffer.getData(), other.length);
+        length = other.length;
+    }
+}
+
+ByteString::ByteString(ByteString &&other)
+    : buffer(std::move(other.buffer)), length(other.length),
+      read_index(other.read_index), running_crc(other.running_crc),
+      time_stamp(other.time_stamp)
+{
+    other.length = 0;
+    other.read_index = 0;
+    other.running_crc = CRC16_INIT;
+}
+
+ByteString &ByteString::operator=(const ByteString &other)
+{
+    if(this != &other) {
+        //Reuse the current block if it is big enough
+        if(other.length > buffer.getCapacity()) buffer = PacketBuffer(other.length);
+        if(other.length > 0) memcpy(buffer.getData(), other.buffer.getData(), other.length);
+        length = other.length;
+        read_index = other.read_index;
+        running_crc = other.running_crc;
+        time_stamp = other.time_stamp;
+    }
+    return *this;
+}
+
+ByteString &ByteString::operator=(ByteString &&other)
+{
+    if(this != &other) {
+        buffer = std::move(other.buffer);
+        length = other.length;
+        read_index = other.read_index;
+        running_crc = other.running_crc;
+        time_stamp = other.time_stamp;
+        other.length = 0;
+        other.read_index = 0;
+        other.running_crc = CRC16_INIT;
+    }
+    return *this;
+}
+
+void ByteString::grow(uint16_t num)
+{
+    if(num <= buffer.getCapacity()) return;
+
+    PacketBuffer larger(num);
+    if(length > 0) memcpy(larger.getData(), buffer.getData(), length);
+    buffer = std::move(larger);
+}
+
+void ByteString::reserve(uint16_t num)
+{
+    if(num > PACKET_MAX_SIZE) throw bsFullException;
+    grow(num);
+}
+
 template <class T>
 void ByteString::append(const T& value)
 {
@@ -67,21 +233,40 @@ void ByteString::append(const T& value)
 template <>
 void ByteString::append<ByteString>(const ByteString& bs)
 {
-    append_bytes(bs.buffer, bs.length);
+    append_bytes(bs.buffer.getData(), bs.length);
 }
 
 void ByteString::append_bytes(const void *ptr, uint16_t num)
 {
     if(length+num > PACKET_MAX_SIZE) throw bsFullException;
-    memcpy(buffer+length, ptr, num);
+    grow(length+num);
+    memcpy(buffer.getData()+length, ptr, num);
+    running_crc = crc16_update(running_crc, ptr, num);
     length += num;
 }
 
 template <class T>
 void ByteString::replace(uint16_t loc, const T& value)
 {
-    if(loc+sizeof(value) > length) throw bsAccessException;
-    memcpy(buffer+loc, &value, sizeof(value));
+    replace_bytes(loc, &value, sizeof(value));
+}
+
+void ByteString::replace_bytes(uint16_t loc, const void *ptr, uint16_t num)
+{
+    if(loc+num > length) throw bsAccessException;
+
+    //The CRC is linear, so the change in the CRC is the CRC (from zero) of the
+    //XOR of the old and new bytes, advanced over the rest of the buffer
+    uint8_t *dest = buffer.getData()+loc;
+    const uint8_t *src = (const uint8_t *)ptr;
+    uint16_t delta = 0;
+    for(uint16_t i=0;i<num;i++) {
+        uint8_t diff = dest[i] ^ src[i];
+        delta = crc16_update_sliced(delta, &diff, 1);
+    }
+    if(delta != 0) running_crc ^= crc16_shift(delta, length-loc-num);
+
+    memcpy(dest, ptr, num);
 }
 
 template <class T>
@@ -93,7 +278,7 @@ void ByteString::readAtTo(uint16_t loc, T& value)
 void ByteString::readAtTo_bytes(uint16_t loc, void *ptr, uint16_t num)
 {
     if(loc+num > length) throw bsAccessException;
-    memcpy(ptr, buffer+loc, num);
+    memcpy(ptr, buffer.getData()+loc, num);
 }
 
 uint16_t ByteString::getReadIndex()
@@ -122,12 +307,18 @@ void ByteString::readNextTo_bytes(void *ptr, uint16_t num)
 void ByteString::clear()
 {
     length = 0;
+    running_crc = CRC16_INIT;
+}
+
+void ByteString::stamp()
+{
+    clock_gettime(CLOCK_MONOTONIC, &time_stamp);
 }
 
 uint16_t ByteString::outputTo(uint8_t dest[])
 {
     finish();
-    memcpy(dest, buffer, length);
+    memcpy(dest, buffer.getData(), length);
     return length;
 }
 
@@ -138,7 +329,7 @@ ostream& operator<<(ostream& os, ByteString& bs)
 {
     bs.finish();
     for (uint16_t i=0;i<bs.length;i++) {
-        os << pkt::byte << (int)bs.buffer[i]; //hex output does not work on uint8_t
+        os << pkt::byte << (int)bs.buffer.getData()[i]; //hex output does not work on uint8_t
     }
     return os << pkt::reset;
 }
@@ -160,12 +351,22 @@ ByteString& operator>><uint8_t *>(ByteString& bs, uint8_t *&dest)
 
 uint16_t ByteString::checksum()
 {
-    unsigned short value = 0xffff;
-    for(uint16_t i=0;i<length;i++) value = update_crc_16(value, (char)buffer[i]);
+    uint16_t value = running_crc;
     //Flip the byte order for the checksum for writing as a word
     return ((value & 0xff) << 8) | (value >> 8);
 }
 
+uint16_t ByteString::checksum(uint16_t loc, uint16_t num)
+{
+    if(loc+num > length) throw bsAccessException;
+
+    //Remove the contribution of those bytes, as in replace_bytes()
+    uint16_t value = running_crc;
+    uint16_t delta = crc16_update(0, buffer.getData()+loc, num);
+    if(delta != 0) value ^= crc16_shift(delta, length-loc-num);
+    return ((value & 0xff) << 8) | (value >> 8);
+}
+
 Packet::Packet()
 {
     *this << PACKET_HEROES_SYNC_WORD;
@@ -194,43 +395,64 @@ bool Packet::valid()
     uint16_t alleged_checksum;
     //All packets should have the checksum at bytes 6 and 7
     this->readAtTo(INDEX_CHECKSUM, alleged_checksum);
-    this->replace(INDEX_CHECKSUM, (uint16_t)0);
-    bool checksum_valid = (this->checksum() == alleged_checksum);
-    this->replace(INDEX_CHECKSUM, alleged_checksum);
+    //The checksum was computed with its own field zeroed
+    bool checksum_valid = (this->checksum(INDEX_CHECKSUM, sizeof(alleged_checksum)) == alleged_checksum);
 
     return syncword_valid && checksum_valid;
 }
 
 ByteStringQueue::ByteStringQueue()
 {
-    if(pthread_mutex_init(&flag, NULL) != 0) {
-        throw bqMutexException;
-    }
+    init_sync();
+}
+
+ByteStringQueue::ByteStringQueue(const ByteStringQueue &other) : std::list<ByteString>(other)
+{
+    init_sync();
 }
 
 ByteStringQueue::~ByteStringQueue()
 {
+    pthread_cond_destroy(&cond);
     pthread_mutex_destroy(&flag);
 }
 
-int ByteStringQueue::lock()
+ByteStringQueue &ByteStringQueue::operator=(const ByteStringQueue &other)
 {
-    struct timespec interval;
-    interval.tv_sec = 0;
-    interval.tv_nsec = 5000000;
+    if(this != &other) {
+        lock();
+        std::list<ByteString>::operator=(other);
+        if(!empty()) pthread_cond_broadcast(&cond);
+        unlock();
+    }
+    return *this;
+}
 
-    int status = -1;
+void ByteStringQueue::init_sync()
+{
+    wake_count = 0;
 
-    int attempts = 1;
-    int result = pthread_mutex_trylock(&flag);
+    if(pthread_mutex_init(&flag, NULL) != 0) {
+        throw bqMutexException;
+    }
 
-    while ((result != 0) && (attempts < 50)) {
-        while (status == -1) status = nanosleep(&interval, NULL);
-        status = -1;
+    //Timed waits are measured against the monotonic clock so that setting the
+    //system time does not stretch or cut short a timeout
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int result = pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
 
-        attempts++;
-        result = pthread_mutex_trylock(&flag);
+    if(result != 0) {
+        pthread_mutex_destroy(&flag);
+        throw bqMutexException;
     }
+}
+
+int ByteStringQueue::lock()
+{
+    int result = pthread_mutex_lock(&flag);
 
     if (result != 0) {
         throw bqMutexException;
@@ -250,11 +472,94 @@ int ByteStringQueue::unlock()
     return result;
 }
 
+//Waiting on the condition is a cancellation point, and a cancelled thread
+//reacquires the mutex, so it must be released on the way out
+static void unlock_on_cancel(void *mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+bool ByteStringQueue::wait_locked(long usec)
+{
+    unsigned int start_count = wake_count;
+    bool available;
+
+    pthread_cleanup_push(unlock_on_cancel, &flag);
+
+    if(usec < 0) {
+        while(empty() && (wake_count == start_count)) pthread_cond_wait(&cond, &flag);
+    } else {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += usec / 1000000;
+        deadline.tv_nsec += (usec % 1000000) * 1000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        int result = 0;
+        while(empty() && (wake_count == start_count) && (result != ETIMEDOUT)) {
+            result = pthread_cond_timedwait(&cond, &flag, &deadline);
+        }
+    }
+    available = !empty();
+
+    pthread_cleanup_pop(0);
+
+    return available;
+}
+
+bool ByteStringQueue::pop(ByteString &bs, long usec)
+{
+    lock();
+
+    bool available = wait_locked(usec);
+    if(available) {
+        bs = std::move(front());
+        pop_front();
+    }
+
+    unlock();
+
+    return available;
+}
+
+bool ByteStringQueue::wait(long usec)
+{
+    lock();
+    bool available = wait_locked(usec);
+    unlock();
+
+    return available;
+}
+
+void ByteStringQueue::wake()
+{
+    lock();
+    wake_count++;
+    pthread_cond_broadcast(&cond);
+    unlock();
+}
+
 ByteStringQueue &operator<<(ByteStringQueue &bq, const ByteString &bs)
 {
     bq.lock();
 
     bq.push_back(bs);
+    pthread_cond_broadcast(&bq.cond);
+
+    bq.unlock();
+
+    return bq;
+}
+
+ByteStringQueue &operator<<(ByteStringQueue &bq, ByteString &&bs)
+{
+    bq.lock();
+
+    bq.push_back(std::move(bs));
+    pthread_cond_broadcast(&bq.cond);
 
     bq.unlock();
 
@@ -266,7 +571,9 @@ ByteStringQueue &operator<<(ByteStringQueue &bq, ByteStringQueue &other)
     bq.lock();
     other.lock();
 
+    bool added = !other.empty();
     bq.splice(bq.end(), other);
+    if(added) pthread_cond_broadcast(&bq.cond);
 
     other.unlock();
     bq.unlock();
@@ -281,7 +588,10 @@ ostream &operator<<(ostream &os, ByteStringQueue &bq)
 
     bq.lock();
 
-    if(bq.empty()) throw bqEmptyException;
+    if(bq.empty()) {
+        bq.unlock();
+        throw bqEmptyException;
+    }
     int i = 0;
     for (ByteStringQueue::iterator it=bq.begin(); it != bq.end(); ++it) {
         os << ++i << ": " << *it << std::endl;
@@ -296,8 +606,11 @@ ByteStringQueue &operator>>(ByteStringQueue &bq, ByteString &bs)
 {
     bq.lock();
 
-    if(bq.empty()) throw bqEmptyException;
-    bs = bq.front();
+    if(bq.empty()) {
+        bq.unlock();
+        throw bqEmptyException;
+    }
+    bs = std::move(bq.front());
     bq.pop_front();
 
     bq.unlock();
@@ -1,6 +1,6 @@
 /*
 
-  ByteString, Packet, and ByteStringQueue
+  PacketBuffer, ByteString, Packet, and ByteStringQueue
 
   These are base classes used by Command* and Telemetry* classes.  See the
   documentation for those classes for examples of usage.  Private variables
@@ -25,13 +25,39 @@
   The necessary size can be retrieved by getLength(), or just use a large enough
   destination array.
 
+  The bytes of a ByteString live in a PacketBuffer, a move-only handle to a block
+  from a shared pool.  Blocks come in power-of-two size classes up to
+  PACKET_MAX_SIZE, so a short ack only occupies a small block, and the block is
+  swapped for a larger one as data is appended (use reserve() to avoid this when
+  the final length is known).  Copying a ByteString copies only getLength()
+  bytes, and moving a ByteString transfers the handle without copying anything.
+  Inserting an rvalue into a ByteStringQueue, and extracting from one, move the
+  handle, so use std::move() when the source is no longer needed:
+      tm_packet_queue << std::move(tp);
+
+  The CRC-16 checksum of the buffer is updated incrementally (see crc16.hpp) as
+  bytes are appended or replaced, so checksum() is immediate.
+
   For convenience when testing, the ByteString can be inserted into an ostream for
   hexadecimal output.
 
+  A ByteString also carries a monotonic-clock stamp that is not part of the
+  buffer.  Call stamp() when the data is received or created, and it travels with
+  copies of the ByteString through the queues so that latency can be measured
+  downstream with getStamp().
+
   The ByteStringQueue class protects the insertion and extraction operators with
   mutex locking and unlocking.  If the queue is locked when attempting an
-  operation, the operation will be blocked for up to 250 ms.  If the timeout is
-  reach, an exception will be thrown.
+  operation, the operation will block until the lock is released.
+
+  Consumers do not need to poll empty() on a timer.  pop() blocks until an entry
+  is available and extracts it, and wait() blocks until the queue is non-empty
+  without extracting anything.  Both take a timeout in microseconds (negative to
+  wait indefinitely) and return false if nothing arrived in time.  Every
+  insertion wakes blocked consumers immediately, and wake() can be used to
+  release them early (e.g., when shutting down).
+      ByteString bs;
+      if (queue.pop(bs, 50000)) { ... }
 
   A variety of exceptions, derived from std::exception, can be thrown.
 
@@ -52,16 +78,47 @@
 #include <list>
 #include <stdint.h>
 #include <pthread.h>
+#include <time.h>
 
 #define PACKET_MAX_SIZE 1024
 #define PACKET_HEROES_SYNC_WORD (uint16_t)0xc39a
 
+//Move-only handle to a pooled block of at least the requested size
+class PacketBuffer {
+private:
+    uint8_t *data;
+    uint16_t capacity;
+
+    PacketBuffer(const PacketBuffer &other);            //not copyable
+    PacketBuffer &operator=(const PacketBuffer &other); //not copyable
+
+public:
+    PacketBuffer() : data(NULL), capacity(0) {};
+    explicit PacketBuffer(uint16_t size);
+    PacketBuffer(PacketBuffer &&other);
+    ~PacketBuffer();
+
+    PacketBuffer &operator=(PacketBuffer &&other);
+
+    uint8_t *getData() { return data; }
+    const uint8_t *getData() const { return data; }
+    uint16_t getCapacity() const { return capacity; }
+
+    //Returns the block to the pool
+    void release();
+};
+
 //Useful base class, may wish to break out
 class ByteString {
 private:
-    uint8_t buffer[PACKET_MAX_SIZE];
+    PacketBuffer buffer;
     uint16_t length;
     uint16_t read_index;
+    uint16_t running_crc; //CRC register over the whole buffer, kept up to date
+    timespec time_stamp;
+
+    //Ensures the buffer can hold at least num bytes
+    void grow(uint16_t num);
 
 protected:
     //A hook to allow derived classes to apply finishing touches to the buffer
@@ -71,15 +128,24 @@ protected:
 public:
     ByteString();
     ByteString(const char *str); //from a null-terminated hexadecimal string
+    ByteString(const ByteString &other);
+    ByteString(ByteString &&other);
+
+    ByteString &operator=(const ByteString &other);
+    ByteString &operator=(ByteString &&other);
 
     uint16_t getLength() { return length; }
 
+    //Preallocates for a total length of num bytes
+    void reserve(uint16_t num);
+
     //Appending to the end
     void append_bytes(const void *ptr, uint16_t num);
     template <class T>
     void append(const T& value);
 
     //Replacing at a specific location
+    void replace_bytes(uint16_t loc, const void *ptr, uint16_t num);
     template <class T>
     void replace(uint16_t loc, const T& value);
 
@@ -99,10 +165,19 @@ public:
     //Output the entire buffer to an array
     uint16_t outputTo(uint8_t dest[]);
 
+    //The checksum is maintained as bytes are appended or replaced, so these
+    //do not need to revisit the buffer
     uint16_t checksum();
+    //The checksum as if num bytes at loc were zero, without modifying the buffer
+    uint16_t checksum(uint16_t loc, uint16_t num);
 
     void clear();
 
+    //Stamping with CLOCK_MONOTONIC, not included in the buffer
+    void stamp();
+    void setStamp(const timespec &ts) { time_stamp = ts; }
+    timespec getStamp() { return time_stamp; }
+
     //insertion operator <<
     //Overloaded for appending and for stream output
     template <class T>
@@ -131,18 +206,41 @@ public:
 class ByteStringQueue : public std::list<ByteString> {
 private:
     pthread_mutex_t flag;
+    pthread_cond_t cond;
+    unsigned int wake_count;
+
+    void init_sync();
+
+    //Blocks while the queue is locked and empty, returns true if non-empty
+    //Must be called with the queue locked
+    bool wait_locked(long usec);
 
 public:
     ByteStringQueue();
+    ByteStringQueue(const ByteStringQueue &other);
     ~ByteStringQueue();
 
+    //Only the entries are copied, each queue keeps its own mutex
+    ByteStringQueue &operator=(const ByteStringQueue &other);
+
     //Mutex-based locking of the queue
     int lock();
     int unlock();
 
+    //Blocking extraction, returns false if the timeout (in us) was reached
+    //or wake() was called before an entry became available
+    bool pop(ByteString &bs, long usec = -1);
+
+    //Blocks until the queue is non-empty, without extracting
+    bool wait(long usec = -1);
+
+    //Releases all threads blocked in pop() or wait()
+    void wake();
+
     //insertion operator <<
     //If a queue is inserted, the source queue will be emptied
     friend ByteStringQueue &operator<<(ByteStringQueue &bq, const ByteString &bs);
+    friend ByteStringQueue &operator<<(ByteStringQueue &bq, ByteString &&bs);
     friend ByteStringQueue &operator<<(ByteStringQueue &bq, ByteStringQueue &other);
 
     //insertion operator << for ostream
@@ -0,0 +1,284 @@
+#include "PeakFinder.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PEAK_SIMD
+#include <emmintrin.h>  /* for SSE2 intrinsics */
+#endif
+
+#ifdef PEAK_SIMD
+static bool PeakHasSSE2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static bool peak_use_sse2 = PeakHasSSE2();
+
+//Minimum, maximum, sum, and sum of squares of blocks of 4 pixels of a row,
+//returning the number of pixels covered
+__attribute__((target("sse2")))
+static int RowStatisticsSSE2(const float *row, int width, float &min, float &max, double &sum, double &sumSquares)
+{
+    __m128 lo = _mm_set1_ps(min), hi = _mm_set1_ps(max);
+    __m128d s = _mm_setzero_pd(), ss = _mm_setzero_pd();
+    double partial[2];
+    float extreme[4];
+    int n;
+
+    for (n = 0; n + 4 <= width; n += 4)
+    {
+        __m128 pixels = _mm_loadu_ps(row + n);
+        __m128d first = _mm_cvtps_pd(pixels);
+        __m128d second = _mm_cvtps_pd(_mm_movehl_ps(pixels, pixels));
+        lo = _mm_min_ps(lo, pixels);
+        hi = _mm_max_ps(hi, pixels);
+        s = _mm_add_pd(s, _mm_add_pd(first, second));
+        ss = _mm_add_pd(ss, _mm_add_pd(_mm_mul_pd(first, first), _mm_mul_pd(second, second)));
+    }
+
+    _mm_storeu_ps(extreme, lo);
+    for (int k = 0; k < 4; k++) if (extreme[k] < min) min = extreme[k];
+    _mm_storeu_ps(extreme, hi);
+    for (int k = 0; k < 4; k++) if (extreme[k] > max) max = extreme[k];
+    _mm_storeu_pd(partial, s);
+    sum += partial[0] + partial[1];
+    _mm_storeu_pd(partial, ss);
+    sumSquares += partial[0] + partial[1];
+    return n;
+}
+
+//Marks, in bit b of the result, whether pixel n+b of row is above threshold
+//and greater than its 8 neighbors, for 4 pixels
+__attribute__((target("sse2")))
+static int LocalMaximaSSE2(const float *above, const float *row, const float *below, int n, __m128 threshold)
+{
+    __m128 center = _mm_loadu_ps(row + n);
+    __m128 mask = _mm_cmpgt_ps(center, threshold);
+    if (_mm_movemask_ps(mask) == 0) return 0;
+
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(row + n - 1)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(row + n + 1)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(above + n - 1)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(above + n)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(above + n + 1)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(below + n - 1)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(below + n)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(center, _mm_loadu_ps(below + n + 1)));
+    return _mm_movemask_ps(mask);
+}
+#endif
+
+PeakFinder::PeakFinder()
+{
+    min = max = mean = stddev = 0;
+    cellSize = 1;
+    gridWidth = 0;
+}
+
+int PeakFinder::find(const cv::Mat &image, float sigma, int separation, int count)
+{
+    cv::Size imageSize = image.size();
+    float threshold, value;
+    int n;
+
+    locations.clear();
+    values.clear();
+    heap.clear();
+    heapIndex.clear();
+    if (image.empty()) return 0;
+
+    Statistics(image);
+    threshold = mean + sigma*stddev;
+    if (count <= 0) return 0;
+
+    cellSize = (separation > 1) ? separation : 1;
+    gridWidth = (imageSize.width + cellSize - 1)/cellSize;
+    cells.assign(gridWidth*((imageSize.height + cellSize - 1)/cellSize), -1);
+    next.clear();
+
+#ifdef PEAK_SIMD
+    __m128 level = _mm_set1_ps(threshold);
+#endif
+
+    for (int m = 1; m < imageSize.height-1; m++)
+    {
+        const float *above = image.ptr<float>(m-1);
+        const float *row = image.ptr<float>(m);
+        const float *below = image.ptr<float>(m+1);
+        n = 1;
+
+#ifdef PEAK_SIMD
+        if (peak_use_sse2)
+        {
+            for (; n + 4 <= imageSize.width-1; n += 4)
+            {
+                int maxima = LocalMaximaSSE2(above, row, below, n, level);
+                for (int b = 0; b < 4; b++)
+                    if (maxima & (1 << b)) Consider(m, n+b, row[n+b], separation, count);
+            }
+        }
+#endif
+
+        for (; n < imageSize.width-1; n++)
+        {
+            value = row[n];
+            if (value > threshold &&
+                value > row[n-1] && value > row[n+1] &&
+                value > above[n-1] && value > above[n] && value > above[n+1] &&
+                value > below[n-1] && value > below[n] && value > below[n+1])
+            {
+                Consider(m, n, value, separation, count);
+            }
+        }
+    }
+    return locations.size();
+}
+
+void PeakFinder::Statistics(const cv::Mat &image)
+{
+    double sum = 0, sumSquares = 0, total;
+    int n;
+
+    min = image.at<float>(0, 0);
+    max = min;
+    for (int m = 0; m < image.rows; m++)
+    {
+        const float *row = image.ptr<float>(m);
+        n = 0;
+#ifdef PEAK_SIMD
+        if (peak_use_sse2) n = RowStatisticsSSE2(row, image.cols, min, max, sum, sumSquares);
+#endif
+        for (; n < image.cols; n++)
+        {
+            if (row[n] < min) min = row[n];
+            if (row[n] > max) max = row[n];
+            sum += row[n];
+            sumSquares += (double) row[n]*row[n];
+        }
+    }
+
+    total = image.total();
+    mean = sum/total;
+    stddev = sqrt(std::max(0.0, sumSquares/total - (sum/total)*(sum/total)));
+}
+
+void PeakFinder::Consider(int m, int n, float value, int separation, int count)
+{
+    int match = -1, cm, cn, k;
+
+    //Look for a kept peak nearby, which can only be in the neighboring cells
+    cm = m/cellSize;
+    cn = n/cellSize;
+    for (int i = cm-1; i <= cm+1; i++)
+    {
+        for (int j = cn-1; j <= cn+1; j++)
+        {
+            if (i < 0 || j < 0 || j >= gridWidth || (i+1)*gridWidth > (int) cells.size()) continue;
+            for (k = cells[i*gridWidth + j]; k >= 0; k = next[k])
+            {
+                if (abs(locations[k].y - m) < separation && abs(locations[k].x - n) < separation &&
+                    (match < 0 || k < match))
+                {
+                    match = k;
+                }
+            }
+        }
+    }
+
+    //Move the nearby peak here if this one is stronger
+    if (match >= 0)
+    {
+        if (value > values[match])
+        {
+            GridRemove(match);
+            locations[match] = cv::Point(n, m);
+            values[match] = value;
+            GridInsert(match);
+            SiftDown(heapIndex[match]);
+        }
+        return;
+    }
+
+    //Keep the peak if there is room
+    if ((int) locations.size() < count)
+    {
+        k = locations.size();
+        locations.push_back(cv::Point(n, m));
+        values.push_back(value);
+        next.push_back(-1);
+        heapIndex.push_back(heap.size());
+        heap.push_back(k);
+        GridInsert(k);
+        SiftUp(heapIndex[k]);
+    }
+    //Otherwise, replace the weakest if this is stronger
+    else if (value > values[heap[0]])
+    {
+        k = heap[0];
+        GridRemove(k);
+        locations[k] = cv::Point(n, m);
+        values[k] = value;
+        GridInsert(k);
+        SiftDown(0);
+    }
+}
+
+int PeakFinder::Cell(cv::Point location) const
+{
+    return (location.y/cellSize)*gridWidth + location.x/cellSize;
+}
+
+void PeakFinder::GridInsert(int k)
+{
+    int cell = Cell(locations[k]);
+    next[k] = cells[cell];
+    cells[cell] = k;
+}
+
+void PeakFinder::GridRemove(int k)
+{
+    int *link = &cells[Cell(locations[k])];
+    while (*link != k) link = &next[*link];
+    *link = next[k];
+}
+
+bool PeakFinder::Weaker(int a, int b) const
+{
+    return values[a] < values[b] || (values[a] == values[b] && a < b);
+}
+
+void PeakFinder::SiftDown(int position)
+{
+    int N = heap.size();
+    int child;
+
+    for (;;)
+    {
+        child = 2*position + 1;
+        if (child >= N) break;
+        if (child + 1 < N && Weaker(heap[child+1], heap[child])) child++;
+        if (!Weaker(heap[child], heap[position])) break;
+        std::swap(heap[child], heap[position]);
+        heapIndex[heap[child]] = child;
+        heapIndex[heap[position]] = position;
+        position = child;
+    }
+}
+
+void PeakFinder::SiftUp(int position)
+{
+    int parent;
+
+    while (position > 0)
+    {
+        parent = (position - 1)/2;
+        if (!Weaker(heap[position], heap[parent])) break;
+        std::swap(heap[parent], heap[position]);
+        heapIndex[heap[parent]] = parent;
+        heapIndex[heap[position]] = position;
+        position = parent;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+
+  PeakFinder
+
+  Finds the strongest local maxima of a CV_32FC1 image, such as the fiducial
+  correlation in Aspect::FindPixelFiducials.
+
+  One pass over the image gathers its minimum, maximum, mean, and standard
+  deviation.  A second pass finds the pixels above mean + sigma*stddev that
+  are greater than all 8 of their neighbors, 4 at a time with SSE2, skipping
+  the outermost rows and columns.  The peaks are taken in raster order:
+    - a peak within separation pixels in both x and y of one already kept
+      replaces it if it is stronger, and is otherwise dropped
+    - while fewer than count peaks are kept, a new peak is added
+    - after that, a new peak replaces the weakest kept peak if it is stronger
+  The kept peaks are in a heap ordered by strength and a grid of
+  separation-sized cells, so each peak costs log(count) rather than count.
+
+      PeakFinder finder;
+      finder.find(correlation, 5, 15, 10);
+      for (int k = 0; k < finder.size(); k++) finder[k] ...
+
+  Memory is kept between calls, so finding peaks in same-sized images does
+  not allocate.
+
+*/
+
+#ifndef _PEAKFINDER_HPP_
+#define _PEAKFINDER_HPP_
+
+#include <opencv.hpp>
+#include <vector>
+
+class PeakFinder
+{
+public:
+    PeakFinder();
+
+    //Returns the number of peaks found, at most count
+    int find(const cv::Mat &image, float sigma, int separation, int count);
+
+    //The peaks, in the order they were first kept
+    int size() const { return locations.size(); };
+    cv::Point operator[](int k) const { return locations[k]; };
+    float value(int k) const { return values[k]; };
+
+    //Statistics of the image from the last call to find()
+    float getMin() const { return min; };
+    float getMax() const { return max; };
+    float getMean() const { return mean; };
+    float getStdDev() const { return stddev; };
+
+private:
+    float min, max, mean, stddev;
+
+    std::vector<cv::Point> locations;
+    std::vector<float> values;
+
+    //Min-heap of peak indices, ordered by value and then index
+    std::vector<int> heap, heapIndex;
+
+    //Peaks in each cell of the grid, as linked lists through next
+    int cellSize, gridWidth;
+    std::vector<int> cells, next;
+
+    void Statistics(const cv::Mat &image);
+    void Consider(int m, int n, float value, int separation, int count);
+
+    int Cell(cv::Point location) const;
+    void GridInsert(int k);
+    void GridRemove(int k);
+
+    bool Weaker(int a, int b) const;
+    void SiftDown(int position);
+    void SiftUp(int position);
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "PeriodicTask.hpp"
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+double Microseconds(const timespec &start, const timespec &end)
+{
+    return (end.tv_sec - start.tv_sec)*1e6 + (end.tv_nsec - start.tv_nsec)/1e3;
+}
+
+static void Advance(timespec &time, int64_t nanoseconds)
+{
+    int64_t nsec = time.tv_nsec + nanoseconds % 1000000000LL;
+
+    time.tv_sec += nanoseconds / 1000000000LL + nsec / 1000000000LL;
+    time.tv_nsec = nsec % 1000000000LL;
+}
+
+static bool Before(const timespec &a, const timespec &b)
+{
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+//Sleeps until deadline on CLOCK_MONOTONIC, returning false if wakeFd became
+//readable first
+static bool SleepUntil(const timespec &deadline, int wakeFd)
+{
+    timespec now, remaining;
+    pollfd wake = {wakeFd, POLLIN, 0};
+
+    if (wakeFd < 0)
+    {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+        return true;
+    }
+
+    //ppoll() only takes a relative timeout
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (Before(now, deadline))
+    {
+        remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+        remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (remaining.tv_nsec < 0)
+        {
+            remaining.tv_sec--;
+            remaining.tv_nsec += 1000000000L;
+        }
+        if (ppoll(&wake, 1, &remaining, NULL) > 0) return false;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    return true;
+}
+
+void TimingHistogram::clear()
+{
+    for (int k = 0; k < TIMING_BINS; k++) bins[k] = 0;
+    count = 0;
+    sum = max = 0;
+}
+
+void TimingHistogram::add(double usec)
+{
+    int bin = 0;
+
+    if (usec < 0) usec = 0;
+    while (bin < TIMING_BINS - 1 && usec >= (double) (2L << bin)) bin++;
+    bins[bin]++;
+    if (count == 0 || usec > max) max = usec;
+    sum += usec;
+    count++;
+}
+
+//Prints the bins with anything in them, by their upper bound
+static void PrintBins(const TimingHistogram &histogram)
+{
+    for (int k = 0; k < TIMING_BINS - 1; k++)
+        if (histogram.bins[k]) printf(" <%ld:%lu", 2L << k, histogram.bins[k]);
+    if (histogram.bins[TIMING_BINS-1])
+        printf(" >=%ld:%lu", 1L << (TIMING_BINS-1), histogram.bins[TIMING_BINS-1]);
+}
+
+PeriodicTask::PeriodicTask(const char *name, long period, Policy policy)
+    : name(name)
+    , period((int64_t) period*1000)
+    , policy(policy)
+    , running(false)
+    , missed(0)
+{
+    deadline.tv_sec = woke.tv_sec = 0;
+    deadline.tv_nsec = woke.tv_nsec = 0;
+    pthread_mutex_init(&mutex, NULL);
+}
+
+PeriodicTask::~PeriodicTask()
+{
+    pthread_mutex_destroy(&mutex);
+}
+
+void PeriodicTask::setPeriod(long period)
+{
+    this->period = (int64_t) period*1000;
+}
+
+void PeriodicTask::start()
+{
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    woke = deadline;
+    running = true;
+    clear();
+}
+
+int PeriodicTask::wait(int wakeFd)
+{
+    timespec now;
+    int64_t behind = 0;
+    int late;
+
+    if (!running) start();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mutex);
+    execution.add(Microseconds(woke, now));
+    pthread_mutex_unlock(&mutex);
+
+    //Count the deadlines that have already passed
+    Advance(deadline, period);
+    if (Before(deadline, now)) behind = (int64_t) (Microseconds(deadline, now)*1000/period) + 1;
+
+    //Run this period late right away while catching up, otherwise skip to
+    //the first deadline still ahead and sleep until it
+    if (policy == CATCH_UP && behind > 0 && behind <= PERIODIC_MAX_CATCH_UP)
+    {
+        late = 1;
+    }
+    else
+    {
+        late = (int) behind;
+        Advance(deadline, behind*period);
+        if (!SleepUntil(deadline, wakeFd))
+        {
+            clock_gettime(CLOCK_MONOTONIC, &woke);
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &woke);
+
+    pthread_mutex_lock(&mutex);
+    jitter.add(Microseconds(deadline, woke));
+    missed += late;
+    pthread_mutex_unlock(&mutex);
+    return late;
+}
+
+void PeriodicTask::getStatistics(TimingHistogram &jitter, TimingHistogram &execution, unsigned long &missed)
+{
+    pthread_mutex_lock(&mutex);
+    jitter = this->jitter;
+    execution = this->execution;
+    missed = this->missed;
+    pthread_mutex_unlock(&mutex);
+}
+
+void PeriodicTask::clear()
+{
+    pthread_mutex_lock(&mutex);
+    jitter.clear();
+    execution.clear();
+    missed = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
+void PeriodicTask::report()
+{
+    TimingHistogram jitter, execution;
+    unsigned long missed;
+
+    getStatistics(jitter, execution, missed);
+    printf("%s: %lu periods of %ld us, %lu missed, jitter mean %.1f us max %.1f us, execution mean %.1f us max %.1f us\n",
+           name, jitter.count, getPeriod(), missed, jitter.mean(), jitter.max, execution.mean(), execution.max);
+    printf("%s jitter (us):", name);
+    PrintBins(jitter);
+    printf("\n%s execution (us):", name);
+    PrintBins(execution);
+    printf("\n");
+}
@@ -0,0 +1,101 @@
+/*
+
+  PeriodicTask and TimingHistogram
+
+  Paces a thread that does something every period, sleeping with
+  clock_nanosleep() until absolute deadlines on CLOCK_MONOTONIC, so that
+  time spent working or oversleeping does not accumulate into drift.  The
+  deadlines are start() plus whole periods.
+
+      PeriodicTask task("TelemetryPackager", 250000);  // microseconds
+      task.start();
+      while (...) {
+          task.wait();
+          ... work ...
+      }
+
+  When the work overruns past one or more deadlines, wait() counts them as
+  missed and, with SKIP, sleeps until the next deadline still ahead, keeping
+  the phase of the schedule.  With CATCH_UP, it returns at once for each
+  missed deadline until the task is back on schedule, unless it has fallen
+  more than PERIODIC_MAX_CATCH_UP periods behind, when it skips instead.
+
+  wait() can also be given a file descriptor, such as a StopToken's, that
+  ends the sleep early when it becomes readable, so that a thread with a long
+  period can still be stopped promptly.
+
+  Each task keeps histograms of its wake-up jitter (how long after its
+  deadline it woke) and execution time (from waking until the next wait()),
+  which another thread can copy with getStatistics() or print with report().
+
+*/
+
+#ifndef _PERIODICTASK_HPP_
+#define _PERIODICTASK_HPP_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TIMING_BINS 20 // histogram bins; bin k counts times under 2^(k+1) us, the last everything longer
+#define PERIODIC_MAX_CATCH_UP 10 // periods a CATCH_UP task can fall behind before skipping
+
+//Microseconds from start to end, negative if end is earlier
+double Microseconds(const timespec &start, const timespec &end);
+
+struct TimingHistogram
+{
+    unsigned long bins[TIMING_BINS];
+    unsigned long count;
+    double sum, max; // microseconds
+
+    TimingHistogram() { clear(); };
+    void clear();
+    void add(double usec);
+    double mean() const { return count ? sum/count : 0; };
+};
+
+class PeriodicTask
+{
+public:
+    enum Policy { SKIP, CATCH_UP };
+
+    PeriodicTask(const char *name, long period, Policy policy = SKIP);
+    ~PeriodicTask();
+
+    //Period in microseconds, which takes effect at the next deadline
+    void setPeriod(long period);
+    long getPeriod() const { return (long) (period/1000); };
+    const char *getName() const { return name; };
+
+    //Starts the schedule now, so the first wait() returns a period from now
+    void start();
+    //Ends the work of this period and sleeps until the next deadline.
+    //Returns the number of deadlines missed, those skipped or, while a
+    //CATCH_UP task is catching up, 1 for the one it is late for.  Returns
+    //-1 without waiting further if wakeFd becomes readable first.
+    int wait(int wakeFd = -1);
+
+    //Copies the statistics since start() or clear()
+    void getStatistics(TimingHistogram &jitter, TimingHistogram &execution, unsigned long &missed);
+    void clear();
+    //Prints the statistics since start() or clear()
+    void report();
+
+private:
+    const char *name;
+    int64_t period; // nanoseconds, which overflow a 32-bit long past about 2 s
+    Policy policy;
+
+    bool running;
+    timespec deadline, woke;
+
+    TimingHistogram jitter, execution;
+    unsigned long missed;
+    pthread_mutex_t mutex;
+
+    PeriodicTask(const PeriodicTask &other);            //not copyable
+    PeriodicTask &operator=(const PeriodicTask &other); //not copyable
+};
+
+#endif
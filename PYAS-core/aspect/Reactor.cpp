@@ -0,0 +1,147 @@
+#include "Reactor.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define STOP_EVENT REACTOR_MAX_SOURCES // epoll data of the stop descriptor, past every source
+
+Reactor::Reactor()
+    : count(0)
+    , largestBatch(0)
+    , buffers(REACTOR_BATCH * PACKET_MAX_SIZE)
+{
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) perror("Reactor: epoll_create1() failed");
+
+    //The message headers never change, only what the kernel writes to them
+    memset(messages, 0, sizeof(messages));
+    for (int k = 0; k < REACTOR_BATCH; k++)
+    {
+        vectors[k].iov_base = &buffers[k * PACKET_MAX_SIZE];
+        vectors[k].iov_len = PACKET_MAX_SIZE;
+        messages[k].msg_hdr.msg_iov = &vectors[k];
+        messages[k].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+Reactor::~Reactor()
+{
+    if (epoll >= 0) close(epoll);
+}
+
+int Reactor::add(int sock, Handler handler, void *context)
+{
+    epoll_event event;
+    int flags;
+
+    if (epoll < 0 || sock < 0 || count == REACTOR_MAX_SOURCES) return -1;
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = count;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, sock, &event) < 0) return -1;
+
+    sources[count].sock = sock;
+    sources[count].handler = handler;
+    sources[count].context = context;
+    sources[count].datagrams = 0;
+    sources[count].truncated = 0;
+    count++;
+    return 0;
+}
+
+void Reactor::remove(int sock)
+{
+    epoll_event event;
+
+    for (int k = 0; k < count; k++)
+    {
+        if (sources[k].sock != sock) continue;
+        epoll_ctl(epoll, EPOLL_CTL_DEL, sock, NULL);
+
+        //The last source takes this one's place and index
+        count--;
+        if (k < count)
+        {
+            sources[k] = sources[count];
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = k;
+            epoll_ctl(epoll, EPOLL_CTL_MOD, sources[k].sock, &event);
+        }
+        return;
+    }
+}
+
+int Reactor::run(int stopFd)
+{
+    epoll_event stop, events[REACTOR_MAX_SOURCES + 1];
+    int ready, result = 0;
+    bool stopping = false;
+
+    memset(&stop, 0, sizeof(stop));
+    stop.events = EPOLLIN;
+    stop.data.u32 = STOP_EVENT;
+    if (epoll < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, stopFd, &stop) < 0) return -1;
+
+    while (!stopping)
+    {
+        ready = epoll_wait(epoll, events, REACTOR_MAX_SOURCES + 1, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("Reactor: epoll_wait() failed");
+            result = -1;
+            break;
+        }
+
+        for (int k = 0; k < ready; k++)
+        {
+            if (events[k].data.u32 == STOP_EVENT) stopping = true;
+            else if (events[k].data.u32 < (unsigned int) count) drain(sources[events[k].data.u32]);
+        }
+    }
+
+    epoll_ctl(epoll, EPOLL_CTL_DEL, stopFd, NULL);
+    return result;
+}
+
+void Reactor::drain(Source &source)
+{
+    int received;
+
+    //Until the socket is empty, which a short batch already shows
+    do
+    {
+        received = recvmmsg(source.sock, messages, REACTOR_BATCH, MSG_DONTWAIT, NULL);
+        if (received <= 0) break;
+        if ((unsigned int) received > largestBatch) largestBatch = received;
+
+        for (int k = 0; k < received; k++)
+        {
+            source.datagrams++;
+            if (messages[k].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                source.truncated++;
+                continue;
+            }
+            source.handler((const uint8_t *) vectors[k].iov_base, messages[k].msg_len, source.context);
+        }
+    } while (received == REACTOR_BATCH);
+
+    if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) perror("Reactor: recvmmsg() failed");
+}
+
+void Reactor::report(const char *name)
+{
+    for (int k = 0; k < count; k++)
+        printf("%s: socket %d, %lu datagrams, %lu truncated\n", name, sources[k].sock, sources[k].datagrams,
+               sources[k].truncated);
+    printf("%s: at most %u datagrams per batch\n", name, largestBatch);
+}
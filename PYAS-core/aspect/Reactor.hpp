@@ -0,0 +1,83 @@
+/*
+
+  Reactor
+
+  Serves any number of datagram sockets from one thread.  Each socket is
+  registered with a handler, and run() waits on all of them with epoll,
+  drains each readable socket with non-blocking recvmmsg() into buffers
+  allocated up front, and calls the handler for each datagram:
+
+      void on_command(const uint8_t *data, unsigned int length, void *context);
+
+      CommandReceiver receiver(PORT_CMD);
+      receiver.init_connection();
+      Reactor reactor;
+      reactor.add(receiver.get_socket(), on_command);
+      reactor.run(token.fd());   // until the token is requested
+
+  run() returns as soon as the stop descriptor becomes readable, so the
+  thread can be stopped instantly however quiet the sockets are.  Handlers
+  run on the reactor's thread and should hand anything slow to another.
+  The data passed to a handler is only valid until it returns.
+
+*/
+
+#ifndef _REACTOR_HPP_
+#define _REACTOR_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <sys/socket.h>
+
+#include "Packet.hpp"
+
+#define REACTOR_MAX_SOURCES 8 // sockets one reactor can serve
+#define REACTOR_BATCH 16 // datagrams received per recvmmsg() call
+
+class Reactor
+{
+public:
+    typedef void (*Handler)(const uint8_t *data, unsigned int length, void *context);
+
+    Reactor();
+    ~Reactor();
+
+    //Watches sock, which is made non-blocking, calling handler with context
+    //for each datagram.  Returns 0, or -1 if it could not be added.
+    int add(int sock, Handler handler, void *context = NULL);
+    //Stops watching sock
+    void remove(int sock);
+
+    //Dispatches datagrams until stopFd becomes readable.  Returns 0 then, or
+    //-1 if epoll fails.
+    int run(int stopFd);
+
+    //Prints the datagrams received on each socket and the largest batch
+    void report(const char *name);
+
+private:
+    struct Source
+    {
+        int sock;
+        Handler handler;
+        void *context;
+        unsigned long datagrams, truncated;
+    };
+
+    int epoll;
+    Source sources[REACTOR_MAX_SOURCES];
+    int count;
+    unsigned int largestBatch;
+
+    std::vector<uint8_t> buffers;   //REACTOR_BATCH datagrams of PACKET_MAX_SIZE
+    mmsghdr messages[REACTOR_BATCH];
+    iovec vectors[REACTOR_BATCH];
+
+    void drain(Source &source);
+
+    Reactor(const Reactor &other);            //not copyable
+    Reactor &operator=(const Reactor &other); //not copyable
+};
+
+#endif
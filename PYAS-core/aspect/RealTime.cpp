@@ -0,0 +1,158 @@
+#include "RealTime.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <alloca.h>
+#include <sys/mman.h>   /* for mlockall() */
+#include <unistd.h>     /* for sysconf() */
+
+#define PAGE_BYTES 4096
+
+//What the wrapper needs to start the thread's routine
+struct ThreadStart
+{
+    void *(*routine)(void *);
+    void *arg;
+    size_t prefault;
+};
+
+static void *StartRoutine(void *start)
+{
+    ThreadStart local = *(ThreadStart *)start;
+    delete (ThreadStart *)start;
+
+    if (local.prefault > 0) PrefaultStack(local.prefault);
+    return local.routine(local.arg);
+}
+
+//Only the CPUs of mask that this machine has.  Returns false if it has none
+//of them, to leave the affinity alone.
+static bool OnlineCPUs(unsigned long mask, cpu_set_t &cpus)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    CPU_ZERO(&cpus);
+    for (long k = 0; k < online && k < (long) (8*sizeof(mask)) && k < CPU_SETSIZE; k++)
+        if (mask & (1UL << k)) CPU_SET(k, &cpus);
+    return CPU_COUNT(&cpus) > 0;
+}
+
+int ConfigureAttributes(const ThreadConfig &config, pthread_attr_t &attr)
+{
+    sched_param param;
+    cpu_set_t cpus;
+    int result;
+
+    //Without explicit scheduling, the thread would inherit the creator's
+    result = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    if (result == 0) result = pthread_attr_setschedpolicy(&attr, config.policy);
+    if (result == 0)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        result = pthread_attr_setschedparam(&attr, &param);
+    }
+    if (result == 0 && config.cpus != 0 && OnlineCPUs(config.cpus, cpus))
+        result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    return result;
+}
+
+int CreateThread(pthread_t *thread, const ThreadConfig &config, void *(*routine)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    ThreadStart *start = new ThreadStart;
+    int result;
+
+    start->routine = routine;
+    start->arg = arg;
+    start->prefault = config.prefault;
+
+    pthread_attr_init(&attr);
+    result = ConfigureAttributes(config, attr);
+    if (result == 0) result = pthread_create(thread, &attr, StartRoutine, start);
+    pthread_attr_destroy(&attr);
+
+    //Most often EPERM without the privilege for SCHED_FIFO
+    if (result != 0)
+    {
+        printf("%s: real-time settings refused (%s), using defaults\n", config.name, strerror(result));
+        result = pthread_create(thread, NULL, StartRoutine, start);
+    }
+    if (result != 0) delete start;
+    return result;
+}
+
+int ConfigureThread(const ThreadConfig &config)
+{
+    sched_param param;
+    cpu_set_t cpus;
+    int result, affinity = 0;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = config.priority;
+    result = pthread_setschedparam(pthread_self(), config.policy, &param);
+
+    if (config.cpus != 0 && OnlineCPUs(config.cpus, cpus))
+        affinity = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (result == 0) result = affinity;
+
+    if (result != 0) printf("%s: real-time settings refused (%s)\n", config.name, strerror(result));
+    if (config.prefault > 0) PrefaultStack(config.prefault);
+    return result;
+}
+
+void PrefaultStack(size_t bytes)
+{
+    volatile unsigned char *stack = (volatile unsigned char *) alloca(bytes);
+
+    for (size_t k = 0; k < bytes; k += PAGE_BYTES) stack[k] = 0;
+}
+
+int LockMemory()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) return errno;
+    return 0;
+}
+
+BackgroundLoad::BackgroundLoad()
+    : running(false)
+{
+}
+
+BackgroundLoad::~BackgroundLoad()
+{
+    stop();
+}
+
+void BackgroundLoad::start(int count)
+{
+    pthread_t thread;
+
+    running = true;
+    for (int k = 0; k < count; k++)
+        if (pthread_create(&thread, NULL, Spin, this) == 0) threads.push_back(thread);
+}
+
+void BackgroundLoad::stop()
+{
+    running = false;
+    for (unsigned int k = 0; k < threads.size(); k++) pthread_join(threads[k], NULL);
+    threads.clear();
+}
+
+void *BackgroundLoad::Spin(void *load)
+{
+    BackgroundLoad *self = (BackgroundLoad *)load;
+    std::vector<unsigned char> memory(REALTIME_LOAD_BYTES);
+    unsigned int sum = 0;
+
+    while (self->running)
+    {
+        for (size_t k = 0; k < memory.size(); k += 64)
+        {
+            memory[k] += k;
+            sum += memory[k];
+        }
+    }
+    return (void *)(size_t) sum;
+}
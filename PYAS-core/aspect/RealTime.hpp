@@ -0,0 +1,86 @@
+/*
+
+  Real-time thread settings
+
+  A ThreadConfig gives a thread's scheduling policy and priority, the CPUs
+  it may run on, and how much of its stack to touch before it starts work,
+  so that page faults do not land in the middle of a frame:
+
+      ThreadConfig config = {"ImageProcess", SCHED_FIFO, 70, 0x2, 64*1024};
+      if (CreateThread(&thread, config, routine, arg) != 0) ...
+
+  CreateThread() applies the settings through pthread_attr.  SCHED_FIFO
+  needs CAP_SYS_NICE (or root), so if the settings are refused, the thread
+  is started with default attributes instead and a warning is printed.
+  The routine is run through a wrapper that prefaults the stack first.
+  ConfigureThread() applies a ThreadConfig to the calling thread instead.
+  LockMemory() calls mlockall() so the pages stay resident.
+
+  BackgroundLoad spins threads that keep the CPUs and memory busy, for
+  measuring latency under load:
+      BackgroundLoad load;
+      load.start(4);
+      ...
+      load.stop();
+
+*/
+
+#ifndef _REALTIME_HPP_
+#define _REALTIME_HPP_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <vector>
+
+#define REALTIME_LOAD_BYTES (4*1024*1024) // memory each load thread sweeps through to evict caches
+
+struct ThreadConfig
+{
+    const char *name;
+    int policy;             //SCHED_FIFO or SCHED_OTHER
+    int priority;           //1 to 99 for SCHED_FIFO, 0 for SCHED_OTHER
+    unsigned long cpus;     //bit k allows CPU k, 0 for any CPU
+    size_t prefault;        //bytes of stack to touch before starting, 0 for none
+};
+
+//Creates a thread running routine(arg) with the settings of config, falling
+//back to default attributes if they are refused.  Returns what
+//pthread_create() does.
+int CreateThread(pthread_t *thread, const ThreadConfig &config, void *(*routine)(void *), void *arg);
+
+//Applies the settings of config to the calling thread, leaving whatever
+//is refused at its current setting.  Returns 0 or the first error.
+int ConfigureThread(const ThreadConfig &config);
+
+//Sets attr, which must be initialized, to the settings of config.  Returns
+//0 or the first error from pthread_attr.
+int ConfigureAttributes(const ThreadConfig &config, pthread_attr_t &attr);
+
+//Touches bytes of the calling thread's stack below the caller
+void PrefaultStack(size_t bytes);
+
+//Locks all current and future pages into memory.  Returns 0 or errno.
+int LockMemory();
+
+class BackgroundLoad
+{
+public:
+    BackgroundLoad();
+    ~BackgroundLoad();
+
+    //Starts threads that spin on the CPU and sweep through memory
+    void start(int threads);
+    void stop();
+
+private:
+    std::vector<pthread_t> threads;
+    volatile bool running;
+
+    static void *Spin(void *load);
+
+    BackgroundLoad(const BackgroundLoad &other);            //not copyable
+    BackgroundLoad &operator=(const BackgroundLoad &other); //not copyable
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "SunTracker.hpp"
+#include <cmath>
+#include <algorithm>
+
+SunTracker::SunTracker()
+{
+    //Critically damped for a constant velocity, beta = alpha^2/(2 - alpha)
+    alpha = 0.5;
+    beta = 1.0/6;
+    reset();
+}
+
+void SunTracker::setGains(float _alpha, float _beta)
+{
+    alpha = _alpha;
+    beta = _beta;
+}
+
+void SunTracker::reset()
+{
+    updates = 0;
+    lastTime = 0;
+    lastInterval = 0;
+    position = velocity = cv::Point2f(0, 0);
+    variance = cv::Point2f(TRACKER_INITIAL_ERROR*TRACKER_INITIAL_ERROR,
+                           TRACKER_INITIAL_ERROR*TRACKER_INITIAL_ERROR);
+    radius = 0;
+    radiusVariance = TRACKER_INITIAL_ERROR*TRACKER_INITIAL_ERROR;
+}
+
+void SunTracker::update(double t, cv::Point2f center, float _radius)
+{
+    double dt = t - lastTime;
+    cv::Point2f innovation;
+    float weight;
+
+    if (updates == 0)
+    {
+        position = center;
+        radius = _radius;
+    }
+    else if (dt <= 0)
+    {
+        //Another measurement of the same frame
+        position += alpha*(center - position);
+    }
+    else if (updates == 1)
+    {
+        //Two points set the velocity
+        velocity = (center - position)*(float)(1/dt);
+        position = center;
+    }
+    else
+    {
+        innovation = center - (position + velocity*(float) dt);
+        position += velocity*(float) dt + alpha*innovation;
+        velocity += (float)(beta/dt)*innovation;
+
+        //The initial error counts as one innovation in the running mean
+        weight = 1.0/std::min(updates, TRACKER_ERROR_FRAMES);
+        variance.x += weight*(innovation.x*innovation.x - variance.x);
+        variance.y += weight*(innovation.y*innovation.y - variance.y);
+    }
+
+    if (updates > 0)
+    {
+        weight = 1.0/std::min(updates + 1, TRACKER_ERROR_FRAMES);
+        radiusVariance += weight*((_radius - radius)*(_radius - radius) - radiusVariance);
+        radius += weight*(_radius - radius);
+    }
+
+    if (dt > 0 && updates > 0) lastInterval = dt;
+    lastTime = t;
+    updates++;
+}
+
+bool SunTracker::predict(double t, cv::Point2f &center, cv::Point2f &error) const
+{
+    double dt = t - lastTime;
+    float stretch = 1;
+
+    if (updates == 0) return false;
+
+    center = position + velocity*(float) dt;
+    if (lastInterval > 0 && dt > lastInterval) stretch = dt/lastInterval;
+    error = cv::Point2f(stretch*sqrt(variance.x), stretch*sqrt(variance.y));
+    return true;
+}
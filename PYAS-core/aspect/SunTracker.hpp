@@ -0,0 +1,65 @@
+/*
+
+  SunTracker
+
+  Follows the Sun's center from frame to frame with an alpha-beta filter on
+  each axis, so Aspect can look for it where it is about to be rather than
+  where it was.  Each measurement moves the position by alpha times the
+  innovation (measured minus predicted) and the velocity by beta/dt times it.
+
+  The expected error of a prediction is the RMS of the recent innovations,
+  a running mean over the first frames and then an exponential average over
+  about TRACKER_ERROR_FRAMES, so it follows the pointing jitter.  It starts
+  at TRACKER_INITIAL_ERROR and is stretched for gaps longer than the last
+  one.  The radius of the Sun is averaged the same way.
+
+      SunTracker tracker;
+      if (tracker.predict(t, center, error)) ... look around center ...
+      tracker.update(t, measured, radius);
+      tracker.reset();  // when the Sun is lost
+
+  Times are in seconds, and only differences between them matter.
+
+*/
+
+#ifndef _SUNTRACKER_HPP_
+#define _SUNTRACKER_HPP_
+
+#include <opencv.hpp>
+#include <cmath>
+
+#define TRACKER_INITIAL_ERROR 5 // pixels, expected error before any innovations
+#define TRACKER_ERROR_FRAMES 16 // frames averaged for the expected error
+
+class SunTracker
+{
+public:
+    SunTracker();
+
+    void setGains(float alpha, float beta);
+    float getAlpha() const { return alpha; };
+    float getBeta() const { return beta; };
+
+    //Forgets the Sun, so the next measurement starts a new track
+    void reset();
+    //Adds the center and radius measured in a frame taken at time t
+    void update(double t, cv::Point2f center, float radius);
+    //Predicts the center at time t and its expected error on each axis,
+    //returning false if there is no track
+    bool predict(double t, cv::Point2f &center, cv::Point2f &error) const;
+
+    bool tracking() const { return updates > 0; };
+    float getRadius() const { return radius; };
+    float getRadiusError() const { return sqrt(radiusVariance); };
+
+private:
+    float alpha, beta;
+
+    int updates;
+    double lastTime, lastInterval;
+    cv::Point2f position, velocity;
+    cv::Point2f variance;
+    float radius, radiusVariance;
+};
+
+#endif
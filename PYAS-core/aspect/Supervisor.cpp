@@ -0,0 +1,282 @@
+#include "Supervisor.hpp"
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+#include "PeriodicTask.hpp"
+
+//Now plus usec microseconds on CLOCK_MONOTONIC
+static timespec Deadline(long usec)
+{
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += usec / 1000000;
+    deadline.tv_nsec += (usec % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+StopToken::StopToken()
+    : stop(false)
+{
+    event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event < 0) perror("StopToken: eventfd() failed");
+}
+
+StopToken::~StopToken()
+{
+    if (event >= 0) close(event);
+}
+
+void StopToken::request()
+{
+    uint64_t one = 1;
+
+    stop = true;
+    if (event >= 0 && write(event, &one, sizeof(one)) < 0) perror("StopToken: write() failed");
+}
+
+void StopToken::reset()
+{
+    uint64_t count;
+
+    stop = false;
+    if (event >= 0) while (read(event, &count, sizeof(count)) > 0);
+}
+
+bool StopToken::sleep(long usec) const
+{
+    pollfd wake = {event, POLLIN, 0};
+    timespec timeout = {usec / 1000000, (usec % 1000000) * 1000};
+
+    if (!stop) ppoll(&wake, 1, &timeout, NULL);
+    return stop;
+}
+
+bool StopToken::sleepUntil(const timespec &deadline) const
+{
+    timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+        return stop;
+    return sleep((long) Microseconds(now, deadline) + 1);
+}
+
+Supervisor::Supervisor(int slots, void (*failed)(void))
+    : slots(slots)
+    , failed(failed)
+{
+    workers = new Worker[slots];
+    for (int k = 0; k < slots; k++)
+    {
+        workers[k].owner = this;
+        workers[k].state = IDLE;
+        workers[k].restart = false;
+        workers[k].quickFailures = 0;
+        workers[k].restarts = 0;
+    }
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+Supervisor::~Supervisor()
+{
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+    delete[] workers;
+}
+
+int Supervisor::reserve()
+{
+    int slot = -1;
+
+    pthread_mutex_lock(&mutex);
+    for (int k = 0; k < slots && slot < 0; k++)
+    {
+        //Failed workers keep their slots until they are restarted
+        if (workers[k].state == FINISHED && !workers[k].restart)
+        {
+            pthread_join(workers[k].thread, NULL);
+            workers[k].state = IDLE;
+        }
+        if (workers[k].state == IDLE)
+        {
+            workers[k].state = RESERVED;
+            slot = k;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return slot;
+}
+
+int Supervisor::start(int slot, void *(*routine)(void *), void *arg, const ThreadConfig &config, bool restart)
+{
+    Worker &worker = workers[slot];
+
+    worker.routine = routine;
+    worker.arg = arg;
+    worker.config = config;
+    worker.restart = restart;
+    worker.quickFailures = 0;
+    worker.restarts = 0;
+    return launch(worker);
+}
+
+int Supervisor::launch(Worker &worker)
+{
+    int result;
+
+    //Running before the thread exists, so that one finishing at once is not
+    //overwritten
+    worker.stop.reset();
+    clock_gettime(CLOCK_MONOTONIC, &worker.started);
+    pthread_mutex_lock(&mutex);
+    worker.state = RUNNING;
+    pthread_mutex_unlock(&mutex);
+
+    result = CreateThread(&worker.thread, worker.config, Run, &worker);
+    if (result != 0)
+    {
+        pthread_mutex_lock(&mutex);
+        worker.state = IDLE;
+        pthread_mutex_unlock(&mutex);
+    }
+    return result;
+}
+
+void *Supervisor::Run(void *worker)
+{
+    Worker *self = (Worker *)worker;
+    void *result;
+
+    //Also run if the routine calls pthread_exit() or is cancelled
+    pthread_cleanup_push(Finished, self);
+    result = self->routine(self->arg);
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+void Supervisor::Finished(void *worker)
+{
+    Worker *self = (Worker *)worker;
+    Supervisor *owner = self->owner;
+    bool failed;
+
+    pthread_mutex_lock(&owner->mutex);
+    self->state = FINISHED;
+    clock_gettime(CLOCK_MONOTONIC, &self->finished);
+    failed = self->restart && !self->stop.requested();
+    pthread_cond_broadcast(&owner->cond);
+    pthread_mutex_unlock(&owner->mutex);
+
+    if (failed)
+    {
+        printf("Supervisor: %s finished without being stopped\n", self->config.name);
+        if (owner->failed != NULL) owner->failed();
+    }
+}
+
+void Supervisor::request(int slot)
+{
+    workers[slot].stop.request();
+}
+
+int Supervisor::join(int slot, long timeout)
+{
+    Worker &worker = workers[slot];
+    timespec deadline = Deadline(timeout);
+    int result = 0;
+
+    pthread_mutex_lock(&mutex);
+    if (worker.state == IDLE || worker.state == RESERVED)
+    {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+
+    while (worker.state == RUNNING)
+        if (pthread_cond_timedwait(&cond, &mutex, &deadline) == ETIMEDOUT) break;
+
+    //As a last resort, cancel it, and give it as long again to get out
+    if (worker.state == RUNNING)
+    {
+        printf("Supervisor: %s did not stop within %ld us, cancelling it\n", worker.config.name, timeout);
+        result = 1;
+        pthread_cancel(worker.thread);
+        deadline = Deadline(timeout);
+        while (worker.state == RUNNING)
+            if (pthread_cond_timedwait(&cond, &mutex, &deadline) == ETIMEDOUT) break;
+    }
+
+    //The Worker is still in use by a thread that never finished, so the
+    //slot cannot be reused
+    if (worker.state == RUNNING)
+    {
+        printf("Supervisor: %s could not be cancelled, abandoning its slot\n", worker.config.name);
+        result = 2;
+    }
+    else
+    {
+        pthread_join(worker.thread, NULL);
+        worker.state = IDLE;
+    }
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+int Supervisor::restartFailed()
+{
+    timespec now;
+    double ran, down = 0;
+    bool restart;
+    int count = 0;
+
+    for (int k = 0; k < slots; k++)
+    {
+        Worker &worker = workers[k];
+
+        pthread_mutex_lock(&mutex);
+        restart = worker.state == FINISHED && worker.restart && !worker.stop.requested();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (restart)
+        {
+            ran = Microseconds(worker.started, worker.finished);
+            down = Microseconds(worker.finished, now);
+
+            //One that keeps failing at once waits a while each time, and is
+            //eventually left stopped
+            if (ran >= SUPERVISOR_MIN_RUNTIME) worker.quickFailures = 0;
+            else if (down < SUPERVISOR_MIN_RUNTIME) restart = false;
+            else if (++worker.quickFailures >= SUPERVISOR_MAX_QUICK_FAILURES)
+            {
+                printf("Supervisor: %s failed %u times in a row, giving up\n", worker.config.name, worker.quickFailures);
+                worker.restart = false;
+                restart = false;
+            }
+        }
+        if (restart) pthread_join(worker.thread, NULL);
+        pthread_mutex_unlock(&mutex);
+
+        if (restart)
+        {
+            worker.restarts++;
+            printf("Supervisor: restarting %s (restart %lu) after %.1f ms down\n", worker.config.name,
+                   worker.restarts, down/1000);
+            if (launch(worker) == 0) count++;
+        }
+    }
+    return count;
+}
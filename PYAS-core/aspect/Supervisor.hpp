@@ -0,0 +1,131 @@
+/*
+
+  Supervisor and StopToken
+
+  The Supervisor owns the lifecycle of a fixed number of worker slots.  A
+  thread is started in a reserved slot, and stopped by asking it to through
+  its StopToken and then joining it with a timeout:
+
+      int slot = supervisor.reserve();
+      supervisor.start(slot, routine, arg, config, true);
+      ...
+      supervisor.request(slot);
+      supervisor.join(slot, 100000);   // microseconds
+
+  The routine checks supervisor.stopping(slot) between pieces of work and
+  returns (or calls pthread_exit()) when it is set, releasing what it holds.
+  Wherever it blocks, it should wait on the token too: StopToken::sleep()
+  instead of sleep(), poll() on StopToken::fd() beside its sockets, or
+  PeriodicTask::wait(fd).  Only a thread that has not finished when join()
+  times out is cancelled, as a last resort.
+
+  A worker started with restart set that finishes without having been asked
+  to stop has failed.  The Supervisor calls the failure callback given to its
+  constructor, from the failed thread, and restartFailed() then starts the
+  worker again in its slot.  A worker that keeps failing within
+  SUPERVISOR_MIN_RUNTIME of being started is only restarted once per
+  SUPERVISOR_MIN_RUNTIME, and is given up on after
+  SUPERVISOR_MAX_QUICK_FAILURES of those in a row.
+
+*/
+
+#ifndef _SUPERVISOR_HPP_
+#define _SUPERVISOR_HPP_
+
+#include <pthread.h>
+#include <time.h>
+
+#include "RealTime.hpp"
+
+#define SUPERVISOR_MIN_RUNTIME 1000000 // microseconds a worker must run for its failure to be restarted at once
+#define SUPERVISOR_MAX_QUICK_FAILURES 5 // failures in a row within SUPERVISOR_MIN_RUNTIME before giving up
+
+//A stop request that can be checked, slept on, or polled as an eventfd
+class StopToken
+{
+public:
+    StopToken();
+    ~StopToken();
+
+    void request();
+    //Clears the request, for starting a new thread with the token
+    void reset();
+    bool requested() const { return stop; };
+
+    //Readable from the request until reset()
+    int fd() const { return event; };
+    //Sleeps for usec microseconds, or until deadline on CLOCK_MONOTONIC, or
+    //until the request, returning requested()
+    bool sleep(long usec) const;
+    bool sleepUntil(const timespec &deadline) const;
+
+private:
+    int event;
+    volatile bool stop;
+
+    StopToken(const StopToken &other);            //not copyable
+    StopToken &operator=(const StopToken &other); //not copyable
+};
+
+class Supervisor
+{
+public:
+    Supervisor(int slots, void (*failed)(void) = NULL);
+    ~Supervisor();
+
+    //Reserves a free slot, joining a finished thread in it first.  Returns
+    //the slot, or -1 if every slot is in use.
+    int reserve();
+    //Starts routine(arg) in a reserved slot with the settings of config.
+    //Returns what CreateThread() does, freeing the slot on failure.
+    int start(int slot, void *(*routine)(void *), void *arg, const ThreadConfig &config, bool restart = false);
+
+    //Asks the thread in slot to stop
+    void request(int slot);
+    bool stopping(int slot) const { return workers[slot].stop.requested(); };
+    const StopToken &token(int slot) const { return workers[slot].stop; };
+
+    //Waits up to timeout microseconds for the thread in slot to finish,
+    //cancelling it if it does not, and frees the slot.  Returns 0 if it
+    //finished, 1 if it had to be cancelled, 2 if it did not finish even then
+    //(its slot stays in use), or -1 if no thread was in the slot.
+    int join(int slot, long timeout);
+
+    //Starts the failed workers again.  Returns the number restarted.
+    int restartFailed();
+
+    int getSlots() const { return slots; };
+
+private:
+    enum State { IDLE, RESERVED, RUNNING, FINISHED };
+
+    struct Worker
+    {
+        Supervisor *owner;
+        pthread_t thread;
+        void *(*routine)(void *);
+        void *arg;
+        ThreadConfig config;
+        bool restart;
+        State state;
+        StopToken stop;
+        timespec started, finished; // CLOCK_MONOTONIC
+        unsigned int quickFailures;
+        unsigned long restarts;
+    };
+
+    int slots;
+    Worker *workers;
+    void (*failed)(void);
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // with mutex, signalled when a worker finishes
+
+    int launch(Worker &worker);
+    static void *Run(void *worker);
+    static void Finished(void *worker);
+
+    Supervisor(const Supervisor &other);            //not copyable
+    Supervisor &operator=(const Supervisor &other); //not copyable
+};
+
+#endif
@@ -4,18 +4,23 @@
 #include <stdlib.h>     /* for atoi() and exit() */
 #include <string.h>     /* for memset() */
 #include <unistd.h>     /* for close() */
+#include <errno.h>      /* for errno */
+#include <math.h>       /* for ceil() */
+#include <sys/time.h>   /* for timeval */
+#include <poll.h>       /* for poll() */
 
 #include "TCPSender.hpp"
 
-TCPSender::TCPSender(void) : sendPort(7000)
+#define SECTION_HEADER_SIZE 24
+
+TCPSender::TCPSender(void) : sock(-1), sendPort(7000)
 {
     char ip[] = "192.168.1.114";
     sendtoIP = new char[strlen(ip)+1];
     strcpy(sendtoIP, ip);
-    sock = 0;
 }
 
-TCPSender::TCPSender( const char *ip, unsigned short port ) : sendPort(port)
+TCPSender::TCPSender( const char *ip, unsigned short port ) : sock(-1), sendPort(port)
 {
     sendtoIP = new char[strlen(ip)+1];
     strcpy(sendtoIP, ip);
@@ -23,12 +28,15 @@ TCPSender::TCPSender( const char *ip, unsigned short port ) : sendPort(port)
 
 TCPSender::~TCPSender()
 {
-    delete sendtoIP;
+    close_connection();
+    delete[] sendtoIP;
 }
 
 int TCPSender::init_connection( void )
 {
-    
+    // The connection persists across images until an error occurs
+    if (sock >= 0) return sock;
+
     // Create a reliable, stream socket using TCP
     sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (sock < 0) {
@@ -48,6 +56,7 @@ int TCPSender::init_connection( void )
         // Establish the connection to the echo server
         if (connect(sock, (struct sockaddr *) &servAddr, sizeof(servAddr)) < 0) {
             printf("connect() failed");
+            close(sock);
             sock = -1;
         }
     }
@@ -57,26 +66,110 @@ int TCPSender::init_connection( void )
 
 void TCPSender::close_connection( void )
 {
-    close(sock);
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+}
+
+int TCPSender::send_all( struct iovec *iov, int iovcnt, int stopFd )
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    // With a stop descriptor, wait for room on the socket or the stop,
+    // whichever comes first, and never block in sendmsg()
+    struct pollfd fds[2];
+    fds[0].fd = sock;
+    fds[0].events = POLLOUT;
+    fds[1].fd = stopFd;
+    fds[1].events = POLLIN;
+    int flags = MSG_NOSIGNAL | (stopFd >= 0 ? MSG_DONTWAIT : 0);
+
+    while (msg.msg_iovlen > 0) {
+        if (stopFd >= 0) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                printf("TCPSender: poll() failed, closing the connection\n");
+                close_connection();
+                return -1;
+            }
+            if (fds[1].revents & POLLIN) {
+                printf("TCPSender: stopped, closing the connection\n");
+                close_connection();
+                return -1;
+            }
+        }
+
+        // MSG_NOSIGNAL so that a dropped connection is an error rather than SIGPIPE
+        ssize_t bytesSent = sendmsg(sock, &msg, flags);
+        if (bytesSent < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            printf("TCPSender: sendmsg() failed, closing the connection\n");
+            close_connection();
+            return -1;
+        }
+
+        // Skip past whatever was written, which may end partway through an iovec
+        while ((msg.msg_iovlen > 0) && ((size_t)bytesSent >= msg.msg_iov->iov_len)) {
+            bytesSent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + bytesSent;
+            msg.msg_iov->iov_len -= bytesSent;
+        }
+    }
+
+    return 0;
 }
 
 void TCPSender::send_packet( ImagePacket *packet )
-{    
-    int bytesSent;
-
-    if( sock > 0){
-        // update the frame number every time we send out a packet
-        printf("TCPSender: Sending to %s\n", sendtoIP);
-        
-        uint8_t *payload = new uint8_t[packet->getLength()];
-        packet->outputTo(payload);
-        
-        bytesSent = send(sock, payload, packet->getLength(), 0);
-        
-        if (bytesSent != packet->getLength()){
-            printf("CommandSender: sendto() sent a different number of bytes (%u)than expected\n", bytesSent);
+{
+    if( sock >= 0){
+        uint8_t payload[PACKET_MAX_SIZE];
+        struct iovec iov;
+        iov.iov_base = payload;
+        iov.iov_len = packet->outputTo(payload);
+
+        send_all(&iov, 1);
+    }
+}
+
+int TCPSender::send_image( uint8_t camera, uint16_t xpixels, uint16_t ypixels, const uint8_t *array, const timeval &time, int stopFd )
+{
+    if (sock < 0) return -1;
+
+    uint32_t totalpixels = xpixels*ypixels;
+    uint16_t nsections = ceil(((float)totalpixels) / SECTION_MAX_PIXELS);
+
+    uint8_t headers[TCP_BATCH_SECTIONS][SECTION_HEADER_SIZE];
+    struct iovec iov[2*TCP_BATCH_SECTIONS];
+    int batch = 0;
+
+    for (uint16_t i = 0; i < nsections; i++) {
+        bool last = (i == nsections-1);
+        uint32_t offset = i*SECTION_MAX_PIXELS;
+        uint16_t length = (last ? totalpixels-offset : SECTION_MAX_PIXELS);
+
+        ImageSectionPacket isp(camera, xpixels, ypixels, offset, last);
+        isp.finishHeader(time, array+offset, length);
+        isp.readAtTo_bytes(0, headers[batch], SECTION_HEADER_SIZE);
+
+        iov[2*batch].iov_base = headers[batch];
+        iov[2*batch].iov_len = SECTION_HEADER_SIZE;
+        iov[2*batch+1].iov_base = (void *)(array+offset);
+        iov[2*batch+1].iov_len = length;
+        batch++;
+
+        if ((batch == TCP_BATCH_SECTIONS) || last) {
+            if (send_all(iov, 2*batch, stopFd) < 0) return -1;
+            batch = 0;
         }
-        if (bytesSent == -1){ printf("CommandSender: sendto() failed!\n"); }
-        free(payload);
     }
+
+    return nsections;
 }
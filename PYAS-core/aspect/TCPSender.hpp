@@ -1,21 +1,40 @@
 #include "Command.hpp"
 #include "Image.hpp"
 #include <arpa/inet.h>  /* for sockaddr_in and inet_addr() */
+#include <sys/uio.h>    /* for struct iovec */
+
+#define TCP_BATCH_SECTIONS 32   /* image sections handed to the kernel per system call */
 
 class TCPSender {
 protected:
-    int sock;                       /* Socket descriptor */
+    int sock;                       /* Socket descriptor, persistent once connected */
     struct sockaddr_in sendAddr;    /* Echo server address */
     unsigned int fromSize;          /* In-out of address size for recvfrom() */
     char *sendtoIP;                 /* IP address to send to */
     in_port_t sendPort;             /* Port to send on*/
 
+    //Writes all of the iovecs, continuing after partial writes
+    //Closes the connection and returns -1 on failure, or as soon as stopFd
+    //(if not -1) becomes readable
+    int send_all( struct iovec *iov, int iovcnt, int stopFd = -1 );
+
 public:
     TCPSender( void );
     TCPSender( const char *ip, unsigned short port );
     ~TCPSender();
-        
+
     virtual void send_packet(  ImagePacket *packet  );
+
+    //Streams an image as ImageSectionPackets, sending the pixel data directly
+    //from array (row-major, xpixels*ypixels bytes) with the section headers
+    //built on the fly.  All sections are stamped with time, which the caller
+    //also gives any tag packets that follow.
+    //If stopFd becomes readable, the image is abandoned and the connection
+    //closed, so that the next image does not follow a partial one.
+    //Returns the number of sections sent, or -1 on failure
+    int send_image( uint8_t camera, uint16_t xpixels, uint16_t ypixels, const uint8_t *array, const timeval &time, int stopFd = -1 );
+
+    //Connects if not already connected, returns the socket or -1
     int init_connection( void );
     void close_connection( void );
 };
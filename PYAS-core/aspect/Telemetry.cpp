@@ -2,6 +2,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <utility>
 
 #include "Telemetry.hpp"
 
@@ -66,8 +67,7 @@ void TelemetryPacket::writePayloadLength()
 
 void TelemetryPacket::writeChecksum()
 {
-    replace(INDEX_CHECKSUM, (uint16_t)0);
-    replace(INDEX_CHECKSUM, (uint16_t)checksum());
+    replace(INDEX_CHECKSUM, (uint16_t)checksum(INDEX_CHECKSUM, sizeof(uint16_t)));
 }
 
 void TelemetryPacket::writeTime()
@@ -213,7 +213,7 @@ void TelemetryPacketQueue::add_file(const char* file)
                     pass_typeID = !(filter_typeID && !(tp.getTypeID() == i_typeID));
                     if(pass_sourceID) ct_sourceID++;
                     if(pass_typeID) ct_typeID++;
-                    if(pass_sourceID && pass_typeID) *this << tp;
+                    if(pass_sourceID && pass_typeID) *this << std::move(tp);
                 }
 
                 ifs.seekg(cur);
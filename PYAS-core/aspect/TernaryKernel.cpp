@@ -0,0 +1,168 @@
+#include "TernaryKernel.hpp"
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TERNARY_SIMD
+#include <emmintrin.h>  /* for SSE2 intrinsics */
+#include <immintrin.h>  /* for AVX2 intrinsics */
+#endif
+
+#define TERNARY_CHUNK 128 // taps of one sign whose sum of 8-bit pixels fits in an int16_t
+
+#ifdef TERNARY_SIMD
+//Chooses the widest instructions the processor has, once, at start-up
+static int TernaryVectorWidth()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return 32;
+    if (__builtin_cpu_supports("sse2")) return 16;
+    return 0;
+}
+
+static int ternary_vector_width = TernaryVectorWidth();
+
+//Each function below fills blocks of 16 pixels of a row of the output, and
+//returns the number of pixels filled.  Offsets are from the top-left corner of
+//the kernel over each output pixel.  The taps are summed in 16 bits, up to
+//TERNARY_CHUNK of each sign at a time, and each chunk is added into 32 bits.
+__attribute__((target("sse2")))
+static int CorrelateRowSSE2(const unsigned char *in, const int *pos, int numPos,
+                            const int *neg, int numNeg, int width, float *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int n, kp, kn, end;
+
+    for (n = 0; n + 16 <= width; n += 16)
+    {
+        __m128i sum[4] = {zero, zero, zero, zero};
+        kp = kn = 0;
+        do
+        {
+            __m128i lo = zero, hi = zero;
+            for (end = std::min(kp + TERNARY_CHUNK, numPos); kp < end; kp++)
+            {
+                __m128i pixels = _mm_loadu_si128((const __m128i *)(in + n + pos[kp]));
+                lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(pixels, zero));
+                hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(pixels, zero));
+            }
+            for (end = std::min(kn + TERNARY_CHUNK, numNeg); kn < end; kn++)
+            {
+                __m128i pixels = _mm_loadu_si128((const __m128i *)(in + n + neg[kn]));
+                lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(pixels, zero));
+                hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(pixels, zero));
+            }
+            //sign extend to 32 bits by shifting each sum down from the top half
+            sum[0] = _mm_add_epi32(sum[0], _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16));
+            sum[1] = _mm_add_epi32(sum[1], _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16));
+            sum[2] = _mm_add_epi32(sum[2], _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16));
+            sum[3] = _mm_add_epi32(sum[3], _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16));
+        } while (kp < numPos || kn < numNeg);
+
+        for (int k = 0; k < 4; k++) _mm_storeu_ps(out + n + 4*k, _mm_cvtepi32_ps(sum[k]));
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static int CorrelateRowAVX2(const unsigned char *in, const int *pos, int numPos,
+                            const int *neg, int numNeg, int width, float *out)
+{
+    int n, kp, kn, end;
+
+    for (n = 0; n + 16 <= width; n += 16)
+    {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        kp = kn = 0;
+        do
+        {
+            __m256i chunk = _mm256_setzero_si256();
+            for (end = std::min(kp + TERNARY_CHUNK, numPos); kp < end; kp++)
+                chunk = _mm256_add_epi16(chunk, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(in + n + pos[kp]))));
+            for (end = std::min(kn + TERNARY_CHUNK, numNeg); kn < end; kn++)
+                chunk = _mm256_sub_epi16(chunk, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(in + n + neg[kn]))));
+            lo = _mm256_add_epi32(lo, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(chunk)));
+            hi = _mm256_add_epi32(hi, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(chunk, 1)));
+        } while (kp < numPos || kn < numNeg);
+
+        _mm256_storeu_ps(out + n, _mm256_cvtepi32_ps(lo));
+        _mm256_storeu_ps(out + n + 8, _mm256_cvtepi32_ps(hi));
+    }
+    return n;
+}
+#endif
+
+TernaryKernel::TernaryKernel()
+{
+    size = cv::Size(0, 0);
+}
+
+bool TernaryKernel::create(const cv::Mat &kernel)
+{
+    float tap;
+
+    size = cv::Size(0, 0);
+    positive.clear();
+    negative.clear();
+    if (kernel.empty() || kernel.type() != CV_32FC1) return false;
+
+    for (int m = 0; m < kernel.rows; m++)
+    {
+        for (int n = 0; n < kernel.cols; n++)
+        {
+            tap = kernel.at<float>(m, n);
+            if (tap == 1) positive.push_back(cv::Point(n, m));
+            else if (tap == -1) negative.push_back(cv::Point(n, m));
+            else if (tap != 0)
+            {
+                positive.clear();
+                negative.clear();
+                return false;
+            }
+        }
+    }
+
+    //Same anchor as filter2D's default
+    size = kernel.size();
+    anchor = cv::Point(size.width/2, size.height/2);
+    return true;
+}
+
+void TernaryKernel::correlate(const cv::Mat &image, cv::Mat &correlation)
+{
+    std::vector<int> &pos = positiveOffsets, &neg = negativeOffsets;
+    cv::Size imageSize = image.size();
+    int n;
+
+    //Extend the image so that every tap lands in it, as filter2D does
+    cv::copyMakeBorder(image, padded, anchor.y, size.height - 1 - anchor.y,
+                       anchor.x, size.width - 1 - anchor.x, cv::BORDER_REFLECT_101);
+    correlation.create(imageSize, CV_32FC1);
+
+    pos.resize(positive.size());
+    neg.resize(negative.size());
+    for (unsigned int k = 0; k < positive.size(); k++) pos[k] = positive[k].y*padded.step + positive[k].x;
+    for (unsigned int k = 0; k < negative.size(); k++) neg[k] = negative[k].y*padded.step + negative[k].x;
+
+    for (int m = 0; m < imageSize.height; m++)
+    {
+        const unsigned char *in = padded.ptr<unsigned char>(m);
+        float *out = correlation.ptr<float>(m);
+        n = 0;
+
+#ifdef TERNARY_SIMD
+        if (ternary_vector_width == 32)
+            n = CorrelateRowAVX2(in, pos.data(), pos.size(), neg.data(), neg.size(), imageSize.width, out);
+        else if (ternary_vector_width == 16)
+            n = CorrelateRowSSE2(in, pos.data(), pos.size(), neg.data(), neg.size(), imageSize.width, out);
+#endif
+
+        //finish the pixels left over, one at a time
+        for (; n < imageSize.width; n++)
+        {
+            int sum = 0;
+            for (unsigned int k = 0; k < pos.size(); k++) sum += in[n + pos[k]];
+            for (unsigned int k = 0; k < neg.size(); k++) sum -= in[n + neg[k]];
+            out[n] = sum;
+        }
+    }
+}
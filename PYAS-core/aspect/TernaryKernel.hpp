@@ -0,0 +1,51 @@
+/*
+
+  TernaryKernel
+
+  Correlates an 8-bit image with a kernel whose taps are all +1, -1, or 0,
+  such as the fiducial mask made by matchKernel().  Rather than multiplying
+  floats, the pixels under the +1 taps are added and those under the -1 taps
+  subtracted in 16-bit integers, 16 output pixels at a time with SSE2 or
+  AVX2, so the sums are exact.  Kernels with more taps of one sign than fit
+  in 16 bits are summed in pieces.
+
+  The result is the same as
+      cv::filter2D(image, correlation, CV_32FC1, kernel);
+  with the default anchor and border, including the use of pixels outside
+  image when it is part of a larger frame.
+      TernaryKernel ternary;
+      if (ternary.create(kernel)) ternary.correlate(image, correlation);
+  create() returns false if kernel has any other values.  The padded image
+  is kept between calls, so correlating same-sized images does not allocate.
+
+*/
+
+#ifndef _TERNARYKERNEL_HPP_
+#define _TERNARYKERNEL_HPP_
+
+#include <opencv.hpp>
+#include <vector>
+
+class TernaryKernel
+{
+public:
+    TernaryKernel();
+
+    //Takes the taps from a CV_32FC1 kernel, returning false if it isn't ternary
+    bool create(const cv::Mat &kernel);
+    bool empty() const { return size.area() == 0; };
+
+    //Correlates the CV_8UC1 image, leaving a CV_32FC1 result in correlation
+    void correlate(const cv::Mat &image, cv::Mat &correlation);
+
+private:
+    cv::Size size;
+    cv::Point anchor;
+    std::vector<cv::Point> positive, negative;
+
+    cv::Mat padded;
+    //Offsets of the taps from the top-left corner of the kernel in padded
+    std::vector<int> positiveOffsets, negativeOffsets;
+};
+
+#endif
@@ -26,6 +26,8 @@ public:
     void get_packet( uint8_t *packet  );
     void init_connection( void );
     void close_connection( void );
+    //For serving the socket some other way, like from a Reactor
+    int get_socket( void ) { return sock; }
 };
 
 class CommandReceiver: public UDPReceiver {
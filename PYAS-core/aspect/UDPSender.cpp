@@ -1,34 +1,45 @@
 #include <stdio.h>      /* for printf() and fprintf() */
-#include <sys/socket.h> /* for socket(), connect(), sendto(), and recvfrom() */
+#include <sys/socket.h> /* for socket(), connect(), send(), and sendmmsg() */
 #include <arpa/inet.h>  /* for sockaddr_in and inet_addr() */
 #include <stdlib.h>     /* for atoi() and exit() */
 #include <string.h>     /* for memset() */
 #include <unistd.h>     /* for close() */
+#include <errno.h>      /* for errno */
 #include "UDPSender.hpp"
 
-UDPSender::UDPSender(void) : sendPort(7000)
+UDPSender::UDPSender(void) : sock(-1), sendPort(7000), batch_count(0),
+                             stat_packets(0), stat_syscalls(0)
 {
     char ip[] = "192.168.1.114";
     sendtoIP = new char[strlen(ip)+1];
     strcpy(sendtoIP, ip);
+    clock_gettime(CLOCK_MONOTONIC, &stat_start);
 }
 
-UDPSender::UDPSender( const char *ip, unsigned short port ) : sendPort(port)
+UDPSender::UDPSender( const char *ip, unsigned short port ) : sock(-1), sendPort(port),
+                                                              batch_count(0),
+                                                              stat_packets(0), stat_syscalls(0)
 {
     sendtoIP = new char[strlen(ip)+1];
     strcpy(sendtoIP, ip);
+    clock_gettime(CLOCK_MONOTONIC, &stat_start);
 }
 
 UDPSender::~UDPSender()
 {
-    delete sendtoIP;
+    close_connection();
+    delete[] sendtoIP;
 }
 
 int UDPSender::init_connection( void )
 {
+    /* The socket persists for the life of the sender */
+    if (sock >= 0) return sock;
+
     /* Create a datagram/UDP socket */
     if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0){
         printf("UDPSender: socket() failed\n");
+        return sock;
     }
 
     /* Construct the server address structure */
@@ -36,34 +47,104 @@ int UDPSender::init_connection( void )
     sendAddr.sin_family = AF_INET;                 /* Internet addr family */
     sendAddr.sin_addr.s_addr = inet_addr(sendtoIP);  /* Server IP address */
     sendAddr.sin_port = htons(sendPort);     /* Server port */
-    
+
+    /* Fix the destination so that every send skips the address lookup */
+    if (connect(sock, (struct sockaddr *) &sendAddr, sizeof(sendAddr)) < 0){
+        printf("UDPSender: connect() failed\n");
+        close_connection();
+    }
+
     return sock;
 }
 
 void UDPSender::close_connection( void )
 {
-    close(sock);
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
 }
 
 void UDPSender::send( Packet *packet )
-{    
+{
     int bytesSent;
+    uint8_t payload[PACKET_MAX_SIZE];
 
     if( init_connection() >= 0){
-        // update the frame number every time we send out a packet
-        //printf("UDPSender: Sending to %s\n", sendtoIP);
-        
-        uint8_t *payload = new uint8_t[packet->getLength()];
-        packet->outputTo(payload);
-    
-        bytesSent = sendto(sock, payload, packet->getLength(), 0, (struct sockaddr *)
-                           &sendAddr, sizeof(sendAddr));
-        if (bytesSent != packet->getLength()){
-            printf("UDPSender: sendto() sent a different number of bytes (%u)than expected\n", bytesSent);
+        uint16_t length = packet->outputTo(payload);
+
+        bytesSent = ::send(sock, payload, length, 0);
+        stat_syscalls++;
+        if (bytesSent != length){
+            printf("UDPSender: send() sent a different number of bytes (%d) than expected\n", bytesSent);
+        } else stat_packets++;
+        if (bytesSent == -1){ printf("UDPSender: send() failed!\n"); }
+    }
+}
+
+void UDPSender::add_to_batch( Packet *packet )
+{
+    batch_iov[batch_count].iov_base = batch_buffer[batch_count];
+    batch_iov[batch_count].iov_len = packet->outputTo(batch_buffer[batch_count]);
+    batch_count++;
+
+    if (batch_count == UDP_BATCH_SIZE) flush_batch();
+}
+
+void UDPSender::flush_batch( void )
+{
+    int first = 0;
+
+    if (init_connection() < 0) {
+        batch_count = 0;
+        return;
+    }
+
+#ifdef __linux__
+    for (int i = 0; i < batch_count; i++) {
+        memset(&batch_msg[i], 0, sizeof(batch_msg[i]));
+        batch_msg[i].msg_hdr.msg_iov = &batch_iov[i];
+        batch_msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (first < batch_count) {
+        int sent = sendmmsg(sock, batch_msg+first, batch_count-first, 0);
+        stat_syscalls++;
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            printf("UDPSender: sendmmsg() failed, dropping a packet!\n");
+            first++;
+        } else {
+            stat_packets += sent;
+            first += sent;
         }
-        if (bytesSent == -1){ printf("UDPSender: sendto() failed!\n"); }
     }
-    close_connection();
+#else
+    for (first = 0; first < batch_count; first++) {
+        int bytesSent = ::send(sock, batch_iov[first].iov_base, batch_iov[first].iov_len, 0);
+        stat_syscalls++;
+        if (bytesSent == -1){ printf("UDPSender: send() failed!\n"); }
+        else stat_packets++;
+    }
+#endif
+
+    batch_count = 0;
+}
+
+void UDPSender::report( const char *name )
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - stat_start.tv_sec) + (now.tv_nsec - stat_start.tv_nsec)/1e9;
+
+    printf("%s: %lu packets in %.1f s (%.1f packets/s, %.2f syscalls/packet)\n",
+           name, stat_packets, elapsed,
+           (elapsed > 0 ? stat_packets/elapsed : 0),
+           (stat_packets > 0 ? (double)stat_syscalls/stat_packets : 0));
+
+    stat_packets = 0;
+    stat_syscalls = 0;
+    stat_start = now;
 }
 
 TelemetrySender::TelemetrySender( const char *ip, unsigned short port )
@@ -72,22 +153,37 @@ TelemetrySender::TelemetrySender( const char *ip, unsigned short port )
 void TelemetrySender::send( TelemetryPacket *packet )
 {
     int bytesSent;
+    uint8_t payload[PACKET_MAX_SIZE];
 
     if( init_connection() >= 0){
-        // update the frame number every time we send out a packet
-        //printf("UDPSender: Sending to %s\n", sendtoIP);
-        
-        uint8_t *payload = new uint8_t[packet->getLength()];
-        packet->outputTo(payload);
-    
-        bytesSent = sendto(sock, payload, packet->getLength(), 0, (struct sockaddr *)
-                           &sendAddr, sizeof(sendAddr));
-        if (bytesSent != packet->getLength()){
-            printf("TelemetrySender: sendto() sent a different number of bytes (%u)than expected\n", bytesSent);
-        }
-        if (bytesSent == -1){ printf("TelemetrySender: sendto() failed!\n"); }
+        uint16_t length = packet->outputTo(payload);
+
+        bytesSent = ::send(sock, payload, length, 0);
+        stat_syscalls++;
+        if (bytesSent != length){
+            printf("TelemetrySender: send() sent a different number of bytes (%d) than expected\n", bytesSent);
+        } else stat_packets++;
+        if (bytesSent == -1){ printf("TelemetrySender: send() failed!\n"); }
     }
-    close_connection();
+}
+
+int TelemetrySender::send( TelemetryPacketQueue *queue )
+{
+    //Take everything currently queued with a single lock
+    TelemetryPacketQueue pending;
+    pending << *queue;
+
+    int count = 0;
+    TelemetryPacket tp(NULL);
+
+    while(!pending.empty()) {
+        pending >> tp;
+        add_to_batch(&tp);
+        count++;
+    }
+    if (batch_count > 0) flush_batch();
+
+    return count;
 }
 
 CommandSender::CommandSender( const char *ip, unsigned short port )
@@ -96,22 +192,17 @@ CommandSender::CommandSender( const char *ip, unsigned short port )
 void CommandSender::send( CommandPacket *packet )
 {
     int bytesSent;
-    
+    uint8_t payload[PACKET_MAX_SIZE];
+
     if( init_connection() >= 0){
-        // update the frame number every time we send out a packet
-        //printf("Sending to %s\n", sendtoIP);
-        
-        uint8_t *payload = new uint8_t[packet->getLength()];
-        packet->outputTo(payload);
-    
+        uint16_t length = packet->outputTo(payload);
+
         /* Send the string to the server */
-        
-        bytesSent = sendto(sock, payload, packet->getLength(), 0, (struct sockaddr *)
-                           &sendAddr, sizeof(sendAddr));
-        if (bytesSent != packet->getLength()){
-            printf("CommandSender: sendto() sent a different number of bytes (%u)than expected\n", bytesSent);
-        }
-        if (bytesSent == -1){ printf("CommandSender: sendto() failed!\n"); }
-        close_connection();
-    }      
+        bytesSent = ::send(sock, payload, length, 0);
+        stat_syscalls++;
+        if (bytesSent != length){
+            printf("CommandSender: send() sent a different number of bytes (%d) than expected\n", bytesSent);
+        } else stat_packets++;
+        if (bytesSent == -1){ printf("CommandSender: send() failed!\n"); }
+    }
 }
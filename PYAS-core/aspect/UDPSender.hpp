@@ -1,30 +1,58 @@
 #include <arpa/inet.h>  /* for sockaddr_in and inet_addr() */
+#include <sys/socket.h> /* for sendmmsg() and struct mmsghdr */
+#include <sys/uio.h>    /* for struct iovec */
+#include <time.h>       /* for timespec */
 #include "Command.hpp"
 #include "Telemetry.hpp"
 
+#define UDP_BATCH_SIZE 32           /* packets handed to the kernel per system call */
+
 class UDPSender {
 protected:
-    int sock;                       /* Socket descriptor */
+    int sock;                       /* Socket descriptor, persistent once connected */
     struct sockaddr_in sendAddr;    /* Echo server address */
     unsigned int fromSize;          /* In-out of address size for recvfrom() */
     char *sendtoIP;                 /* IP address to send to */
     unsigned short sendPort;        /* Port to send on*/
 
+    /* Reusable buffers for batched sending */
+    uint8_t batch_buffer[UDP_BATCH_SIZE][PACKET_MAX_SIZE];
+    struct iovec batch_iov[UDP_BATCH_SIZE];
+#ifdef __linux__
+    struct mmsghdr batch_msg[UDP_BATCH_SIZE];
+#endif
+    int batch_count;
+
+    /* Throughput statistics since the last report() */
+    unsigned long stat_packets;
+    unsigned long stat_syscalls;
+    timespec stat_start;
+
+    void add_to_batch( Packet *packet );
+    void flush_batch( void );
+
 public:
     UDPSender( void );
     UDPSender( const char *ip, unsigned short port );
     ~UDPSender();
-        
+
     virtual void send(  Packet *packet  );
     int init_connection( void );
     void close_connection( void );
+
+    //Prints packets/s and syscalls/packet since the last report, then resets
+    void report( const char *name );
 };
 
 class TelemetrySender: public UDPSender {
-   
+
 public:
     TelemetrySender( const char *ip, unsigned short port );
     virtual void send( TelemetryPacket *packet );
+
+    //Drains the entire queue, submitting the packets in batches
+    //Returns the number of packets sent
+    int send( TelemetryPacketQueue *queue );
 };
 
 class CommandSender: public UDPSender {
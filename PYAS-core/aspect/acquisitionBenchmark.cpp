@@ -0,0 +1,194 @@
+/*
+
+  acquisitionBenchmark
+
+  Measures how quickly Aspect finds the Sun again after losing it, with the
+  full-frame chord search (ACQUISITION_DECIMATION of 1) and with the Sun
+  found first in frames decimated by 4 and by 8.
+
+  By default, SyntheticSun frames are played as loss-of-lock sequences: the
+  Sun is tracked for two frames, leaves the field for two, and comes back
+  somewhere else in the frame.  The Sun is found again once Run() gives a
+  center within two pixels of where it was drawn.  Given a directory, its
+  images are replayed instead, and the Sun is found again once Run() gives a
+  center at all.  Either way, Run() is timed on the frames where it is
+  looking for the Sun.
+
+      acquisitionBenchmark [sequences (default 100)]
+      acquisitionBenchmark directory [frames (default 1000)]
+
+*/
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for atoi() and rand() */
+#include <time.h>       /* for clock_gettime() */
+#include <math.h>
+#include <vector>
+
+#include "processing.hpp"
+#include "FrameSource.hpp"
+
+#define FRAME_WIDTH 1296
+#define FRAME_HEIGHT 966
+#define RADIUS 105
+#define MAX_FRAMES 10 // frames to wait for the Sun before giving up on a sequence
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+struct Result
+{
+    int losses, found, firstFrame, totalFrames, worstFrames;
+    int searches;
+    double searchTime, worstTime;
+
+    Result() : losses(0), found(0), firstFrame(0), totalFrames(0), worstFrames(0),
+               searches(0), searchTime(0), worstTime(0) {}
+};
+
+//Runs a frame, timing it if searching, and returns whether there is a
+//center afterwards
+static bool RunFrame(Aspect &aspect, const cv::Mat &frame, bool searching, Result &result, cv::Point2f &center)
+{
+    aspect.LoadFrame(frame);
+    double start = now();
+    aspect.Run();
+    double elapsed = now() - start;
+
+    if (searching)
+    {
+        result.searches++;
+        result.searchTime += elapsed;
+        if (elapsed > result.worstTime) result.worstTime = elapsed;
+    }
+    return aspect.GetPixelCenter(center) == NO_ERROR;
+}
+
+static void Recovered(Result &result, int frames)
+{
+    result.found++;
+    if (frames == 1) result.firstFrame++;
+    result.totalFrames += frames;
+    if (frames > result.worstFrames) result.worstFrames = frames;
+}
+
+static Result Synthetic(int decimation, const std::vector<cv::Point2f> &places)
+{
+    Aspect aspect;
+    SyntheticSun sun;
+    Result result;
+    cv::Mat frame;
+    cv::Point2f center;
+    timespec captureTime;
+    bool locked;
+
+    aspect.SetInteger(ACQUISITION_DECIMATION, decimation);
+    sun.Configure(cv::Size(FRAME_WIDTH, FRAME_HEIGHT), cv::Point(0, 0), 0);
+    sun.StartStream();
+
+    for (unsigned int s = 1; s < places.size(); s++)
+    {
+        //Track, then lose the Sun
+        sun.SetSun(places[s-1], RADIUS);
+        for (int k = 0; k < 2; k++)
+        {
+            sun.Retrieve(frame, captureTime);
+            RunFrame(aspect, frame, false, result, center);
+        }
+        sun.SetSun(cv::Point2f(10*FRAME_WIDTH, 10*FRAME_HEIGHT), RADIUS);
+        for (int k = 0; k < 2; k++)
+        {
+            sun.Retrieve(frame, captureTime);
+            RunFrame(aspect, frame, false, result, center);
+        }
+
+        //Find it again
+        result.losses++;
+        sun.SetSun(places[s], RADIUS);
+        for (int k = 1; k <= MAX_FRAMES; k++)
+        {
+            sun.Retrieve(frame, captureTime);
+            locked = RunFrame(aspect, frame, true, result, center);
+            if (locked && fabs(center.x - places[s].x) < 2 && fabs(center.y - places[s].y) < 2)
+            {
+                Recovered(result, k);
+                break;
+            }
+        }
+    }
+
+    sun.Stop();
+    return result;
+}
+
+static Result Replay(int decimation, const char *directory, int frames)
+{
+    Aspect aspect;
+    ReplaySource replay(directory);
+    Result result;
+    cv::Mat frame;
+    cv::Point2f center;
+    timespec captureTime;
+    bool locked = false, everLocked = false;
+    int lostFor = 0;
+
+    aspect.SetInteger(ACQUISITION_DECIMATION, decimation);
+    if (replay.Connect() != 0) return result;
+    replay.Configure(cv::Size(0, 0), cv::Point(0, 0), 0);
+    replay.Initialize();
+    replay.StartStream();
+
+    for (int k = 0; k < frames; k++)
+    {
+        if (replay.Retrieve(frame, captureTime) != 0) break;
+        if (!locked)
+        {
+            lostFor++;
+            if (everLocked && lostFor == 1) result.losses++;
+        }
+        locked = RunFrame(aspect, frame, !locked, result, center);
+        if (locked)
+        {
+            if (everLocked && lostFor > 0) Recovered(result, lostFor);
+            everLocked = true;
+            lostFor = 0;
+        }
+    }
+
+    replay.Stop();
+    replay.Disconnect();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int decimations[] = {1, 4, 8};
+    int numDecimations = sizeof(decimations)/sizeof(decimations[0]);
+    bool replay = argc > 1 && atoi(argv[1]) == 0;
+    int count = replay ? ((argc > 2) ? atoi(argv[2]) : 1000) : ((argc > 1) ? atoi(argv[1]) : 100);
+
+    //The same places for every decimation, with the whole disk in the frame
+    std::vector<cv::Point2f> places;
+    for (int k = 0; k <= count; k++)
+        places.push_back(cv::Point2f(RADIUS + 5 + rand()%(FRAME_WIDTH - 2*RADIUS - 10) + (rand()%100)/100.0,
+                                     RADIUS + 5 + rand()%(FRAME_HEIGHT - 2*RADIUS - 10) + (rand()%100)/100.0));
+
+    if (replay) printf("Replaying %d frames of %s\n", count, argv[1]);
+    else printf("Finding the Sun after %d losses of lock\n", count);
+    printf("decimation  found  in 1 frame  mean frames  worst  searches  mean time  worst time\n");
+
+    for (int d = 0; d < numDecimations; d++)
+    {
+        Result result = replay ? Replay(decimations[d], argv[1], count) : Synthetic(decimations[d], places);
+        printf("%10d %3d/%-3d %10d %12.2f %6d %9d %7.2f ms %8.2f ms\n", decimations[d], result.found,
+               result.losses, result.firstFrame, result.found ? (double) result.totalFrames/result.found : 0.0,
+               result.worstFrames, result.searches,
+               result.searches ? 1e3*result.searchTime/result.searches : 0.0, 1e3*result.worstTime);
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+
+  centerBenchmark
+
+  Measures how accurately Aspect finds the Sun's center as the number of
+  chords per axis while tracking (NUM_CHORDS_OPERATING) goes down, with the
+  center taken as the mean of the chord midpoints (CIRCLE_FIT of 0) and as
+  the center of a circle fitted to the limb crossings (CIRCLE_FIT of 1).
+
+  SyntheticSun frames, with the fiducials and noise it draws, are played
+  with the Sun wandering a few pixels per frame, so that Aspect keeps
+  tracking it.  For each setting, the RMS and worst distances of the center
+  from where the Sun was drawn, the mean radius, the frames without a
+  center, and the time Run() takes to find the center are reported.  Run
+  with an optional number of frames (default 500) and noise in DN (default
+  6).
+
+*/
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for atoi() and rand() */
+#include <time.h>       /* for clock_gettime() */
+#include <math.h>
+#include <vector>
+
+#include "processing.hpp"
+#include "FrameSource.hpp"
+
+#define FRAME_WIDTH 1296
+#define FRAME_HEIGHT 966
+#define RADIUS 105
+#define STEP 3 // most pixels the Sun moves per frame
+#define SETTLE 3 // frames at the start not counted, while Aspect acquires the Sun
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+struct Result
+{
+    int frames, missed;
+    double sumSquares, worst, radius, time;
+
+    Result() : frames(0), missed(0), sumSquares(0), worst(0), radius(0), time(0) {}
+};
+
+static Result Measure(int chords, int circleFit, float noise, const std::vector<cv::Point2f> &path)
+{
+    Aspect aspect;
+    SyntheticSun sun;
+    Result result;
+    cv::Mat frame;
+    cv::Point2f center;
+    timespec captureTime;
+    float radius;
+    double start, elapsed, distance;
+
+    aspect.SetInteger(NUM_CHORDS_OPERATING, chords);
+    aspect.SetInteger(CIRCLE_FIT, circleFit);
+    sun.SetNoise(noise);
+    sun.Configure(cv::Size(FRAME_WIDTH, FRAME_HEIGHT), cv::Point(0, 0), 0);
+    sun.StartStream();
+
+    for (unsigned int k = 0; k < path.size(); k++)
+    {
+        sun.SetSun(path[k], RADIUS);
+        sun.Retrieve(frame, captureTime);
+        aspect.LoadFrame(frame, captureTime);
+        start = now();
+        aspect.Run(CENTER_PRODUCTS);
+        elapsed = now() - start;
+        if (k < SETTLE) continue;
+
+        result.frames++;
+        result.time += elapsed;
+        if (aspect.GetPixelCenter(center) != NO_ERROR)
+        {
+            result.missed++;
+            continue;
+        }
+        aspect.GetPixelRadius(radius);
+        distance = sqrt(pow(center.x - path[k].x, 2) + pow(center.y - path[k].y, 2));
+        result.sumSquares += distance*distance;
+        if (distance > result.worst) result.worst = distance;
+        result.radius += radius;
+    }
+
+    sun.Stop();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = (argc > 1) ? atoi(argv[1]) : 500;
+    float noise = (argc > 2) ? atof(argv[2]) : 6;
+    int counts[] = {2, 3, 4, 5, 8, 10};
+    int numCounts = sizeof(counts)/sizeof(counts[0]);
+
+    //The same wandering path for every setting, keeping the whole disk in
+    //the frame
+    std::vector<cv::Point2f> path;
+    cv::Point2f place(FRAME_WIDTH/2 + 0.37, FRAME_HEIGHT/2 + 0.61);
+    for (int k = 0; k < frames; k++)
+    {
+        place.x += STEP*((rand()%2001)/1000.0 - 1);
+        place.y += STEP*((rand()%2001)/1000.0 - 1);
+        place.x = std::min(std::max(place.x, (float) 2*RADIUS), (float) FRAME_WIDTH - 2*RADIUS);
+        place.y = std::min(std::max(place.y, (float) 2*RADIUS), (float) FRAME_HEIGHT - 2*RADIUS);
+        path.push_back(place);
+    }
+
+    printf("Finding the center in %d frames with %.1f DN of noise\n", frames, noise);
+    printf("chords  method     RMS error  worst error  mean radius  missed  mean time\n");
+
+    for (int c = 0; c < numCounts; c++)
+    {
+        for (int circleFit = 0; circleFit <= 1; circleFit++)
+        {
+            Result result = Measure(counts[c], circleFit, noise, path);
+            int found = result.frames - result.missed;
+            printf("%6d  %-9s %7.3f px %9.3f px %9.2f px %7d %7.2f ms\n", counts[c],
+                   circleFit ? "circle" : "midpoint", found ? sqrt(result.sumSquares/found) : 0.0,
+                   result.worst, found ? result.radius/found : 0.0, result.missed,
+                   result.frames ? 1e3*result.time/result.frames : 0.0);
+        }
+    }
+
+    return 0;
+}
@@ -1,3 +1,6 @@
+#ifndef _COMPRESSION_HPP_
+#define _COMPRESSION_HPP_
+
 #include "opencv.hpp"
 #include "utilities.hpp"
 #include <string>
@@ -12,3 +15,5 @@ struct HeaderData
 int writePNGImage(cv::InputArray _image, const std::string fileName);
 int writeFITSImage(cv::InputArray, HeaderData keys, const std::string fileName);
 int readFITSImage(const std::string fileName, cv::OutputArray image);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+
+  correlationBenchmark
+
+  Compares cv::filter2D against TernaryKernel for the fiducial correlation in
+  Aspect::FindPixelFiducials, over a solar sub-image cut from a full frame.
+  The kernels are crosses drawn the way Mask.png is, for a range of fiducial
+  lengths and widths (FIDUCIAL_LENGTH and FIDUCIAL_WIDTH), with -1 along the
+  inside of the cross and +1 along the outside.  Checks that the peaks agree.
+  Run with an optional number of repetitions (default 20) and sub-image size
+  (default 211, the diameter of the Sun).
+
+*/
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for atoi() and rand() */
+#include <time.h>       /* for clock_gettime() */
+#include <math.h>
+
+#include <opencv.hpp>
+#include "TernaryKernel.hpp"
+
+#define FRAME_WIDTH 1296
+#define FRAME_HEIGHT 966
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Whether (m, n) is on a cross of the given width spanning a side x side kernel
+static bool onCross(int m, int n, int side, int width)
+{
+    int half = side/2;
+    if (m < 1 || n < 1 || m > side-2 || n > side-2) return false;
+    return abs(m - half) <= width/2 || abs(n - half) <= width/2;
+}
+
+//A cross kernel like Mask.png, which is this for a length of 15 and width of 2
+static cv::Mat crossKernel(int length, int width)
+{
+    int side = length + 10;
+    cv::Mat kernel(side, side, CV_32FC1, cv::Scalar(0));
+    for (int m = 0; m < side; m++)
+    {
+        for (int n = 0; n < side; n++)
+        {
+            int neighbors = onCross(m-1, n, side, width) + onCross(m+1, n, side, width) +
+                            onCross(m, n-1, side, width) + onCross(m, n+1, side, width);
+            if (onCross(m, n, side, width))
+            {
+                if (neighbors < 4) kernel.at<float>(m, n) = -1;
+            }
+            else if (neighbors > 0) kernel.at<float>(m, n) = 1;
+        }
+    }
+    return kernel;
+}
+
+int main(int argc, char *argv[])
+{
+    int reps = (argc > 1) ? atoi(argv[1]) : 20;
+    int side = (argc > 2) ? atoi(argv[2]) : 211;
+    int lengths[] = {9, 15, 15, 21, 27, 35};
+    int widths[] = {2, 2, 4, 2, 4, 4};
+    int numKernels = sizeof(lengths)/sizeof(lengths[0]);
+
+    cv::Mat frame(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC1);
+    for (int m = 0; m < frame.rows; m++)
+        for (int n = 0; n < frame.cols; n++)
+            frame.at<unsigned char>(m, n) = rand();
+    cv::Mat image = frame(cv::Rect((FRAME_WIDTH - side)/2, (FRAME_HEIGHT - side)/2, side, side));
+
+    printf("Correlating a %dx%d sub-image, %d repetitions\n", side, side, reps);
+    printf("length width  kernel  taps   filter2D   TernaryKernel  speedup  difference  peaks\n");
+
+    for (int k = 0; k < numKernels; k++)
+    {
+        cv::Mat kernel = crossKernel(lengths[k], widths[k]);
+        cv::Mat expected, result;
+        TernaryKernel ternary;
+        ternary.create(kernel);
+
+        double start = now();
+        for (int r = 0; r < reps; r++) cv::filter2D(image, expected, CV_32FC1, kernel, cv::Point(-1,-1));
+        double generic = (now() - start)/reps;
+
+        start = now();
+        for (int r = 0; r < reps; r++) ternary.correlate(image, result);
+        double specialized = (now() - start)/reps;
+
+        double difference = 0;
+        for (int m = 0; m < side; m++)
+            for (int n = 0; n < side; n++)
+                difference = std::max(difference, (double) fabs(expected.at<float>(m, n) - result.at<float>(m, n)));
+
+        cv::Point expectedPeak, resultPeak;
+        cv::minMaxLoc(expected, NULL, NULL, NULL, &expectedPeak);
+        cv::minMaxLoc(result, NULL, NULL, NULL, &resultPeak);
+
+        printf("%6d %5d  %3dx%-3d %5d %8.3f ms %11.3f ms %7.1fx %11.2g  %s\n", lengths[k], widths[k],
+               kernel.cols, kernel.rows, cv::countNonZero(kernel), generic*1e3, specialized*1e3,
+               generic/specialized, difference, (expectedPeak == resultPeak) ? "match" : "DIFFER");
+    }
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "crc16.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC16_PCLMUL
+#include <cpuid.h>      /* for __get_cpuid() */
+#include <emmintrin.h>  /* for SSE2 intrinsics */
+#include <wmmintrin.h>  /* for _mm_clmulepi64_si128() */
+#endif
+
+#define CRC16_POLY 0xA001 // reflected form of x^16 + x^15 + x^2 + 1
+
+static bool crc16_initialized = false;
+static bool crc16_use_pclmul = false;
+
+//crc_table[0] is the usual byte-at-a-time table, and crc_table[k] advances
+//the contribution of a byte by k more bytes
+static uint16_t crc_table[8][256];
+
+//x2n_table[k] is x^(2^k) modulo the polynomial
+static uint16_t x2n_table[32];
+
+//Folding constants for the carry-less multiplication path
+static uint64_t fold_k1, fold_k2;
+
+//Multiplies two polynomials modulo the CRC polynomial, in the reflected bit order
+static uint16_t multmodp(uint16_t a, uint16_t b)
+{
+    uint16_t m = 0x8000, p = 0;
+
+    if (a == 0) return 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m-1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC16_POLY : b >> 1;
+    }
+    return p;
+}
+
+//Returns x^(n*2^k) modulo the CRC polynomial
+static uint16_t x2nmodp(size_t n, unsigned k)
+{
+    uint16_t p = 0x8000; // x^0
+
+    while (n) {
+        if (n & 1) p = multmodp(x2n_table[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static void crc16_init()
+{
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i;
+        for (int j = 0; j < 8; j++) crc = (crc & 1) ? (crc >> 1) ^ CRC16_POLY : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            crc_table[k][i] = (crc_table[k-1][i] >> 8) ^ crc_table[0][crc_table[k-1][i] & 0xff];
+        }
+    }
+
+    x2n_table[0] = 0x4000; // x^1
+    for (int k = 1; k < 32; k++) x2n_table[k] = multmodp(x2n_table[k-1], x2n_table[k-1]);
+
+    //A 16-byte block is folded forward by 16 bytes by multiplying its first
+    //half by x^192 and its second half by x^128.  Carry-less multiplication of
+    //reflected operands yields the product times x^-1, so x^191 and x^127 are
+    //used instead, placed in the top 16 bits of a 64-bit operand.
+    fold_k1 = (uint64_t)x2nmodp(191, 0) << 48;
+    fold_k2 = (uint64_t)x2nmodp(127, 0) << 48;
+
+#ifdef CRC16_PCLMUL
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) crc16_use_pclmul = (ecx & bit_PCLMUL) != 0;
+#endif
+
+    crc16_initialized = true;
+}
+
+//Builds the tables before main(), the checks in the functions below only
+//matter for CRCs computed during static initialization of other files
+static struct Crc16Initializer {
+    Crc16Initializer() { if (!crc16_initialized) crc16_init(); }
+} crc16_initializer;
+
+uint16_t crc16_update_sliced(uint16_t crc, const void *data, size_t num)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    if (!crc16_initialized) crc16_init();
+
+    while (num >= 8) {
+        uint32_t lo = (p[0] | (p[1] << 8)) ^ crc;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][lo >> 8] ^
+              crc_table[5][p[2]] ^ crc_table[4][p[3]] ^
+              crc_table[3][p[4]] ^ crc_table[2][p[5]] ^
+              crc_table[1][p[6]] ^ crc_table[0][p[7]];
+        p += 8;
+        num -= 8;
+    }
+    while (num--) crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#ifdef CRC16_PCLMUL
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc16_update_pclmul(uint16_t crc, const uint8_t *p, size_t num)
+{
+    //The CRC register is XORed into the first two bytes, then each 16-byte
+    //block is folded into the next, leaving a single block to finish with the
+    //tables starting from zero
+    __m128i k = _mm_set_epi64x(fold_k2, fold_k1);
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), _mm_cvtsi32_si128(crc));
+    p += 16;
+    num -= 16;
+
+    while (num >= 16) {
+        __m128i first = _mm_clmulepi64_si128(x, k, 0x00);
+        __m128i second = _mm_clmulepi64_si128(x, k, 0x11);
+        x = _mm_xor_si128(_mm_xor_si128(first, second), _mm_loadu_si128((const __m128i *)p));
+        p += 16;
+        num -= 16;
+    }
+
+    uint8_t folded[16];
+    _mm_storeu_si128((__m128i *)folded, x);
+    crc = crc16_update_sliced(0, folded, 16);
+
+    return crc16_update_sliced(crc, p, num);
+}
+#endif
+
+uint16_t crc16_update(uint16_t crc, const void *data, size_t num)
+{
+    if (!crc16_initialized) crc16_init();
+
+#ifdef CRC16_PCLMUL
+    if (crc16_use_pclmul && (num >= 32)) return crc16_update_pclmul(crc, (const uint8_t *)data, num);
+#endif
+
+    return crc16_update_sliced(crc, data, num);
+}
+
+uint16_t crc16_shift(uint16_t crc, size_t num)
+{
+    if (!crc16_initialized) crc16_init();
+
+    return multmodp(x2nmodp(num, 3), crc);
+}
+
+bool crc16_has_pclmul()
+{
+    if (!crc16_initialized) crc16_init();
+
+    return crc16_use_pclmul;
+}
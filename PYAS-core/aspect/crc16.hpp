@@ -0,0 +1,44 @@
+/*
+
+  CRC-16
+
+  A faster engine for the same CRC-16 that lib_crc's update_crc_16() computes
+  (reflected polynomial 0xA001), used for the checksums of HEROES packets.
+  Rather than one table lookup per byte, the data is consumed 8 bytes per step
+  (slicing-by-8).  On x86 processors with the PCLMULQDQ instruction, buffers of
+  32 bytes or more are instead folded 16 bytes per step with carry-less
+  multiplication.  The choice is made once, at start-up, based on CPUID.
+
+  Because the CRC is linear, it can be maintained incrementally:
+      uint16_t crc = CRC16_INIT;
+      crc = crc16_update(crc, header, 16);
+      crc = crc16_update(crc, payload, 1000);
+  gives the same result as a single call over the concatenated bytes.  If bytes
+  at position loc of an n-byte buffer are later changed, XOR the old and new
+  values into delta and correct the CRC without revisiting the buffer:
+      crc ^= crc16_shift(crc16_update(0, delta, num), n-loc-num);
+
+*/
+
+#ifndef _CRC16_HPP_
+#define _CRC16_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC16_INIT 0xffff
+
+//Continues the CRC over num more bytes, using the fastest available path
+uint16_t crc16_update(uint16_t crc, const void *data, size_t num);
+
+//The portable slicing-by-8 path, exposed for testing and benchmarking
+uint16_t crc16_update_sliced(uint16_t crc, const void *data, size_t num);
+
+//Returns the CRC after num zero bytes have been appended
+//Runs in time proportional to log(num)
+uint16_t crc16_shift(uint16_t crc, size_t num);
+
+//Whether crc16_update() is using carry-less multiplication
+bool crc16_has_pclmul();
+
+#endif
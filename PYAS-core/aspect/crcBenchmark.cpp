@@ -0,0 +1,97 @@
+/*
+
+  crcBenchmark
+
+  Compares the CRC-16 throughput of lib_crc's update_crc_16() against the
+  slicing-by-8 and carry-less multiplication paths in crc16, checks that they
+  agree, and times building and validating a full frame's worth of image
+  packets.  Run with an optional number of repetitions (default 20).
+
+*/
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for atoi() and rand() */
+#include <time.h>       /* for clock_gettime() */
+#include <vector>
+#include <algorithm>
+
+#include "crc16.hpp"
+#include "lib_crc/lib_crc.h"
+#include "Image.hpp"
+
+#define FRAME_BYTES (1296*966)
+#define PACKET_BYTES 1024
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static uint16_t lib_crc_packet(const uint8_t *data, size_t num)
+{
+    unsigned short value = 0xffff;
+    for(size_t i = 0; i < num; i++) value = update_crc_16(value, (char)data[i]);
+    return value;
+}
+
+int main(int argc, char *argv[])
+{
+    int reps = (argc > 1) ? atoi(argv[1]) : 20;
+    std::vector<uint8_t> frame(FRAME_BYTES);
+    for(size_t i = 0; i < frame.size(); i++) frame[i] = rand();
+
+    printf("CRC-16 over a %d-byte frame in %d-byte packets, %d repetitions\n", FRAME_BYTES, PACKET_BYTES, reps);
+    printf("PCLMULQDQ %s\n", crc16_has_pclmul() ? "available" : "not available");
+
+    uint16_t result[3] = {0, 0, 0};
+    double elapsed[3] = {0, 0, 0};
+    const char *name[3] = {"lib_crc", "slicing-by-8", "crc16_update"};
+
+    for(int method = 0; method < 3; method++) {
+        double start = now();
+        for(int r = 0; r < reps; r++) {
+            for(size_t offset = 0; offset < frame.size(); offset += PACKET_BYTES) {
+                size_t num = std::min((size_t)PACKET_BYTES, frame.size()-offset);
+                switch(method) {
+                    case 0: result[method] ^= lib_crc_packet(&frame[offset], num); break;
+                    case 1: result[method] ^= crc16_update_sliced(CRC16_INIT, &frame[offset], num); break;
+                    case 2: result[method] ^= crc16_update(CRC16_INIT, &frame[offset], num); break;
+                }
+            }
+        }
+        elapsed[method] = now()-start;
+    }
+
+    for(int method = 0; method < 3; method++) {
+        printf("%-14s %8.1f MB/s  (%.2fx)  %s\n", name[method],
+               reps*frame.size()/elapsed[method]/1e6, elapsed[0]/elapsed[method],
+               (result[method] == result[0] ? "matches" : "MISMATCH"));
+    }
+
+    //Full image packet path, which computes the checksum as bytes are appended
+    ImagePacketQueue queue;
+    double start = now();
+    for(int r = 0; r < reps; r++) {
+        queue.add_array(0, 1296, 966, &frame[0]);
+        queue.synchronize();
+        if(r < reps-1) queue.clear();
+    }
+    double build = now()-start;
+
+    size_t count = queue.size();
+    int invalid = 0;
+    ImagePacket ip(NULL);
+    start = now();
+    while(!queue.empty()) {
+        queue >> ip;
+        if(!ip.valid()) invalid++;
+    }
+    double check = now()-start;
+
+    printf("add_array + synchronize: %.2f ms per frame\n", build/reps*1e3);
+    printf("extract and valid() on %zu packets: %.2f ms, %d invalid\n", count, check*1e3, invalid);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+
+  fiducialBenchmark
+
+  Times fiducial identification as the number of fiducials grows from 10 to
+  200.  The previous search over every pair of fiducials, with a scan of all
+  of the distances for each well-spaced pair, is compared against
+  IdentifyFiducials(), which pairs fiducials on a grid of spacing-sized
+  buckets and looks the distances up in a DistanceTable, and the IDs are
+  checked to be
+  identical.  The fiducials are the pattern nearest the center of the screen,
+  placed on the image the way SyntheticSun draws them, with a little noise
+  and one spurious point for every ten fiducials.  Run with an optional
+  number of repetitions (default 200).
+
+*/
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for atoi() and rand() */
+#include <time.h>       /* for clock_gettime() */
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "processing.hpp"
+
+#define SPACING 15.5
+#define SPACING_TOL 1.5
+#define PLATE_SCALE (SPACING/90) // pixels per screen unit
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static float noise()
+{
+    return (rand()%1000)/1000.0 - 0.5;
+}
+
+static bool closer(const cv::Point &a, const cv::Point &b)
+{
+    return a.x*a.x + a.y*a.y < b.x*b.x + b.y*b.y;
+}
+
+//The identification used by Aspect before IdentifyFiducials
+static void PairSearch(const CoordList &pixelFiducials, float fiducialSpacing, float fiducialSpacingTol,
+                       const std::vector<float> &mDistances, const std::vector<float> &nDistances,
+                       IndexList &fiducialIDs)
+{
+    unsigned int d, k, l, K;
+    float rowDiff, colDiff;
+    IndexList rowPairs, colPairs;
+    K = pixelFiducials.size();
+    fiducialIDs.clear();
+    fiducialIDs.resize(K, cv::Point2i(-100,-100));
+
+    for (k = 0; k < K; k++)
+    {
+        for (l = k+1; l < K; l++)
+        {
+            rowDiff = pixelFiducials[k].y - pixelFiducials[l].y;
+            if (fabs(rowDiff) > (float) fiducialSpacing - fiducialSpacingTol &&
+                fabs(rowDiff) < (float) fiducialSpacing + fiducialSpacingTol)
+                colPairs.push_back(cv::Point(k,l));
+
+            colDiff = pixelFiducials[k].x - pixelFiducials[l].x;
+            if (fabs(colDiff) > (float) fiducialSpacing - fiducialSpacingTol &&
+                fabs(colDiff) < (float) fiducialSpacing + fiducialSpacingTol)
+                rowPairs.push_back(cv::Point(k,l));
+        }
+    }
+
+    for (k = 0; k <  rowPairs.size(); k++)
+    {
+        rowDiff = pixelFiducials[rowPairs[k].y].y - pixelFiducials[rowPairs[k].x].y;
+        for (d = 0; d < mDistances.size(); d++)
+        {
+            if (fabs(fabs(rowDiff) - mDistances[d]) < fiducialSpacingTol)
+            {
+                if (rowDiff > 0)
+                {
+                    fiducialIDs[rowPairs[k].x].y = d-7;
+                    fiducialIDs[rowPairs[k].y].y = d+1-7;
+                }
+                else
+                {
+                    fiducialIDs[rowPairs[k].x].y = d+1-7;
+                    fiducialIDs[rowPairs[k].y].y = d-7;
+                }
+            }
+        }
+    }
+
+    for (k = 0; k <  colPairs.size(); k++)
+    {
+        colDiff = pixelFiducials[colPairs[k].x].x - pixelFiducials[colPairs[k].y].x;
+        for (d = 0; d <  nDistances.size(); d++)
+        {
+            if (fabs(fabs(colDiff) - nDistances[d]) < fiducialSpacingTol)
+            {
+                if (colDiff > 0)
+                {
+                    fiducialIDs[colPairs[k].x].x = d-7;
+                    fiducialIDs[colPairs[k].y].x = d+1-7;
+                }
+                else
+                {
+                    fiducialIDs[colPairs[k].x].x = d+1-7;
+                    fiducialIDs[colPairs[k].y].x = d-7;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int reps = (argc > 1) ? atoi(argv[1]) : 200;
+    int counts[] = {10, 20, 40, 80, 120, 160, 200};
+    int numCounts = sizeof(counts)/sizeof(counts[0]);
+
+    //Same distances as Aspect
+    std::vector<float> distances;
+    for (int k = 0; k < 14; k++)
+    {
+        if (k < 7) distances.push_back((84-k*6)*SPACING/15);
+        else distances.push_back((45 + (k-7)*6)*SPACING/15);
+    }
+    DistanceTable table;
+    table.create(distances, SPACING_TOL);
+
+    std::vector<cv::Point> pattern;
+    for (int i = -7; i <= 7; i++)
+        for (int j = -7; j <= 7; j++)
+            pattern.push_back(cv::Point(i, j));
+    std::stable_sort(pattern.begin(), pattern.end(), closer);
+
+    printf("Identifying fiducials, %d repetitions\n", reps);
+    printf("fiducials  pair search  IdentifyFiducials  speedup  identified  IDs\n");
+
+    for (int c = 0; c < numCounts; c++)
+    {
+        CoordList fiducials;
+        for (int k = 0; k < counts[c]; k++)
+        {
+            cv::Point2f screen = fiducialIDtoScreen(pattern[k]);
+            fiducials.add(648 - screen.x*PLATE_SCALE + noise(), 483 + screen.y*PLATE_SCALE + noise());
+        }
+        for (int k = 0; k < counts[c]/10; k++)
+            fiducials.add(rand()%1296, rand()%966);
+        std::random_shuffle(fiducials.begin(), fiducials.end());
+
+        IndexList expected, result;
+        double start = now();
+        for (int r = 0; r < reps; r++) PairSearch(fiducials, SPACING, SPACING_TOL, distances, distances, expected);
+        double search = (now() - start)/reps;
+
+        start = now();
+        for (int r = 0; r < reps; r++) IdentifyFiducials(fiducials, SPACING, SPACING_TOL, table, table, result);
+        double indexed = (now() - start)/reps;
+
+        int identified = 0;
+        for (unsigned int k = 0; k < result.size(); k++)
+            if (result[k].x > -10 && result[k].y > -10) identified++;
+
+        printf("%9d %9.1f us %15.1f us %7.1fx %7d/%-3d  %s\n", (int) fiducials.size(), search*1e6, indexed*1e6,
+               search/indexed, identified, counts[c], (expected == result) ? "identical" : "DIFFER");
+    }
+
+    return 0;
+}
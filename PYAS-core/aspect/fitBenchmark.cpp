@@ -0,0 +1,189 @@
+/*
+
+  fitBenchmark
+
+  Times the line fits made for one frame: two per limb chord and one per
+  mapping axis.  The previous LinearFit(), which built cv::Mats and called
+  cv::eigen() and cv::solve() for every fit, is compared against FitLine()
+  called once per fit and against a LineFitBatch solved once per frame, and
+  the largest error of each against a long double reference is reported.  Run with an
+  optional number of frames (default 2000) and chords per axis (default 20,
+  as when acquiring the Sun).
+
+*/
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for atoi() and rand() */
+#include <time.h>       /* for clock_gettime() */
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <opencv.hpp>
+#include "fitting.hpp"
+
+#define LIMB_WIDTH 2
+#define NUM_MAPPING_POINTS 10
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//The fit used by Aspect before fitting.cpp
+static void LinearFit(const std::vector<float> &x, const std::vector<float> &y, std::vector<float> &fit)
+{
+    cv::Scalar init(0);
+    cv::Mat A(2,2,CV_32FC1, init), B(2,1,CV_32FC1, init), X(2,1,CV_32FC1, init);
+    cv::Mat eigenvalues;
+    float N, cond;
+    unsigned int l;
+
+    N = (float) x.size();
+    A.at<float>(1,1) = N;
+
+    for (l = 0; l <  x.size(); l++)
+    {
+        A.at<float>(0,0) += x[l]*x[l];
+        A.at<float>(0,1) += x[l];
+        B.at<float>(1) += y[l];
+        B.at<float>(0) += x[l]*y[l];
+    }
+
+    A.at<float>(1,0) = A.at<float>(0,1);
+
+    cv::eigen(A, eigenvalues);
+    cond = eigenvalues.at<float>(0)/eigenvalues.at<float>(1);
+    (void) cond;
+
+    cv::solve(A,B,X,cv::DECOMP_CHOLESKY);
+
+    fit.clear();
+    fit.resize(2);
+    fit[0] = X.at<float>(1); //intercept
+    fit[1] = X.at<float>(0); //slope
+}
+
+//Reference fit, from the normal equations in long double
+static void ReferenceFit(const float *x, const float *y, int n, LineFit &fit)
+{
+    long double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int l = 0; l < n; l++)
+    {
+        sx += x[l];
+        sy += y[l];
+        sxx += (long double) x[l]*x[l];
+        sxy += (long double) x[l]*y[l];
+    }
+    long double slope = (n*sxy - sx*sy)/(n*sxx - sx*sx);
+    fit.slope = slope;
+    fit.intercept = (sy - slope*sx)/n;
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = (argc > 1) ? atoi(argv[1]) : 2000;
+    int chords = (argc > 2) ? atoi(argv[2]) : 20;
+    int numFits = 2*2*chords + 2;
+
+    //Limb edges are ramps of 2*LIMB_WIDTH+1 pixels across a frame, and the
+    //mapping fits fiducial positions to screen positions
+    std::vector<int> start(numFits+1);
+    std::vector<float> x, y;
+    for (int k = 0; k < numFits; k++)
+    {
+        start[k] = x.size();
+        if (k < numFits - 2)
+        {
+            int edge = 100 + rand()%1000;
+            for (int l = edge - LIMB_WIDTH; l <= edge + LIMB_WIDTH; l++)
+            {
+                x.push_back(l);
+                y.push_back(10 + 40*(l - edge + LIMB_WIDTH) + rand()%5);
+            }
+        }
+        else
+        {
+            for (int l = 0; l < NUM_MAPPING_POINTS; l++)
+            {
+                float pixel = 560 + 15.5*(rand()%12) + (rand()%100)/100.0;
+                x.push_back(pixel);
+                y.push_back(3760 - 5.81*pixel + (rand()%100)/100.0);
+            }
+        }
+    }
+    start[numFits] = x.size();
+
+    printf("%d fits per frame (%d chords per axis plus the mapping), %d frames\n", numFits, chords, frames);
+
+    std::vector<LineFit> result[3];
+    double elapsed[3] = {0, 0, 0};
+    const char *name[3] = {"LinearFit", "FitLine", "LineFitBatch"};
+    for (int method = 0; method < 3; method++) result[method].resize(numFits);
+
+    //cv::Mat path, copying each neighborhood into vectors as Aspect did
+    std::vector<float> px, py, fit;
+    double begin = now();
+    for (int f = 0; f < frames; f++)
+    {
+        for (int k = 0; k < numFits; k++)
+        {
+            px.clear(); py.clear();
+            for (int l = start[k]; l < start[k+1]; l++)
+            {
+                px.push_back(x[l]);
+                py.push_back(y[l]);
+            }
+            LinearFit(px, py, fit);
+            result[0][k].intercept = fit[0];
+            result[0][k].slope = fit[1];
+        }
+    }
+    elapsed[0] = now() - begin;
+
+    begin = now();
+    for (int f = 0; f < frames; f++)
+    {
+        for (int k = 0; k < numFits; k++)
+            FitLine(&x[start[k]], &y[start[k]], NULL, start[k+1] - start[k], result[1][k]);
+    }
+    elapsed[1] = now() - begin;
+
+    LineFitBatch batch;
+    begin = now();
+    for (int f = 0; f < frames; f++)
+    {
+        batch.clear();
+        for (int k = 0; k < numFits; k++)
+        {
+            batch.begin();
+            for (int l = start[k]; l < start[k+1]; l++) batch.add(x[l], y[l]);
+        }
+        batch.solve();
+    }
+    elapsed[2] = now() - begin;
+    for (int k = 0; k < numFits; k++) result[2][k] = batch[k];
+
+    std::vector<LineFit> reference(numFits);
+    for (int k = 0; k < numFits; k++) ReferenceFit(&x[start[k]], &y[start[k]], start[k+1] - start[k], reference[k]);
+
+    for (int method = 0; method < 3; method++)
+    {
+        double error = 0;
+        for (int k = 0; k < numFits; k++)
+        {
+            //compare where the lines cross the middle of their points
+            double mid = (x[start[k]] + x[start[k+1]-1])/2;
+            error = std::max(error, fabs((result[method][k].intercept + result[method][k].slope*mid) -
+                                         (reference[k].intercept + reference[k].slope*mid)));
+        }
+        printf("%-13s %8.2f us per frame  (%.1fx)  largest error %.2g\n", name[method],
+               elapsed[method]/frames*1e6, elapsed[0]/elapsed[method], error);
+    }
+
+    printf("mapping condition numbers: %.3g %.3g\n", result[1][numFits-2].condition, result[1][numFits-1].condition);
+
+    return 0;
+}
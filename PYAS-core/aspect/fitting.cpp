@@ -0,0 +1,238 @@
+#include "fitting.hpp"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+float FitLine(const float *x, const float *y, const float *w, int n, LineFit &fit)
+{
+    double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    double x0, wk, dx, dy, mx, my, det, r;
+
+    fit.intercept = fit.slope = 0;
+    fit.condition = std::numeric_limits<float>::infinity();
+    if (n < 2) return fit.condition;
+
+    //Sums are taken about the first point to limit cancellation
+    x0 = x[0];
+    for (int k = 0; k < n; k++)
+    {
+        wk = w ? w[k] : 1;
+        dx = x[k] - x0;
+        dy = y[k];
+        sw += wk;
+        sx += wk*dx;
+        sy += wk*dy;
+        sxx += wk*dx*dx;
+        sxy += wk*dx*dy;
+    }
+    if (sw <= 0) return fit.condition;
+
+    //Solve the centered normal equations
+    mx = sx/sw;
+    my = sy/sw;
+    det = sxx - sx*mx;
+    if (!(det > 0)) return fit.condition;
+    fit.slope = (sxy - sx*my)/det;
+    fit.intercept = my - fit.slope*(mx + x0);
+
+    //Scaling the columns of [x 1] to unit length leaves a normal matrix of
+    //[1 r; r 1], where r is the cosine between them, with eigenvalues 1 +/- r
+    sx += sw*x0;
+    sxx = det + sx*sx/sw;
+    r = fabs(sx)/sqrt(sxx*sw);
+    fit.condition = (r < 1) ? (1 + r)/(1 - r) : std::numeric_limits<float>::infinity();
+    return fit.condition;
+}
+
+void LineFitBatch::clear()
+{
+    x.clear();
+    y.clear();
+    w.clear();
+    start.clear();
+    fits.clear();
+}
+
+int LineFitBatch::begin()
+{
+    start.push_back(x.size());
+    fits.push_back(LineFit());
+    return fits.size() - 1;
+}
+
+void LineFitBatch::add(float xk, float yk, float wk)
+{
+    x.push_back(xk);
+    y.push_back(yk);
+    w.push_back(wk);
+}
+
+void LineFitBatch::solve()
+{
+    int K = fits.size();
+    int end;
+
+    for (int k = 0; k < K; k++)
+    {
+        end = (k + 1 < K) ? start[k+1] : x.size();
+        FitLine(x.data() + start[k], y.data() + start[k], w.data() + start[k], end - start[k], fits[k]);
+    }
+}
+
+bool FitCircle(const float *x, const float *y, const unsigned char *use, int n, CircleFit &fit)
+{
+    double mx = 0, my = 0, Mxx = 0, Myy = 0, Mxy = 0, Mxz = 0, Myz = 0, Mzz = 0;
+    double dx, dy, z, Mz, covXY, varZ, A0, A1, A2, A3, root, value, slope, next, nextValue, det, cx, cy;
+    double sumSquares = 0, distance;
+    int count = 0;
+
+    fit.x = fit.y = fit.radius = fit.rms = 0;
+    fit.points = 0;
+
+    for (int k = 0; k < n; k++)
+    {
+        if (use && !use[k]) continue;
+        mx += x[k];
+        my += y[k];
+        count++;
+    }
+    if (count < 3) return false;
+    mx /= count;
+    my /= count;
+
+    //Moments about the centroid
+    for (int k = 0; k < n; k++)
+    {
+        if (use && !use[k]) continue;
+        dx = x[k] - mx;
+        dy = y[k] - my;
+        z = dx*dx + dy*dy;
+        Mxx += dx*dx;
+        Myy += dy*dy;
+        Mxy += dx*dy;
+        Mxz += dx*z;
+        Myz += dy*z;
+        Mzz += z*z;
+    }
+    Mxx /= count;
+    Myy /= count;
+    Mxy /= count;
+    Mxz /= count;
+    Myz /= count;
+    Mzz /= count;
+
+    //Taubin's characteristic polynomial, whose root nearest 0 from above
+    //gives the circle
+    Mz = Mxx + Myy;
+    covXY = Mxx*Myy - Mxy*Mxy;
+    varZ = Mzz - Mz*Mz;
+    A3 = 4*Mz;
+    A2 = -3*Mz*Mz - Mzz;
+    A1 = varZ*Mz + 4*covXY*Mz - Mxz*Mxz - Myz*Myz;
+    A0 = Mxz*(Mxz*Myy - Myz*Mxy) + Myz*(Myz*Mxx - Mxz*Mxy) - varZ*covXY;
+
+    //Newton's method from 0 decreases steadily to that root
+    root = 0;
+    value = A0;
+    for (int iteration = 0; iteration < 99; iteration++)
+    {
+        slope = A1 + root*(2*A2 + 3*A3*root);
+        next = root - value/slope;
+        if (next == root || !std::isfinite(next)) break;
+        nextValue = A0 + next*(A1 + next*(A2 + next*A3));
+        if (fabs(nextValue) >= fabs(value)) break;
+        root = next;
+        value = nextValue;
+    }
+
+    det = root*root - root*Mz + covXY;
+    if (!(fabs(det) > 0)) return false;
+    cx = (Mxz*(Myy - root) - Myz*Mxy)/(2*det);
+    cy = (Myz*(Mxx - root) - Mxz*Mxy)/(2*det);
+    if (!std::isfinite(cx) || !std::isfinite(cy)) return false;
+
+    fit.x = cx + mx;
+    fit.y = cy + my;
+    fit.radius = sqrt(cx*cx + cy*cy + Mz);
+    fit.points = count;
+
+    for (int k = 0; k < n; k++)
+    {
+        if (use && !use[k]) continue;
+        distance = sqrt(pow(x[k] - fit.x, 2) + pow(y[k] - fit.y, 2)) - fit.radius;
+        sumSquares += distance*distance;
+    }
+    fit.rms = sqrt(sumSquares/count);
+    return true;
+}
+
+//Marks the points within tolerance of a circle, returning how many there are
+static int CircleInliers(const float *x, const float *y, int n, double cx, double cy, double radius,
+                         float tolerance, std::vector<unsigned char> &inliers)
+{
+    int count = 0;
+
+    for (int k = 0; k < n; k++)
+    {
+        inliers[k] = fabs(sqrt((x[k] - cx)*(x[k] - cx) + (y[k] - cy)*(y[k] - cy)) - radius) < tolerance;
+        count += inliers[k];
+    }
+    return count;
+}
+
+bool FitCircleRansac(const float *x, const float *y, int n, float tolerance, int iterations,
+                     CircleFit &fit, std::vector<unsigned char> &inliers)
+{
+    std::vector<unsigned char> candidate;
+    unsigned int state = 2463534242u;
+    int a, b, c, count, best = 0;
+    double bx, by, cx, cy, det, ux, uy, radius;
+
+    inliers.assign(n, 1);
+    if (n < 3) return FitCircle(x, y, NULL, n, fit);
+    candidate.resize(n);
+
+    for (int iteration = 0; iteration < iterations && best < n; iteration++)
+    {
+        //Three different points, from a xorshift generator with a fixed seed
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        a = state % n;
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        b = state % (n - 1);
+        if (b >= a) b++;
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        c = state % (n - 2);
+        if (c >= std::min(a, b)) c++;
+        if (c >= std::max(a, b)) c++;
+
+        //The circle through them, relative to the first
+        bx = x[b] - x[a];
+        by = y[b] - y[a];
+        cx = x[c] - x[a];
+        cy = y[c] - y[a];
+        det = 2*(bx*cy - by*cx);
+        if (!(fabs(det) > 0)) continue;
+        ux = (cy*(bx*bx + by*by) - by*(cx*cx + cy*cy))/det;
+        uy = (bx*(cx*cx + cy*cy) - cx*(bx*bx + by*by))/det;
+        radius = sqrt(ux*ux + uy*uy);
+        if (!std::isfinite(radius)) continue;
+
+        count = CircleInliers(x, y, n, ux + x[a], uy + y[a], radius, tolerance, candidate);
+        if (count > best)
+        {
+            best = count;
+            inliers.swap(candidate);
+        }
+    }
+
+    //Fit the points near the best circle, then once more those near the fit
+    if (best < 3) inliers.assign(n, 1);
+    if (!FitCircle(x, y, inliers.data(), n, fit)) return false;
+    candidate.resize(n);
+    if (CircleInliers(x, y, n, fit.x, fit.y, fit.radius, tolerance, candidate) >= 3 && candidate != inliers)
+    {
+        inliers.swap(candidate);
+        return FitCircle(x, y, inliers.data(), n, fit);
+    }
+    return true;
+}
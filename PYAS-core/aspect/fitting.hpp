@@ -0,0 +1,101 @@
+/*
+
+  Line fitting
+
+  Weighted least-squares fits of y = intercept + slope*x, solved in closed
+  form from the 2x2 normal equations.  Nothing is allocated per fit, so the
+  fits can be run for every chord of every frame.
+
+  A single fit is made from arrays:
+      LineFit fit;
+      FitLine(x, y, NULL, n, fit);  // NULL weights fits every point equally
+      if (fit.condition > limit) ...
+
+  Many fits are queued in a LineFitBatch and solved together.  The points are
+  kept in separate x, y, and weight arrays whose memory is reused from one
+  frame to the next:
+      batch.clear();
+      for each fit: { batch.begin(); for each point: batch.add(x, y); }
+      batch.solve();
+      batch[k].slope ...
+
+  The condition number is that of the normal equations after scaling the x
+  and constant columns to unit length, so it does not depend on the units of
+  x.  It grows as the x values bunch together relative to their distance from
+  0, and is infinite when there are fewer than two distinct x values.
+
+  Circle fitting
+
+  FitCircle() is Taubin's algebraic fit, which like Kasa's is solved in
+  closed form (up to a few Newton steps on a cubic), but without Kasa's
+  pull toward smaller circles when the points are noisy or cover only part
+  of the circle.  FitCircleRansac() first looks for the circle through
+  three of the points that the most points lie within tolerance of, then
+  fits the points near it, so that a few bad points are left out:
+      CircleFit circle;
+      std::vector<unsigned char> inliers;
+      if (FitCircleRansac(x, y, n, 1.0, 32, circle, inliers)) ... circle.x, circle.y, circle.radius
+
+*/
+
+#ifndef _FITTING_HPP_
+#define _FITTING_HPP_
+
+#include <vector>
+
+struct LineFit
+{
+    float intercept;
+    float slope;
+    float condition;
+};
+
+//Fits a line to the n points (x[k], y[k]) with weights w[k], or equal
+//weights if w is NULL.  Returns the condition number.
+float FitLine(const float *x, const float *y, const float *w, int n, LineFit &fit);
+
+class LineFitBatch
+{
+public:
+    //Removes all of the fits, keeping the memory
+    void clear();
+
+    //Starts a new fit, which following calls to add() go into
+    //Returns the index of the fit
+    int begin();
+    void add(float x, float y, float w = 1);
+
+    //Fits every line queued since clear()
+    void solve();
+
+    int size() const { return fits.size(); };
+    const LineFit& operator[](int k) const { return fits[k]; };
+
+private:
+    std::vector<float> x, y, w;
+    std::vector<int> start;
+    std::vector<LineFit> fits;
+};
+
+struct CircleFit
+{
+    float x, y;
+    float radius;
+    float rms; // RMS distance of the fitted points from the circle
+    int points; // number of points fitted
+};
+
+//Fits a circle to the n points (x[k], y[k]) for which use[k] is nonzero, or
+//all of them if use is NULL.  Returns false if there are fewer than three
+//such points or they are on a line.
+bool FitCircle(const float *x, const float *y, const unsigned char *use, int n, CircleFit &fit);
+
+//Fits a circle to the n points, leaving out those farther than tolerance
+//from the best of iterations circles through three of them.  inliers[k] is
+//set to 1 for the points fitted and 0 for the others.  The samples are the
+//same for the same n, so the fit is repeatable.  Returns false if no circle
+//could be fitted.
+bool FitCircleRansac(const float *x, const float *y, int n, float tolerance, int iterations,
+                     CircleFit &fit, std::vector<unsigned char> &inliers);
+
+#endif
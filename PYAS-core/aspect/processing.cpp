@@ -2,7 +2,9 @@
    center, fiducials, etc, as well as a local copy of the current frame. 
 
    The idea would be to call "LoadFrame" once, at which point this module would
-   reset all its values. Next, the "Run" function computes all the data products possible.
+   reset all its values. Next, the "Run" function computes all the data products possible,
+   or only those up to the center if the mapping products aren't asked for; their Get
+   functions then compute them if called before the next LoadFrame.
    Requests for data are made with the Get functions, and the necessary data is provided if
    its available, otherwise an error code is returned. Most data is stored as either CoordList or a
    cv::Point. All the functions doing real computation are private, other than "Run."
@@ -13,6 +15,23 @@
 #include <vector>
 #include <list>
 #include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHORD_SIMD
+#include <emmintrin.h>  /* for SSE2 intrinsics */
+#include <immintrin.h>  /* for AVX2 intrinsics */
+#endif
+
+#define MAPPING_MAX_CONDITION 1e6 // above this, the fiducials are too close to a line to fit the mapping
+#define DISTANCE_TABLE_BINS 1024 // most bins in a DistanceTable
+#define SPACED_PAIRS_DIRECT 32 // up to this many points, FindSpacedPairs checks every pair
+#define CHORD_BLOCK 16 // rows copied per column at a time when gathering column chords
+#define ACQUISITION_MAX_DECIMATION 16 // largest decimation whose block sums fit in 16 bits
+#define ACQUISITION_PASSES 3 // centroids taken when finding a lost Sun in the decimated frame
+#define ACQUISITION_BOX 1.25 // half-width of the box around the centroid, in solar radii
+#define CIRCLE_RANSAC_ITERATIONS 32 // circles through three limb crossings tried before fitting them all
+#define TRACKED_FIDUCIALS_KEPT 0.75 // fraction of the fiducials of the last full search that tracking must keep
 
 cv::Point2f fiducialIDtoScreen(cv::Point2i id) 
 {
@@ -155,13 +174,32 @@ const char * GetMessage(const AspectCode& code)
     }
 }
 
+//Whether a center is unusable, so the Sun has to be searched for
+static bool OutOfFrame(cv::Point2f center, cv::Size size)
+{
+    return center.x < 0 || center.x >= size.width ||
+           center.y < 0 || center.y >= size.height ||
+           std::isnan(center.x) || std::isnan(center.y);
+}
+
 Aspect::Aspect()
 {
     frameMin = 255;
     frameMax = 0;
     
     initialNumChords = 20;
-    chordsPerAxis = 5;
+    chordsPerAxis = 3;
+    acquisitionDecimation = 4;
+    acquiring = false;
+    mappingPending = false;
+    trackerSigmas = 4;
+    fiducialWindow = 4;
+    fiducialLevel = fiducialFloor = 0;
+    fullSearches = windowSearches = 0;
+    fullSearchFiducials = 0;
+    frameTime = 0;
+    predictionValid = false;
+    narrowing = false;
     chordThreshold = .25;
     solarRadius = 105;
     limbWidth = 2;
@@ -175,9 +213,13 @@ Aspect::Aspect()
     fiducialSpacingTol = 1.5;
     pixelCenter = cv::Point2f(-1.0, -1.0);
     pixelError = cv::Point2f(0.0, 0.0);
+    pixelRadius = 0;
+    circleFit = 1;
+    circleTolerance = 1;
     
     matchKernel(kernel);
     kernelSize = kernel.size();
+    ternaryKernel.create(kernel);
 
     mDistances.clear();
     nDistances.clear();
@@ -194,6 +236,8 @@ Aspect::Aspect()
             nDistances.push_back((45 + (k-7)*6)*fiducialSpacing/15);
         }
     }
+    mTable.create(mDistances, fiducialSpacingTol);
+    nTable.create(nDistances, fiducialSpacingTol);
     mapping.resize(4);
     state = STALE_DATA;
 }
@@ -204,8 +248,21 @@ Aspect::~Aspect()
 }
 
 AspectCode Aspect::LoadFrame(cv::Mat inputFrame)
+{
+    //Without capture times, the tracker takes the frames to be evenly spaced
+    return LoadFrame(inputFrame, frameTime + 1);
+}
+
+AspectCode Aspect::LoadFrame(cv::Mat inputFrame, const timespec &captureTime)
+{
+    return LoadFrame(inputFrame, captureTime.tv_sec + captureTime.tv_nsec/1e9);
+}
+
+AspectCode Aspect::LoadFrame(cv::Mat inputFrame, double time)
 {
     frameProcessed = false;
+    mappingPending = false;
+    frameTime = time;
     //std::cout << "Aspect: Loading Frame" << std::endl;
     if(inputFrame.empty())
     {
@@ -224,7 +281,9 @@ AspectCode Aspect::LoadFrame(cv::Mat inputFrame)
         }
         else
         {
-            inputFrame.copyTo(frame);
+            //Shares the caller's buffer rather than copying it, so the image must
+            //not change until the caller is done with Run and the Get functions
+            frame = inputFrame;
             frameSize = frame.size();
 
             frameValid = true;
@@ -236,12 +295,15 @@ AspectCode Aspect::LoadFrame(cv::Mat inputFrame)
 
 AspectCode Aspect::Run()
 {
-    cv::Range rowRange, colRange;
-    cv::Mat solarImage;
-    cv::Size solarSize;
-    cv::Point offset;
+    return Run(ALL_PRODUCTS);
+}
+
+AspectCode Aspect::Run(ProductMask products)
+{
     double max, min;
 
+    mappingPending = false;
+
     limbCrossings.clear();    
     slopes.clear();    
     pixelFiducials.clear();
@@ -251,6 +313,14 @@ AspectCode Aspect::Run()
     conditionNumbers.clear();
     conditionNumbers.resize(2);
 
+    //Predict where the Sun will be, unless it was lost
+    if (OutOfFrame(pixelCenter, frameSize))
+    {
+        tracker.reset();
+        trackedFiducials.clear();
+    }
+    predictionValid = tracker.predict(frameTime, predictedCenter, predictedError);
+
     if (state == FRAME_EMPTY)
     {
         //std::cout << "Aspect: Frame is empty." << std::endl;
@@ -260,17 +330,30 @@ AspectCode Aspect::Run()
     else
     {
         //std::cout << "Aspect: Finding max and min pixel values" << std::endl;
-        cv::minMaxLoc(frame, &min, &max, NULL, NULL);
-        frameMin = (unsigned char) min;
-        frameMax = (unsigned char) max;
+        //If the Sun was lost, shrink the frame to look for it in the same pass
+        acquiring = acquisitionDecimation > 1 && OutOfFrame(pixelCenter, frameSize);
+        if (acquiring)
+        {
+            DecimateMinMax(frame, acquisitionDecimation, decimatedFrame, frameMin, frameMax);
+            min = frameMin;
+            max = frameMax;
+        }
+        else
+        {
+            cv::minMaxLoc(frame, &min, &max, NULL, NULL);
+            frameMin = (unsigned char) min;
+            frameMax = (unsigned char) max;
+        }
         if (min >= max || std::isnan(min) || std::isnan(max))
         {
             //std::cout << "Aspect: Max/Min value bad" << std::endl;
+            pixelCenter = cv::Point2f(-1,-1);
             state = MIN_MAX_BAD;
             return state;
         }
         else if(max - min < 64)
         {
+            pixelCenter = cv::Point2f(-1,-1);
             state = DYNAMIC_RANGE_LOW;
             return state;
         }
@@ -307,76 +390,117 @@ AspectCode Aspect::Run()
             state = CENTER_ERROR_LARGE;
             return state;
         }
-        
-        //Find solar subImage
-        //std::cout << "Aspect: Finding solar subimage" << std::endl;
-        rowRange = SafeRange(pixelCenter.y-solarRadius, pixelCenter.y+solarRadius, frameSize.height);
-        colRange = SafeRange(pixelCenter.x-solarRadius, pixelCenter.x+solarRadius, frameSize.width);
-        solarImage = frame(rowRange, colRange);
-        if (solarImage.empty())
-        {
-            //std::cout << "Aspect: Solar Image too empty." << std::endl;
-            state = SOLAR_IMAGE_EMPTY;
-            return state;  
-        }
-        else
-        {
-            solarSize = solarImage.size();
-        }
+        UpdateTracker();
 
-        if (solarSize.width < (int) fiducialSpacing + 2*fiducialLength || 
-            solarSize.height < (int) fiducialSpacing + 2*fiducialLength)
+        //Without the mapping products, stop here; their Get functions run
+        //the rest of the frame if they are called
+        if (!(products & MAPPING_PRODUCTS))
         {
-            //std::cout << "Aspect: Solar Image too small." << std::endl;
-            state = SOLAR_IMAGE_SMALL;
+            mappingPending = true;
+            state = NO_ERROR;
             return state;
         }
+    }
+    return RunMapping();
+}
 
-        //Define offset for converting subimage locations to frame locations
-        offset = cv::Point(colRange.start, rowRange.start);
-        if (offset.x < 0 || offset.x >= (frameSize.width - solarSize.width + 1) ||
-            offset.y < 0 || offset.y >= (frameSize.height - solarSize.height + 1))
-        {
-            //std::cout << "Aspect: Solar Image Offset out of bounds." << std::endl;
-            state = SOLAR_IMAGE_OFFSET_OUT_OF_BOUNDS;
-            return state;
-        }
-            
-        //Find fiducials
-        //std::cout << "Aspect: Finding Fiducials" << std::endl;
-        FindPixelFiducials(solarImage, offset);
-        if (pixelFiducials.size() == 0)
-        {
-            //std::cout << "Aspect: No Fiducials found" << std::endl;
-            state = NO_FIDUCIALS;
-            return state;
-        }
-        else if (pixelFiducials.size() < 3)
-        {
-            //std::cout << "Aspect: Too Few Fiducials" << std::endl;
-            state = FEW_FIDUCIALS;
-            return state;
-        }
+AspectCode Aspect::RunMapping()
+{
+    cv::Range rowRange, colRange;
+    cv::Mat solarImage;
+    cv::Size solarSize;
+    cv::Point offset;
+    bool tracked;
 
-        //Find fiducial IDs
-        //std::cout << "Aspect: Finding fiducial IDs" << std::endl;
-        FindFiducialIDs();
-        if (fiducialIDs.size() == 0)
-        {
-            //std::cout << "Aspect: No Valid IDs" << std::endl;
-            state = NO_IDS;
-            return state;
-        }
+    mappingPending = false;
+
+    //Find solar subImage
+    //std::cout << "Aspect: Finding solar subimage" << std::endl;
+    rowRange = SafeRange(pixelCenter.y-solarRadius, pixelCenter.y+solarRadius, frameSize.height);
+    colRange = SafeRange(pixelCenter.x-solarRadius, pixelCenter.x+solarRadius, frameSize.width);
+    solarImage = frame(rowRange, colRange);
+    if (solarImage.empty())
+    {
+        //std::cout << "Aspect: Solar Image too empty." << std::endl;
+        state = SOLAR_IMAGE_EMPTY;
+        return state;  
+    }
+    else
+    {
+        solarSize = solarImage.size();
+    }
+
+    if (solarSize.width < (int) fiducialSpacing + 2*fiducialLength || 
+        solarSize.height < (int) fiducialSpacing + 2*fiducialLength)
+    {
+        //std::cout << "Aspect: Solar Image too small." << std::endl;
+        state = SOLAR_IMAGE_SMALL;
+        return state;
+    }
+
+    //Define offset for converting subimage locations to frame locations
+    offset = cv::Point(colRange.start, rowRange.start);
+    if (offset.x < 0 || offset.x >= (frameSize.width - solarSize.width + 1) ||
+        offset.y < 0 || offset.y >= (frameSize.height - solarSize.height + 1))
+    {
+        //std::cout << "Aspect: Solar Image Offset out of bounds." << std::endl;
+        state = SOLAR_IMAGE_OFFSET_OUT_OF_BOUNDS;
+        return state;
+    }
         
-        //std::cout << "Aspect: Finding Mapping" << std::endl;
-        FindMapping();
-        if (/*ILL CONDITIONED*/ false)
-        {
-            //std::cout << "Aspect: Mapping is ill-conditioned." << std::endl;
-            state = MAPPING_ILL_CONDITIONED;
-            return state;
-        }
+    //Find fiducials, in windows around those of the last frame if they
+    //are found again with the same IDs, or else in the whole subimage
+    //std::cout << "Aspect: Finding Fiducials" << std::endl;
+    tracked = TrackFiducials(solarImage, offset);
+    if (!tracked) FindPixelFiducials(solarImage, offset);
+    if (pixelFiducials.size() == 0)
+    {
+        //std::cout << "Aspect: No Fiducials found" << std::endl;
+        state = NO_FIDUCIALS;
+        return state;
+    }
+    else if (pixelFiducials.size() < 3)
+    {
+        //std::cout << "Aspect: Too Few Fiducials" << std::endl;
+        state = FEW_FIDUCIALS;
+        return state;
+    }
+
+    //Find fiducial IDs, which tracking already has
+    //std::cout << "Aspect: Finding fiducial IDs" << std::endl;
+    if (!tracked) FindFiducialIDs();
+    if (fiducialIDs.size() == 0)
+    {
+        //std::cout << "Aspect: No Valid IDs" << std::endl;
+        state = NO_IDS;
+        return state;
     }
+    
+    //std::cout << "Aspect: Finding Mapping" << std::endl;
+    FindMapping();
+    if (tracked && (conditionNumbers[0] > MAPPING_MAX_CONDITION ||
+                    conditionNumbers[1] > MAPPING_MAX_CONDITION))
+    {
+        //The tracked fiducials can be too few in a row or column for a
+        //mapping, so try again with those of the whole subimage, which
+        //counts this frame as a full search instead
+        tracked = false;
+        windowSearches--;
+        FindPixelFiducials(solarImage, offset);
+        FindFiducialIDs();
+        if (pixelFiducials.size() >= 3 && fiducialIDs.size() > 0) FindMapping();
+    }
+    if (conditionNumbers[0] > MAPPING_MAX_CONDITION ||
+        conditionNumbers[1] > MAPPING_MAX_CONDITION)
+    {
+        //std::cout << "Aspect: Mapping is ill-conditioned." << std::endl;
+        state = MAPPING_ILL_CONDITIONED;
+        return state;
+    }
+
+    //Track these fiducials in the next frame
+    trackedFiducials = pixelFiducials;
+    trackedIDs = fiducialIDs;
     state = NO_ERROR;
     return state;
 }
@@ -436,6 +560,24 @@ AspectCode Aspect::GetPixelCenter(cv::Point2f &center)
     else return state;
 }
 
+AspectCode Aspect::GetFiducialSearches(unsigned long &full, unsigned long &windowed)
+{
+    full = fullSearches;
+    windowed = windowSearches;
+    return NO_ERROR;
+}
+
+AspectCode Aspect::GetPredictedCenter(cv::Point2f &center, cv::Point2f &error)
+{
+    if (predictionValid)
+    {
+        center = predictedCenter;
+        error = predictedError;
+        return NO_ERROR;
+    }
+    else return STALE_DATA;
+}
+
 AspectCode Aspect::GetPixelError(cv::Point2f &error)
 {
     if (state < CENTER_ERROR)
@@ -446,8 +588,19 @@ AspectCode Aspect::GetPixelError(cv::Point2f &error)
     else return state;
 }
 
+AspectCode Aspect::GetPixelRadius(float &radius)
+{
+    if (state < CENTER_ERROR)
+    {
+        radius = pixelRadius;
+        return NO_ERROR;
+    }
+    else return state;
+}
+
 AspectCode Aspect::GetPixelFiducials(CoordList& fiducials)
 {
+    if (mappingPending) RunMapping();
     if (state < FIDUCIAL_ERROR)
     {
         fiducials.clear();
@@ -461,6 +614,7 @@ AspectCode Aspect::GetPixelFiducials(CoordList& fiducials)
 
 AspectCode Aspect::GetFiducialIDs(IndexList& IDs)
 {
+    if (mappingPending) RunMapping();
     if (state < ID_ERROR)
     {
         IDs.clear();
@@ -473,6 +627,7 @@ AspectCode Aspect::GetFiducialIDs(IndexList& IDs)
 
 AspectCode Aspect::GetMapping(std::vector<float>& map)
 {
+    if (mappingPending) RunMapping();
     if(state < MAPPING_ERROR)
     {
         map.clear();
@@ -485,7 +640,7 @@ AspectCode Aspect::GetMapping(std::vector<float>& map)
 
 AspectCode Aspect::GetScreenCenter(cv::Point2f &center)
 {
-    
+    if (mappingPending) RunMapping();
     if(state < MAPPING_ERROR)
     {
         center = PixelToScreen(pixelCenter);
@@ -496,6 +651,7 @@ AspectCode Aspect::GetScreenCenter(cv::Point2f &center)
 
 AspectCode Aspect::GetScreenFiducials(CoordList& fiducials)
 {
+    if (mappingPending) RunMapping();
     fiducials.clear();
     if (state < MAPPING_ERROR)
     {
@@ -527,6 +683,14 @@ float Aspect::GetFloat(FloatParameter variable)
         return fiducialSpacing;
     case FIDUCIAL_SPACING_TOL:
         return fiducialSpacingTol;
+    case TRACKER_ALPHA:
+        return tracker.getAlpha();
+    case TRACKER_BETA:
+        return tracker.getBeta();
+    case TRACKER_SIGMAS:
+        return trackerSigmas;
+    case CIRCLE_TOLERANCE:
+        return circleTolerance;
     default:
         return 0;
     }
@@ -552,6 +716,12 @@ int Aspect::GetInteger(IntParameter variable)
         return fiducialNeighborhood;
     case NUM_FIDUCIALS:
         return numFiducials;
+    case FIDUCIAL_WINDOW:
+        return fiducialWindow;
+    case CIRCLE_FIT:
+        return circleFit;
+    case ACQUISITION_DECIMATION:
+        return acquisitionDecimation;
     default:
         return 0;
     }
@@ -572,6 +742,20 @@ void Aspect::SetFloat(FloatParameter variable, float value)
         break;
     case FIDUCIAL_SPACING_TOL:
         fiducialSpacingTol = value;
+        mTable.create(mDistances, fiducialSpacingTol);
+        nTable.create(nDistances, fiducialSpacingTol);
+        break;
+    case TRACKER_ALPHA:
+        tracker.setGains(value, tracker.getBeta());
+        break;
+    case TRACKER_BETA:
+        tracker.setGains(tracker.getAlpha(), value);
+        break;
+    case TRACKER_SIGMAS:
+        trackerSigmas = value;
+        break;
+    case CIRCLE_TOLERANCE:
+        circleTolerance = value;
         break;
     default:
         return;
@@ -607,6 +791,15 @@ void Aspect::SetInteger(IntParameter variable, int value)
     case NUM_FIDUCIALS:
         numFiducials = value;
         break;
+    case FIDUCIAL_WINDOW:
+        fiducialWindow = value;
+        break;
+    case CIRCLE_FIT:
+        circleFit = value;
+        break;
+    case ACQUISITION_DECIMATION:
+        acquisitionDecimation = std::min(value, ACQUISITION_MAX_DECIMATION);
+        break;
     default:
         return;
     }
@@ -619,46 +812,41 @@ Aspect Private processing functions
 
 ***********************************************************/
 
-int Aspect::FindLimbCrossings(cv::Mat chord, std::vector<float> &crossings)
+int Aspect::FindLimbCrossings(const unsigned char *chord, int K, unsigned char pixelThreshold,
+                              const cv::Range *windows, int numWindows)
 {
-    std::vector<int> edges;
-    std::vector<float> x, y, fit;
-    unsigned char thisValue, lastValue, pixelThreshold;
-    int K = chord.total();
+    int *edges;
+    int numEdges, numKept;
     int edgeSpread;
-    int edge, min, max;
-    int N;
-
-    float threshold = frameMin + chordThreshold*(frameMax-frameMin);
-    pixelThreshold = (unsigned char) threshold;
-    
-
-    //for each pixel, check if the pixel lies on a potential limb
-    lastValue = (int) chord.at<unsigned char>(0);
-    for (int k = 1; k < K; k++)
+    int edge, min[2], max[2];
+
+    //find every pixel in the windows where the chord crosses the threshold,
+    //as indices into the whole chord
+    if ((int) edgeBuffer.size() < K) edgeBuffer.resize(K);
+    edges = edgeBuffer.data();
+    numEdges = 0;
+    for (int w = 0; w < numWindows; w++)
     {
-        thisValue = (int) chord.at<unsigned char>(k);
-
-        //check for a rising edge, save the index above the threshold
-        if (lastValue <= pixelThreshold && thisValue > pixelThreshold)
-        {
-            edges.push_back(k);
-        }
-        //check for a falling edge
-        else if(lastValue > pixelThreshold && thisValue <= pixelThreshold)
-        {
-            edges.push_back(-(k-1));
-        }
-        lastValue = thisValue;
+        int start = windows[w].start;
+        int found = FindThresholdEdges(chord + start, windows[w].end - start, pixelThreshold, edges + numEdges);
+        for (int k = numEdges; k < numEdges + found; k++)
+            edges[k] += (edges[k] > 0) ? start : -start;
+        numEdges += found;
     }
 
     //Remove edge pairs that seem to correspond to fiducials
     //also remove edge pairs that are too close together
-    for (unsigned int k = 1; k <  edges.size(); k++)
+    //The kept edges are compacted in place, so a removed pair exposes the
+    //edge before it to be paired with the next one
+    numKept = 0;
+    for (int k = 0; k < numEdges; k++)
     {
-        //find distance between next edge pair
+        edges[numKept++] = edges[k];
+        if (numKept < 2) continue;
+
+        //find distance between the last edge pair
         //positive if the region is below the threshold
-        edgeSpread = edges[k] + edges[k-1];
+        edgeSpread = edges[numKept-1] + edges[numKept-2];
 
         //if the pair is along a fiducial
         if(abs(edgeSpread - fiducialLength) <= limbWidth || 
@@ -667,15 +855,22 @@ int Aspect::FindLimbCrossings(cv::Mat chord, std::vector<float> &crossings)
            // or too close together
            abs(edgeSpread) < limbWidth)
         {
-            // remove the pair and update the index accordingly
-            edges.erase(edges.begin() + (k-1), edges.begin() + (k+1));
-            if (k == 1) k -= 1;
-            else k -= 2;
+            // remove the pair
+            numKept -= 2;
         }
     }
 
+    //The circle fit can reject a bad crossing, so a chord with more than
+    //one edge pair gives its outermost edges, which are the limb unless the
+    //disk is cut off
+    if (circleFit && numKept > 2 && edges[0] > 0 && edges[numKept-1] < 0)
+    {
+        edges[1] = edges[numKept-1];
+        numKept = 2;
+    }
+
     //if we still have anything other than a single edge pair, ignore the chord
-    if ( edges.size() != 2)
+    if ( numKept != 2)
     {
         return -1;
     }
@@ -688,34 +883,31 @@ int Aspect::FindLimbCrossings(cv::Mat chord, std::vector<float> &crossings)
     {
         // at this point we're reasonably certain we've found a valid chord
 
-        // for each edge, perform a fit to find the limb crossing
-        crossings.clear();
+        // for each edge, take a neighborhood around the edge
         for (int k = 0; k < 2; k++)
         {
-            //take a neighborhood around the edge
             edge = abs(edges[k]);
-            if ((edge-limbWidth) < 0) min = 0;
-            else min = edge-limbWidth;
+            if ((edge-limbWidth) < 0) min[k] = 0;
+            else min[k] = edge-limbWidth;
             
-            if ((edge+limbWidth) > K) max = K;
-            else max = edge+limbWidth;
+            if ((edge+limbWidth) > K - 1) max[k] = K - 1;
+            else max[k] = edge+limbWidth;
             
-            //if that neighborhood is large enough
-            N = max-min+1;
-            if (N < 2)
+            //if that neighborhood isn't large enough, ignore the chord
+            if (max[k] - min[k] + 1 < 2)
             {
                 return -1;
             }
-            //compute fit to neighborhood
-            x.clear(); y.clear();
-            for (int l = min; l <= max; l++)
+        }
+
+        // queue a fit to each neighborhood to find the limb crossing
+        for (int k = 0; k < 2; k++)
+        {
+            limbFits.begin();
+            for (int l = min[k]; l <= max[k]; l++)
             {
-                x.push_back(l);
-                y.push_back((float) chord.at<unsigned char>(l));
+                limbFits.add(l, chord[l]);
             }
-            LinearFit(x,y,fit);
-            crossings.push_back((threshold - fit[0])/fit[1]);
-            slopes.push_back(fabs(fit[1]));
         }
     }
     return 0; 
@@ -724,19 +916,63 @@ int Aspect::FindLimbCrossings(cv::Mat chord, std::vector<float> &crossings)
 void Aspect::FindPixelCenter()
 {
     std::vector<int> rows, cols;
-    std::vector<float> crossings, midpoints;
-    int rowStart, colStart, rowStep, colStep, limit, K, M;
+    cv::Point2f seed;
+    unsigned int blockThreshold;
+    int factor = acquisitionDecimation;
+
+    //Track the Sun around where it is predicted to be, or else around the
+    //last center, unless it was lost.  With a prediction, the chords are only
+    //searched where the limb is expected.
+    if (!OutOfFrame(pixelCenter, frameSize))
+    {
+        if (predictionValid && !OutOfFrame(predictedCenter, frameSize))
+        {
+            narrowing = trackerSigmas > 0;
+            PlaceChords(predictedCenter, rows, cols);
+        }
+        else PlaceChords(pixelCenter, rows, cols);
+        FindChordCenter(rows, cols);
+        narrowing = false;
+        if (limbCrossings.size() >= 4) return;
+        pixelCenter = cv::Point2f(-1, -1);
+        tracker.reset();
+    }
+
+    //Find it roughly in the decimated frame, and measure it with the chords
+    //around that as though it were being tracked.  If the Sun was only lost
+    //in this frame, the frame still has to be decimated.
+    if (factor > 1)
+    {
+        if (!acquiring) DecimateMinMax(frame, factor, decimatedFrame, frameMin, frameMax);
+        acquiring = true;
+
+        blockThreshold = factor*factor*(frameMin + chordThreshold*(frameMax-frameMin));
+        if (FindCoarseCenter(decimatedFrame, blockThreshold, (float) solarRadius/factor, seed))
+        {
+            pixelCenter = seed*factor + cv::Point2f((factor-1)/2.0, (factor-1)/2.0);
+            PlaceChords(pixelCenter, rows, cols);
+            FindChordCenter(rows, cols);
+            if (limbCrossings.size() >= 4) return;
+            pixelCenter = cv::Point2f(-1, -1);
+        }
+    }
+
+    //Otherwise, search the whole frame
+    PlaceChords(pixelCenter, rows, cols);
+    FindChordCenter(rows, cols);
+}
+
+void Aspect::PlaceChords(cv::Point2f center, std::vector<int> &rows, std::vector<int> &cols)
+{
+    int rowStart, colStart, rowStep, colStep, limit;
     cv::Range rowRange, colRange;
-    float mean, std;
 
     rows.clear();
     cols.clear();
 
     //Determine new row and column locations for chords
-    //If the past center was invalid, search the whole frame
-    if(pixelCenter.x < 0 || pixelCenter.x >= frameSize.width ||
-       pixelCenter.y < 0 || pixelCenter.y >= frameSize.height ||
-       std::isnan(pixelCenter.x) || std::isnan(pixelCenter.y))
+    //If the center is invalid, search the whole frame
+    if(OutOfFrame(center, frameSize))
     {
         ////std::cout << "Aspect: Finding new center" << std::endl;
         limit = initialNumChords;
@@ -752,12 +988,12 @@ void Aspect::FindPixelCenter()
     {
         //std::cout << "Aspect: Searching around old center" << std::endl;
         limit = chordsPerAxis;
-        rowRange = SafeRange(pixelCenter.y - solarRadius,
-                             pixelCenter.y + solarRadius, 
+        rowRange = SafeRange(center.y - solarRadius,
+                             center.y + solarRadius, 
                              frameSize.height);
 
-        colRange = SafeRange(pixelCenter.x - solarRadius,
-                             pixelCenter.x + solarRadius, 
+        colRange = SafeRange(center.x - solarRadius,
+                             center.x + solarRadius, 
                              frameSize.width);
 
         rowStep = (rowRange.end - rowRange.start + 1)/limit;
@@ -774,44 +1010,97 @@ void Aspect::FindPixelCenter()
         rows.push_back(rowStart + k*rowStep);
         cols.push_back(colStart + k*colStep);
     }
+}
+
+void Aspect::FindChordCenter(const std::vector<int> &rows, const std::vector<int> &cols)
+{
+    std::vector<float> midpoints;
+    float crossings[2], threshold;
+    unsigned char pixelThreshold;
+    int K, M, numWindows;
+    cv::Range windows[2], span;
+    float mean, std;
 
     //Initialize
     pixelCenter = cv::Point2f(0,0);
     limbCrossings.clear();
     slopes.clear();
 
+    //Copy the column chords into contiguous rows, so that they can be scanned
+    //like the row chords.  Only the rows that the windows and the fits around
+    //their edges reach are needed.
+    span = cv::Range(0, frameSize.height);
+    if (narrowing)
+    {
+        span = cv::Range(frameSize.height, 0);
+        for (unsigned int k = 0; k < cols.size(); k++)
+        {
+            numWindows = ChordWindows(0, cols[k], frameSize.height, windows);
+            span.start = std::min(span.start, windows[0].start);
+            span.end = std::max(span.end, windows[numWindows-1].end);
+        }
+        span = ClipRange(span.start - limbWidth, span.end + limbWidth, frameSize.height);
+    }
+    GatherColumns(frame, cols, columnChords, span);
+
+    //Find the edges of every chord, queueing a fit for each one
+    threshold = frameMin + chordThreshold*(frameMax-frameMin);
+    pixelThreshold = (unsigned char) threshold;
+    limbFits.clear();
+    limbChords.clear();
+    for (int dim = 0; dim < 2; dim++)
+    {
+        if (dim) K =  rows.size();
+        else K =  cols.size();
+
+        for (int k = 0; k < K; k++)
+        {
+            if (dim)
+            {
+                numWindows = ChordWindows(dim, rows[k], frameSize.width, windows);
+                if (FindLimbCrossings(frame.ptr<unsigned char>(rows[k]), frameSize.width, pixelThreshold,
+                                      windows, numWindows) == 0)
+                    limbChords.add(dim, rows[k]);
+            }
+            else
+            {
+                numWindows = ChordWindows(dim, cols[k], frameSize.height, windows);
+                if (FindLimbCrossings(columnChords.ptr<unsigned char>(k), frameSize.height, pixelThreshold,
+                                      windows, numWindows) == 0)
+                    limbChords.add(dim, cols[k]);
+            }
+        }
+    }
+
+    //Fit all of the edges at once
+    limbFits.solve();
+
     //For each dimension
     for (int dim = 0; dim < 2; dim++)
     {
         //if (dim) std::cout << "Aspect: Searching Rows" << std::endl;
         //else std::cout << "Aspect: Searching Cols" << std::endl;
 
-        if (dim) K =  rows.size();
-        else K =  cols.size();
-
         //Find the midpoints of the chords.
-        //For each chord
+        //For each chord with a pair of edges
         midpoints.clear();
-        for (int k = 0; k < K; k++)
+        for (unsigned int k = 0; k < limbChords.size(); k++)
         {
+            if (limbChords[k].x != dim) continue;
+
             //Determine the limb crossings in that chord
-            crossings.clear();
-            if (dim) FindLimbCrossings(frame.row(rows[k]), crossings);
-            else FindLimbCrossings(frame.col(cols[k]), crossings);
-            
-            //If there seems to be a pair of crossings
-            if (crossings.size() != 2) continue;
-            else
+            for (int l = 0; l < 2; l++)
             {
+                const LineFit &fit = limbFits[2*k + l];
+                crossings[l] = (threshold - fit.intercept)/fit.slope;
+                slopes.push_back(fabs(fit.slope));
+
                 //Save the crossings
-                for (unsigned int l = 0; l < crossings.size(); l++)
-                {
-                    if (dim) limbCrossings.add(crossings[l], rows[k]);
-                    else limbCrossings.add(cols[k], crossings[l]);
-                }
-                //Compute and store the midpoint
-                midpoints.push_back((crossings[0] + crossings[1])/2);
+                if (dim) limbCrossings.add(crossings[l], limbChords[k].y);
+                else limbCrossings.add(limbChords[k].y, crossings[l]);
             }
+            //Compute and store the midpoint
+            midpoints.push_back((crossings[0] + crossings[1])/2);
         }
 
         //Determine the mean of the midpoints for this dimension
@@ -842,89 +1131,128 @@ void Aspect::FindPixelCenter()
             pixelError.y = std;
         }       
     }
+
+    //A circle through all of the crossings is as accurate with fewer chords,
+    //and gives the radius as well.  Otherwise, or if the fit fails, the
+    //radius is the mean distance of the crossings from the midpoint center.
+    if (!circleFit || !FitLimbCircle())
+    {
+        pixelRadius = 0;
+        for (unsigned int k = 0; k < limbCrossings.size(); k++)
+            pixelRadius += sqrt(pow(limbCrossings[k].x - pixelCenter.x, 2) + pow(limbCrossings[k].y - pixelCenter.y, 2));
+        pixelRadius /= limbCrossings.size();
+    }
     //std::cout << "Aspect: Leaving FindPixelCenter" << std::endl;
 }
 
+int Aspect::ChordWindows(int dim, int location, int K, cv::Range *windows)
+{
+    float along, across, alongError, acrossError;
+    float radius, offset, half, margin;
+
+    if (!narrowing)
+    {
+        windows[0] = cv::Range(0, K);
+        return 1;
+    }
+
+    //Row chords run along x, and column chords along y
+    along = dim ? predictedCenter.x : predictedCenter.y;
+    across = dim ? predictedCenter.y : predictedCenter.x;
+    alongError = dim ? predictedError.x : predictedError.y;
+    acrossError = dim ? predictedError.y : predictedError.x;
+
+    //The limb is expected half a chord either side of the center.  Errors
+    //across the chord and in the radius move it further where the chord is
+    //short, near the ends of the disk.
+    radius = tracker.getRadius();
+    offset = location - across;
+    half = sqrt(std::max(radius*radius - offset*offset, 1.0f));
+    margin = trackerSigmas*(alongError + (fabs(offset)*acrossError + radius*tracker.getRadiusError())/half)
+             + limbWidth + 1;
+
+    windows[0] = ClipRange(along - half - margin, along - half + margin + 1, K);
+    windows[1] = ClipRange(along + half - margin, along + half + margin + 1, K);
+
+    //Overlapping windows are searched as one
+    if (windows[1].start <= windows[0].end)
+    {
+        windows[0].end = windows[1].end;
+        return 1;
+    }
+    return 2;
+}
+
+bool Aspect::FitLimbCircle()
+{
+    int K = limbCrossings.size();
+    double dx, dy, distance, radial, errorX = 0, errorY = 0;
+
+    //Needs a crossing more than a circle does, so that there is an error
+    if (K < 4) return false;
+    crossingX.resize(K);
+    crossingY.resize(K);
+    for (int k = 0; k < K; k++)
+    {
+        crossingX[k] = limbCrossings[k].x;
+        crossingY[k] = limbCrossings[k].y;
+    }
+    if (!FitCircleRansac(crossingX.data(), crossingY.data(), K, circleTolerance, CIRCLE_RANSAC_ITERATIONS,
+                         limbCircle, limbInliers) || limbCircle.points < 4)
+        return false;
+
+    //The error on each axis is the RMS of the distances of the fitted
+    //crossings from the circle, along that axis
+    for (int k = 0; k < K; k++)
+    {
+        if (!limbInliers[k]) continue;
+        dx = crossingX[k] - limbCircle.x;
+        dy = crossingY[k] - limbCircle.y;
+        radial = sqrt(dx*dx + dy*dy);
+        if (radial <= 0) continue;
+        distance = radial - limbCircle.radius;
+        errorX += pow(distance*dx/radial, 2);
+        errorY += pow(distance*dy/radial, 2);
+    }
+
+    pixelCenter = cv::Point2f(limbCircle.x, limbCircle.y);
+    pixelError = cv::Point2f(sqrt(errorX/limbCircle.points), sqrt(errorY/limbCircle.points));
+    pixelRadius = limbCircle.radius;
+    return true;
+}
+
+void Aspect::UpdateTracker()
+{
+    tracker.update(frameTime, pixelCenter, pixelRadius);
+}
+
 void Aspect::FindPixelFiducials(cv::Mat image, cv::Point offset)
 {
-    cv::Scalar mean, stddev;
     cv::Size imageSize;
-    cv::Mat correlation, nbhd;
+    cv::Mat correlation;
     cv::Range rowRange, colRange;
-    float threshold, thisValue, thatValue, minValue;
+    float thisValue, floor;
     double Cm, Cn, average;
-    int minIndex;
-    bool redundant;
 
     pixelFiducials.clear();
     imageSize = image.size();
+    fullSearches++;
 
-    cv::filter2D(image, correlation, CV_32FC1, kernel, cv::Point(-1,-1));
-    cv::normalize(correlation,correlation,0,1,cv::NORM_MINMAX);
-        
-    cv::meanStdDev(correlation, mean, stddev);
+    if (!ternaryKernel.empty()) ternaryKernel.correlate(image, correlation);
+    else cv::filter2D(image, correlation, CV_32FC1, kernel, cv::Point(-1,-1));
 
-    threshold = mean[0] + fiducialThreshold*stddev[0];
-        
-    for (int m = 1; m < imageSize.height-1; m++)
-    {
-        for (int n = 1; n < imageSize.width-1; n++)
-        {        
-            thisValue = correlation.at<float>(m,n);
-            if(thisValue > threshold)
-            {
-                if((thisValue > correlation.at<float>(m, n+1)) &
-                   (thisValue > correlation.at<float>(m, n- 1)) &
-                   (thisValue > correlation.at<float>(m+1, n)) &
-                   (thisValue > correlation.at<float>(m-1, n)))
-                {
-                    redundant = false;
-                    for (unsigned int k = 0; k <  pixelFiducials.size(); k++)
-                    {
-                        if (abs(pixelFiducials[k].y - m) < fiducialLength &&
-                            abs(pixelFiducials[k].x - n) < fiducialLength)
-                        {
-                            redundant = true;
-                            thatValue = correlation.at<float>((int) pixelFiducials[k].y,
-                                                              (int) pixelFiducials[k].x);
-                            if ( thisValue > thatValue)
-                            {
-                                pixelFiducials[k] = cv::Point2f(n,m);
-                            }
-                            break;
-                        }
-                    }
-                    if (redundant == true)
-                        continue;
-
-                    if ( (int) pixelFiducials.size() < numFiducials)
-                    {
-                        pixelFiducials.add(n, m);
-                    }
-                    else
-                    {
-                        minValue = kernelSize.width*kernelSize.height*256;
-                        minIndex = -1;
-                        for (int k = 0; k < numFiducials; k++)
-                        {
-                            if (correlation.at<float>((int) pixelFiducials[k].y,
-                                                      (int) pixelFiducials[k].x) 
-                                < minValue)
-                            {
-                                minIndex = k;
-                                minValue = correlation.at<float>((int) pixelFiducials[k].y,
-                                                                 (int) pixelFiducials[k].x);
-                            }   
-                        }
-                        if (thisValue > minValue)
-                        {
-                            pixelFiducials[minIndex] = cv::Point2f(n, m);
-                        }
-                    }
-                }
-            }
-        }
-    }
+    //Keep the strongest local maxima of the correlation that stand out from
+    //the rest of it, merging those closer together than a fiducial
+    peakFinder.find(correlation, fiducialThreshold, fiducialLength, numFiducials);
+    for (int k = 0; k < peakFinder.size(); k++)
+        pixelFiducials.add(peakFinder[k].x, peakFinder[k].y);
+
+    //The centroids are weighted by the correlation above its minimum.  Both
+    //are kept for tracking the fiducials in windows.
+    floor = peakFinder.getMin();
+    fiducialFloor = floor;
+    fiducialLevel = peakFinder.getMean() + fiducialThreshold*peakFinder.getStdDev();
+    fullSearchFiducials = pixelFiducials.size();
 
     //Refine positions to sub-pixel
     //For each fiducial location
@@ -945,7 +1273,7 @@ void Aspect::FindPixelFiducials(cv::Mat image, cv::Point offset)
         {
             for (int n = colRange.start; n <= colRange.end; n++)
             {
-                thisValue = correlation.at<float>(m,n);
+                thisValue = correlation.at<float>(m,n) - floor;
                 Cm += m*thisValue;
                 Cn += n*thisValue;
                 average += thisValue;
@@ -960,90 +1288,106 @@ void Aspect::FindPixelFiducials(cv::Mat image, cv::Point offset)
     return;
 }
 
-void Aspect::FindFiducialIDs()
+bool Aspect::TrackFiducials(cv::Mat image, cv::Point offset)
 {
-    unsigned int d, k, l, K;
-    float rowDiff, colDiff;
-    IndexList rowPairs, colPairs;
-    CoordList trash;
-    K = pixelFiducials.size();
-    fiducialIDs.clear();
-    fiducialIDs.resize(K, cv::Point2i(-100,-100));
+    cv::Size imageSize = image.size();
+    std::vector<int> found;
+    float peak, value;
+    double Cm, Cn, average;
+    int half, cm, cn, pm, pn, edge;
 
+    if (fiducialWindow <= 0 || trackedFiducials.size() < 3) return false;
 
-    rowPairs.clear();
-    colPairs.clear();
-    //Find fiducial pairs that are spaced correctly
-    //std::cout << "Aspect: Find valid fiducial pairs" << std::endl;
-    //std::cout << "Aspect: Searching through " << K << " Fiducials" << std::endl;
-    for (k = 0; k < K; k++)
-    {
-        for (l = k+1; l < K; l++)
-        {
-            rowDiff = pixelFiducials[k].y - pixelFiducials[l].y;
-            if (fabs(rowDiff) > (float) fiducialSpacing - fiducialSpacingTol &&
-                fabs(rowDiff) < (float) fiducialSpacing + fiducialSpacingTol)
-                colPairs.push_back(cv::Point(k,l));
-
-            colDiff = pixelFiducials[k].x - pixelFiducials[l].x;
-            if (fabs(colDiff) > (float) fiducialSpacing - fiducialSpacingTol &&
-                fabs(colDiff) < (float) fiducialSpacing + fiducialSpacingTol)
-                rowPairs.push_back(cv::Point(k,l));
-        }
-    }
-    
-    //std::cout << "Aspect: Compute intra-pair distances for row pairs." << std::endl;
-    for (k = 0; k <  rowPairs.size(); k++)
-    {
-        rowDiff = pixelFiducials[rowPairs[k].y].y 
-            - pixelFiducials[rowPairs[k].x].y;
+    //Each window leaves room around the search area for the neighbors of a
+    //peak and the centroid
+    edge = std::max(fiducialNeighborhood, 1);
+    half = fiducialWindow + edge;
 
-        for (d = 0; d < mDistances.size(); d++)
+    //The fiducials are fixed on the screen, so each is looked for where it
+    //was in the last frame
+    pixelFiducials.clear();
+    for (unsigned int k = 0; k < trackedFiducials.size(); k++)
+    {
+        cm = cvRound(trackedFiducials[k].y) - offset.y;
+        cn = cvRound(trackedFiducials[k].x) - offset.x;
+        if (cm - half < 0 || cm + half >= imageSize.height ||
+            cn - half < 0 || cn + half >= imageSize.width) continue;
+
+        cv::Mat window = image(cv::Range(cm - half, cm + half + 1), cv::Range(cn - half, cn + half + 1));
+        if (!ternaryKernel.empty()) ternaryKernel.correlate(window, windowCorrelation);
+        else cv::filter2D(window, windowCorrelation, CV_32FC1, kernel, cv::Point(-1,-1));
+
+        //The strongest point of the search area has to be a peak above the
+        //level of the last full search
+        pm = pn = edge;
+        peak = windowCorrelation.at<float>(pm, pn);
+        for (int m = edge; m < 2*half + 1 - edge; m++)
         {
-            if (fabs(fabs(rowDiff) - mDistances[d]) < fiducialSpacingTol)
+            for (int n = edge; n < 2*half + 1 - edge; n++)
             {
-                if (rowDiff > 0) 
-                {
-                    fiducialIDs[rowPairs[k].x].y = d-7;
-                    fiducialIDs[rowPairs[k].y].y = d+1-7;
-                }
-                else
+                if (windowCorrelation.at<float>(m, n) > peak)
                 {
-                    fiducialIDs[rowPairs[k].x].y = d+1-7;
-                    fiducialIDs[rowPairs[k].y].y = d-7;
+                    peak = windowCorrelation.at<float>(m, n);
+                    pm = m;
+                    pn = n;
                 }
             }
         }
-    }
-
-    //std::cout << "Aspect: Compute intra-pair distances for col pairs." << std::endl;
-    for (k = 0; k <  colPairs.size(); k++)
-    {
-        colDiff = pixelFiducials[colPairs[k].x].x 
-            - pixelFiducials[colPairs[k].y].x;
-        for (d = 0; d <  nDistances.size(); d++)
+        if (peak <= fiducialLevel) continue;
+        bool isPeak = true;
+        for (int m = pm - 1; m <= pm + 1; m++)
+            for (int n = pn - 1; n <= pn + 1; n++)
+                if ((m != pm || n != pn) && windowCorrelation.at<float>(m, n) >= peak) isPeak = false;
+        if (!isPeak) continue;
+
+        //Refine to sub-pixel as for the full search
+        Cm = 0.0; Cn = 0.0; average = 0.0;
+        for (int m = pm - fiducialNeighborhood; m <= pm + fiducialNeighborhood; m++)
         {
-            if (fabs(fabs(colDiff) - nDistances[d]) < fiducialSpacingTol)
+            for (int n = pn - fiducialNeighborhood; n <= pn + fiducialNeighborhood; n++)
             {
-                if (colDiff > 0) 
-                {
-                    fiducialIDs[colPairs[k].x].x = d-7;
-                    fiducialIDs[colPairs[k].y].x = d+1-7;
-                }
-                else
-                {
-                    fiducialIDs[colPairs[k].x].x = d+1-7;
-                    fiducialIDs[colPairs[k].y].x = d-7;
-                }
+                value = windowCorrelation.at<float>(m, n) - fiducialFloor;
+                Cm += m*value;
+                Cn += n*value;
+                average += value;
             }
         }
+        pixelFiducials.add((float) (Cn/average + (double) (cn - half + offset.x)),
+                           (float) (Cm/average + (double) (cm - half + offset.y)));
+        found.push_back(k);
+    }
+
+    //Losing too many of those from the last full search means the Sun has
+    //moved off them, and the full search is needed to find the ones it has
+    //moved onto
+    if (found.size() < 3 || found.size() < TRACKED_FIDUCIALS_KEPT*fullSearchFiducials)
+        return false;
+
+    //A fiducial found again with a different ID means the mapping has changed
+    FindFiducialIDs();
+    for (unsigned int k = 0; k < found.size(); k++)
+    {
+        cv::Point last = trackedIDs[found[k]], now = fiducialIDs[k];
+        if ((last.x > -10 && now.x > -10 && last.x != now.x) ||
+            (last.y > -10 && now.y > -10 && last.y != now.y))
+            return false;
     }
+
+    windowSearches++;
+    return true;
+}
+
+void Aspect::FindFiducialIDs()
+{
+    IdentifyFiducials(pixelFiducials, fiducialSpacing, fiducialSpacingTol,
+                      mTable, nTable, fiducialIDs);
     fiducialIDsValid = true;
 }       
 
 void Aspect::FindMapping()
 {
-    std::vector<float> x, y, fit;
+    std::vector<float> x, y;
+    LineFit fit;
     cv::Point2f screenPoint;
     mapping.clear();
     mapping.resize(4);
@@ -1068,9 +1412,9 @@ void Aspect::FindMapping()
                 y.push_back(screenPoint.y);
             }
         }
-        LinearFit(x,y,fit);
-        mapping[2*dim + 0] = fit[0];
-        mapping[2*dim + 1] = fit[1];
+        conditionNumbers[dim] = FitLine(x.data(), y.data(), NULL, x.size(), fit);
+        mapping[2*dim + 0] = fit.intercept;
+        mapping[2*dim + 1] = fit.slope;
     }
     mappingValid = true;
 }
@@ -1088,55 +1432,465 @@ cv::Point2f Aspect::PixelToScreen(cv::Point2f pixelPoint)
 
 /*****************************************************
 
-Random utility functions
+Fiducial identification functions
 
 *****************************************************/
 
-cv::Range SafeRange(int start, int stop, int size)
+void DistanceTable::create(const std::vector<float> &_distances, float _tolerance)
 {
-    cv::Range range;
-    range.start = (start > 0) ? (start) : 0;
-    range.end = (stop < size - 1) ? (stop) : (size - 1);
-    return range;
+    std::vector<int> count;
+    int first, last, bins;
+    float longest = 0;
+
+    distances = _distances;
+    tolerance = _tolerance;
+    start.clear();
+    candidates.clear();
+    if (!(tolerance > 0)) return;
+
+    //Bins are as wide as the tolerance, unless that would take too many
+    for (unsigned int d = 0; d < distances.size(); d++)
+        longest = std::max(longest, distances[d]);
+    binWidth = std::max(tolerance, (longest + tolerance)/DISTANCE_TABLE_BINS);
+    bins = (int) ((longest + tolerance)/binWidth) + 2;
+
+    //Each distance is a candidate for the bins its tolerance reaches, plus one
+    //more on each side so that rounding can't leave it out
+    count.assign(bins, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            start.assign(bins + 1, 0);
+            for (int b = 0; b < bins; b++) start[b+1] = start[b] + count[b];
+            candidates.resize(start[bins]);
+            count.assign(bins, 0);
+        }
+        //Largest index first, since the last match is the one that counts
+        for (int d = distances.size() - 1; d >= 0; d--)
+        {
+            first = std::max(0, (int) ((distances[d] - tolerance)/binWidth) - 1);
+            last = std::min(bins - 1, (int) ((distances[d] + tolerance)/binWidth) + 1);
+            for (int b = first; b <= last; b++)
+            {
+                if (pass == 1) candidates[start[b] + count[b]] = d;
+                count[b]++;
+            }
+        }
+    }
+}
+
+int DistanceTable::find(float distance) const
+{
+    int b;
+
+    if (start.empty() || !(distance >= 0)) return -1;
+    b = (int) (distance/binWidth);
+    if (b >= (int) start.size() - 1) return -1;
+
+    for (int k = start[b]; k < start[b+1]; k++)
+    {
+        if (fabs(distance - distances[candidates[k]]) < tolerance) return candidates[k];
+    }
+    return -1;
 }
 
-void LinearFit(const std::vector<float> &x, const std::vector<float> &y, std::vector<float> &fit)
+void FindSpacedPairs(const CoordList &points, bool alongX, float low, float high, IndexList &pairs)
 {
-    cv::Scalar init(0);
-    cv::Mat A(2,2,CV_32FC1, init), B(2,1,CV_32FC1, init), X(2,1,CV_32FC1, init);
-    cv::Mat eigenvalues;
-    float N, cond;
-    unsigned int l;
+    std::vector<float> position(points.size());
+    std::vector<int> bucket(points.size(), -1), start, members, partners;
+    float first = 0, last = 0, difference;
+    double width;
+    int K = points.size(), B, b, count = 0;
+
+    pairs.clear();
+    if (!(high > 0)) return;
 
-    if (x.size() != y.size())
+    for (int k = 0; k < K; k++) position[k] = alongX ? points[k].x : points[k].y;
+
+    //For a few points, checking every pair is quicker than sorting them
+    if (K <= SPACED_PAIRS_DIRECT)
     {
-        std::cout << "Error in LinearFit: x and y vectors should be same length\n";
+        for (int k = 0; k < K; k++)
+        {
+            for (int l = k+1; l < K; l++)
+            {
+                difference = fabs(position[k] - position[l]);
+                if (difference > low && difference < high) pairs.add(k, l);
+            }
+        }
         return;
     }
 
-    N = (float) x.size();
-    A.at<float>(1,1) = N;
+    for (int k = 0; k < K; k++)
+    {
+        if (std::isnan(position[k])) continue;
+        if (count++ == 0) first = last = position[k];
+        first = std::min(first, position[k]);
+        last = std::max(last, position[k]);
+    }
+    if (count < 2) return;
+
+    //Sort the points into buckets a little wider than high, so that each
+    //point's partners are in its own bucket or the ones to either side.
+    //Very spread out points get wider buckets, to bound their number.
+    width = std::max(high*1.001, (last - first)/(4.0*count));
+    B = (int) ((last - first)/width) + 1;
+    start.assign(B + 2, 0);
+    for (int k = 0; k < K; k++)
+    {
+        if (std::isnan(position[k])) continue;
+        bucket[k] = (int) ((position[k] - first)/width);
+        start[bucket[k] + 2]++;
+    }
+    for (b = 0; b < B; b++) start[b+2] += start[b+1];
+    members.resize(count);
+    for (int k = 0; k < K; k++)
+        if (bucket[k] >= 0) members[start[bucket[k] + 1]++] = k;
 
-    for (l = 0; l <  x.size(); l++)
+    //Pairs are listed in the order of a search over every pair
+    for (int k = 0; k < K; k++)
     {
-        A.at<float>(0,0) += x[l]*x[l];
-        A.at<float>(0,1) += x[l];
-        B.at<float>(1) += y[l];
-        B.at<float>(0) += x[l]*y[l];
+        if (bucket[k] < 0) continue;
+        partners.clear();
+        for (b = std::max(0, bucket[k] - 1); b <= std::min(B - 1, bucket[k] + 1); b++)
+        {
+            for (int m = start[b]; m < start[b+1]; m++)
+            {
+                if (members[m] <= k) continue;
+                difference = fabs(position[k] - position[members[m]]);
+                if (difference > low && difference < high) partners.push_back(members[m]);
+            }
+        }
+        std::sort(partners.begin(), partners.end());
+        for (unsigned int l = 0; l < partners.size(); l++) pairs.add(k, partners[l]);
     }
+}
 
-    A.at<float>(1,0) = A.at<float>(0,1);
-    
-    cv::eigen(A, eigenvalues);
-    cond = eigenvalues.at<float>(0)/eigenvalues.at<float>(1);
-    //std::cout << "Condition number: " << cond << std::endl;
+void IdentifyFiducials(const CoordList &fiducials, float spacing, float tolerance,
+                       const DistanceTable &mTable, const DistanceTable &nTable, IndexList &IDs)
+{
+    IndexList rowPairs, colPairs;
+    float rowDiff, colDiff;
+    int d;
 
-    cv::solve(A,B,X,cv::DECOMP_CHOLESKY);
-    
-    fit.clear();
-    fit.resize(2);
-    fit[0] = X.at<float>(1); //intercept
-    fit[1] = X.at<float>(0); //slope
+    IDs.clear();
+    IDs.resize(fiducials.size(), cv::Point2i(-100,-100));
+
+    //Find fiducial pairs that are spaced correctly
+    //Row pairs are neighbors along a row, and col pairs along a column
+    FindSpacedPairs(fiducials, true, spacing - tolerance, spacing + tolerance, rowPairs);
+    FindSpacedPairs(fiducials, false, spacing - tolerance, spacing + tolerance, colPairs);
+
+    //The offset across each pair gives the row or column ID of both
+    for (unsigned int k = 0; k < rowPairs.size(); k++)
+    {
+        rowDiff = fiducials[rowPairs[k].y].y - fiducials[rowPairs[k].x].y;
+        d = mTable.find(fabs(rowDiff));
+        if (d < 0) continue;
+        if (rowDiff > 0)
+        {
+            IDs[rowPairs[k].x].y = d-7;
+            IDs[rowPairs[k].y].y = d+1-7;
+        }
+        else
+        {
+            IDs[rowPairs[k].x].y = d+1-7;
+            IDs[rowPairs[k].y].y = d-7;
+        }
+    }
+
+    for (unsigned int k = 0; k < colPairs.size(); k++)
+    {
+        colDiff = fiducials[colPairs[k].x].x - fiducials[colPairs[k].y].x;
+        d = nTable.find(fabs(colDiff));
+        if (d < 0) continue;
+        if (colDiff > 0)
+        {
+            IDs[colPairs[k].x].x = d-7;
+            IDs[colPairs[k].y].x = d+1-7;
+        }
+        else
+        {
+            IDs[colPairs[k].x].x = d+1-7;
+            IDs[colPairs[k].y].x = d-7;
+        }
+    }
+}
+
+/*****************************************************
+
+Chord scanning functions
+
+*****************************************************/
+
+#ifdef CHORD_SIMD
+//Chooses the widest instructions the processor has, once, at start-up
+static int ChordVectorWidth()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return 32;
+    if (__builtin_cpu_supports("sse2")) return 16;
+    return 0;
+}
+
+static int chord_vector_width = ChordVectorWidth();
+
+//Appends the edges for a block of pixels starting at base.  Bit b of above is
+//set if pixel base+b is above the threshold, and bit b of transitions is set
+//if it differs from the pixel before it.
+static inline int AppendEdges(uint64_t transitions, uint64_t above, int base, int *edges)
+{
+    int n = 0;
+    while (transitions)
+    {
+        int b = __builtin_ctzll(transitions);
+        //rising edges save the index above the threshold, falling edges the
+        //index before it, negated
+        if ((above >> b) & 1) edges[n++] = base + b;
+        else edges[n++] = -(base + b - 1);
+        transitions &= transitions - 1;
+    }
+    return n;
+}
+
+//Scans whole blocks of 16 pixels, leaving next at the first pixel not scanned
+__attribute__((target("sse2")))
+static int FindThresholdEdgesSSE2(const unsigned char *chord, int K, unsigned char threshold, int *edges, int &next)
+{
+    //SSE2 only compares signed bytes, so both sides are offset by 128
+    const __m128i bias = _mm_set1_epi8((char) 0x80);
+    const __m128i level = _mm_set1_epi8((char) (threshold ^ 0x80));
+    uint64_t carry = chord[0] > threshold;
+    int base, n = 0;
+
+    for (base = 0; base + 16 <= K; base += 16)
+    {
+        __m128i pixels = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(chord + base)), bias);
+        uint64_t above = (unsigned int) _mm_movemask_epi8(_mm_cmpgt_epi8(pixels, level));
+        uint64_t transitions = (above ^ ((above << 1) | carry)) & 0xffff;
+        if (transitions) n += AppendEdges(transitions, above, base, edges + n);
+        carry = above >> 15;
+    }
+    next = base;
+    return n;
+}
+
+//Scans whole blocks of 32 pixels, leaving next at the first pixel not scanned
+__attribute__((target("avx2")))
+static int FindThresholdEdgesAVX2(const unsigned char *chord, int K, unsigned char threshold, int *edges, int &next)
+{
+    const __m256i bias = _mm256_set1_epi8((char) 0x80);
+    const __m256i level = _mm256_set1_epi8((char) (threshold ^ 0x80));
+    uint64_t carry = chord[0] > threshold;
+    int base, n = 0;
+
+    for (base = 0; base + 32 <= K; base += 32)
+    {
+        __m256i pixels = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(chord + base)), bias);
+        uint64_t above = (unsigned int) _mm256_movemask_epi8(_mm256_cmpgt_epi8(pixels, level));
+        uint64_t transitions = (above ^ ((above << 1) | carry)) & 0xffffffff;
+        if (transitions) n += AppendEdges(transitions, above, base, edges + n);
+        carry = above >> 31;
+    }
+    next = base;
+    return n;
+}
+#endif
+
+int FindThresholdEdges(const unsigned char *chord, int K, unsigned char threshold, int *edges)
+{
+    int n = 0, k = 0;
+    bool thisAbove, lastAbove;
+
+    if (K < 2) return 0;
+
+#ifdef CHORD_SIMD
+    if (chord_vector_width == 32) n = FindThresholdEdgesAVX2(chord, K, threshold, edges, k);
+    else if (chord_vector_width == 16) n = FindThresholdEdgesSSE2(chord, K, threshold, edges, k);
+#endif
+
+    //finish the pixels left over, one at a time
+    if (k == 0) k = 1;
+    lastAbove = chord[k-1] > threshold;
+    for (; k < K; k++)
+    {
+        thisAbove = chord[k] > threshold;
+        if (thisAbove != lastAbove) edges[n++] = thisAbove ? k : -(k-1);
+        lastAbove = thisAbove;
+    }
+    return n;
+}
+
+void GatherColumns(const cv::Mat &image, const std::vector<int> &cols, cv::Mat &chords, cv::Range rows)
+{
+    int R = rows.end;
+    int C = cols.size();
+
+    chords.create(C, image.rows, CV_8UC1);
+
+    //Reading a whole column at once would touch a new cache line for every
+    //pixel, so the rows are taken in blocks small enough to stay in cache
+    //while every column is copied out of them
+    for (int r0 = rows.start; r0 < R; r0 += CHORD_BLOCK)
+    {
+        int r1 = std::min(r0 + CHORD_BLOCK, R);
+        for (int c = 0; c < C; c++)
+        {
+            const unsigned char *in = image.ptr<unsigned char>(r0) + cols[c];
+            unsigned char *out = chords.ptr<unsigned char>(c) + r0;
+            for (int r = r0; r < r1; r++, in += image.step) *out++ = *in;
+        }
+    }
+}
+
+/*****************************************************
+
+Acquisition functions
+
+*****************************************************/
+
+#ifdef CHORD_SIMD
+//Sums blocks of factor pixels (4, 8, or 16) of a row into sums while finding
+//its minimum and maximum, 16 pixels at a time, returning the number of
+//pixels covered
+__attribute__((target("sse2")))
+static int DecimateRowSSE2(const unsigned char *row, int width, int factor, unsigned short *sums,
+                           unsigned char &min, unsigned char &max)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+    __m128i lo = _mm_set1_epi8((char) min), hi = _mm_set1_epi8((char) max);
+    unsigned char extreme[16];
+    int n;
+
+    for (n = 0; n + 16 <= width; n += 16)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(row + n));
+        lo = _mm_min_epu8(lo, pixels);
+        hi = _mm_max_epu8(hi, pixels);
+
+        //_mm_sad_epu8 against zero sums each half of 8 pixels
+        if (factor == 4)
+        {
+            __m128i first = _mm_sad_epu8(_mm_and_si128(pixels, low), zero);
+            __m128i second = _mm_sad_epu8(_mm_srli_epi64(pixels, 32), zero);
+            sums[n/4] += _mm_cvtsi128_si32(first);
+            sums[n/4 + 1] += _mm_cvtsi128_si32(second);
+            sums[n/4 + 2] += _mm_extract_epi16(first, 4);
+            sums[n/4 + 3] += _mm_extract_epi16(second, 4);
+        }
+        else
+        {
+            __m128i halves = _mm_sad_epu8(pixels, zero);
+            if (factor == 8)
+            {
+                sums[n/8] += _mm_cvtsi128_si32(halves);
+                sums[n/8 + 1] += _mm_extract_epi16(halves, 4);
+            }
+            else sums[n/16] += _mm_cvtsi128_si32(halves) + _mm_extract_epi16(halves, 4);
+        }
+    }
+
+    _mm_storeu_si128((__m128i *) extreme, lo);
+    for (int k = 0; k < 16; k++) if (extreme[k] < min) min = extreme[k];
+    _mm_storeu_si128((__m128i *) extreme, hi);
+    for (int k = 0; k < 16; k++) if (extreme[k] > max) max = extreme[k];
+    return n;
+}
+#endif
+
+void DecimateMinMax(const cv::Mat &image, int factor, cv::Mat &decimated, unsigned char &min, unsigned char &max)
+{
+    int width, n;
+
+    factor = std::max(1, std::min(factor, ACQUISITION_MAX_DECIMATION));
+    decimated.create(image.rows/factor, image.cols/factor, CV_16UC1);
+    decimated = cv::Scalar(0);
+    width = decimated.cols*factor;
+    min = 255;
+    max = 0;
+
+    for (int m = 0; m < image.rows; m++)
+    {
+        const unsigned char *row = image.ptr<unsigned char>(m);
+        //the last few rows and columns don't fill a block, and only count
+        //towards the minimum and maximum
+        bool whole = m < decimated.rows*factor;
+        unsigned short *sums = whole ? decimated.ptr<unsigned short>(m/factor) : NULL;
+        n = 0;
+
+#ifdef CHORD_SIMD
+        if (whole && chord_vector_width >= 16 && (factor == 4 || factor == 8 || factor == 16))
+            n = DecimateRowSSE2(row, width, factor, sums, min, max);
+#endif
+
+        for (; n < image.cols; n++)
+        {
+            if (row[n] < min) min = row[n];
+            if (row[n] > max) max = row[n];
+            if (whole && n < width) sums[n/factor] += row[n];
+        }
+    }
+}
+
+bool FindCoarseCenter(const cv::Mat &decimated, unsigned int threshold, float radius, cv::Point2f &center)
+{
+    cv::Range rowRange(0, decimated.rows), colRange(0, decimated.cols);
+    double sumX, sumY;
+    int count = 0;
+
+    //The first pass takes the whole image, and the later ones only the box
+    //around the last center that holds the disk, which leaves out anything
+    //bright away from the Sun
+    for (int pass = 0; pass < ACQUISITION_PASSES; pass++)
+    {
+        sumX = sumY = 0;
+        count = 0;
+        for (int m = rowRange.start; m < rowRange.end; m++)
+        {
+            const unsigned short *row = decimated.ptr<unsigned short>(m);
+            for (int n = colRange.start; n < colRange.end; n++)
+            {
+                if (row[n] > threshold)
+                {
+                    sumX += n;
+                    sumY += m;
+                    count++;
+                }
+            }
+        }
+        if (count == 0) return false;
+
+        center = cv::Point2f(sumX/count, sumY/count);
+        rowRange = cv::Range(std::max(0, (int) floor(center.y - ACQUISITION_BOX*radius)),
+                             std::min(decimated.rows, (int) ceil(center.y + ACQUISITION_BOX*radius) + 1));
+        colRange = cv::Range(std::max(0, (int) floor(center.x - ACQUISITION_BOX*radius)),
+                             std::min(decimated.cols, (int) ceil(center.x + ACQUISITION_BOX*radius) + 1));
+    }
+    return true;
+}
+
+/*****************************************************
+
+Random utility functions
+
+*****************************************************/
+
+cv::Range SafeRange(int start, int stop, int size)
+{
+    cv::Range range;
+    range.start = (start > 0) ? (start) : 0;
+    range.end = (stop < size - 1) ? (stop) : (size - 1);
+    return range;
+}
+
+cv::Range ClipRange(float start, float end, int size)
+{
+    cv::Range range;
+    range.start = std::min(size, std::max(0, (int) floor(start)));
+    range.end = std::min(size, std::max(range.start, (int) ceil(end)));
+    return range;
 }
 
 void matchKernel(cv::OutputArray _kernel)
@@ -3,6 +3,10 @@
 #include <list>
 #include <opencv.hpp>
 #include <cstring>
+#include "fitting.hpp"
+#include "TernaryKernel.hpp"
+#include "PeakFinder.hpp"
+#include "SunTracker.hpp"
 
 class CoordList : public std::vector<cv::Point2f>
 {
@@ -25,7 +29,10 @@ enum IntParameter
     FIDUCIAL_LENGTH,
     FIDUCIAL_WIDTH,
     FIDUCIAL_NEIGHBORHOOD,
-    NUM_FIDUCIALS
+    NUM_FIDUCIALS,
+    ACQUISITION_DECIMATION,
+    FIDUCIAL_WINDOW,
+    CIRCLE_FIT
 };
 
 enum FloatParameter
@@ -34,6 +41,10 @@ enum FloatParameter
     FIDUCIAL_THRESHOLD,
     FIDUCIAL_SPACING,
     FIDUCIAL_SPACING_TOL,
+    TRACKER_ALPHA,
+    TRACKER_BETA,
+    TRACKER_SIGMAS,
+    CIRCLE_TOLERANCE
 };
     
 enum AspectCode
@@ -72,7 +83,35 @@ enum AspectCode
     STALE_DATA
 };
 
+//Data products for Run to find.  The mapping products need the center
+//products, so asking for them finds both.
+enum AspectProduct
+{
+    CENTER_PRODUCTS = 0x1, // min and max, limb crossings, and center
+    MAPPING_PRODUCTS = 0x2, // fiducials, IDs, mapping, and screen coordinates
+    ALL_PRODUCTS = CENTER_PRODUCTS | MAPPING_PRODUCTS
+};
+typedef unsigned int ProductMask;
+
+//Direct-indexed lookup of which of a list of distances a measured distance
+//is within tolerance of, for identifying fiducials
+class DistanceTable
+{
+public:
+    void create(const std::vector<float> &distances, float tolerance);
+    //Returns the largest index d with |distance - distances[d]| < tolerance,
+    //or -1 if there is none
+    int find(float distance) const;
+
+private:
+    std::vector<float> distances;
+    float tolerance, binWidth;
+    //The candidates for bin b, largest index first, run from start[b] to start[b+1]
+    std::vector<int> start, candidates;
+};
+
 AspectCode GeneralizeError(AspectCode code);
+cv::Point2f fiducialIDtoScreen(cv::Point2i id);
 const char * GetMessage(const AspectCode& code);
 
 class Aspect
@@ -82,11 +121,27 @@ public:
     ~Aspect();
 
     AspectCode LoadFrame(cv::Mat inputFrame);
+    //captureTime (CLOCK_REALTIME or CLOCK_MONOTONIC, but not a mix) times the
+    //frames for the tracker
+    AspectCode LoadFrame(cv::Mat inputFrame, const timespec &captureTime);
     AspectCode Run();
+    //Finds only the products asked for.  Without MAPPING_PRODUCTS, a frame
+    //whose center is good gives NO_ERROR, and the first of GetPixelFiducials,
+    //GetFiducialIDs, GetMapping, GetScreenCenter, or GetScreenFiducials called
+    //before the next LoadFrame finds the rest, after which every Get returns
+    //what it would have after Run().
+    AspectCode Run(ProductMask products);
     AspectCode GetPixelMinMax(unsigned char& min, unsigned char& max);
     AspectCode GetPixelCrossings(CoordList& crossings);
     AspectCode GetPixelCenter(cv::Point2f& center);
     AspectCode GetPixelError(cv::Point2f& error);
+    AspectCode GetPixelRadius(float& radius);
+    //Where the tracker expected the center in this frame, and how far off
+    //it expected to be
+    AspectCode GetPredictedCenter(cv::Point2f& center, cv::Point2f& error);
+    //How many frames have searched the whole solar image for fiducials, and
+    //how many only searched windows around those of the last frame
+    AspectCode GetFiducialSearches(unsigned long& full, unsigned long& windowed);
     AspectCode GetPixelFiducials(CoordList& fiducials);
     AspectCode GetFiducialIDs(IndexList& fiducialIDs);
     AspectCode GetMapping(std::vector<float>& map);
@@ -105,6 +160,7 @@ private:
 
     int initialNumChords;
     int chordsPerAxis;
+    int acquisitionDecimation;
     float chordThreshold;
     int limbWidth;
 
@@ -121,35 +177,76 @@ private:
     float fiducialSpacing;
     float fiducialSpacingTol;
     std::vector<float> mDistances, nDistances;
+    DistanceTable mTable, nTable;
     
-    int FindLimbCrossings(cv::Mat chord, std::vector<float> &crossings);
+    int FindLimbCrossings(const unsigned char *chord, int K, unsigned char pixelThreshold,
+                          const cv::Range *windows, int numWindows);
     void FindPixelCenter();
+    void PlaceChords(cv::Point2f center, std::vector<int> &rows, std::vector<int> &cols);
+    void FindChordCenter(const std::vector<int> &rows, const std::vector<int> &cols);
+    bool FitLimbCircle();
+    int ChordWindows(int dim, int location, int K, cv::Range *windows);
+    void UpdateTracker();
+    AspectCode RunMapping();
     void FindPixelFiducials(cv::Mat image, cv::Point offset);
+    bool TrackFiducials(cv::Mat image, cv::Point offset);
     void FindFiducialIDs();
     void FindMapping();
     cv::Point2f PixelToScreen(cv::Point2f point);
     
 //    void LoadKernel();
 
+    AspectCode LoadFrame(cv::Mat inputFrame, double time);
+
     bool frameValid;
     cv::Mat frame;
+    double frameTime;
     cv::Size frameSize;
 
     bool minMaxValid;
     unsigned char frameMax, frameMin;
 
+    bool acquiring;
+    cv::Mat decimatedFrame;
+
     cv::Mat kernel;
     cv::Size kernelSize;
+    TernaryKernel ternaryKernel;
 
     bool crossingsValid;
     CoordList limbCrossings;
+    std::vector<int> edgeBuffer;
+    cv::Mat columnChords;
+    IndexList limbChords;
+    LineFitBatch limbFits;
 
     bool centerValid;
     cv::Point2f pixelCenter;
     cv::Point2f pixelError;
+    float pixelRadius;
+
+    int circleFit;
+    float circleTolerance;
+    std::vector<float> crossingX, crossingY;
+    std::vector<unsigned char> limbInliers;
+    CircleFit limbCircle;
+
+    SunTracker tracker;
+    float trackerSigmas;
+    bool predictionValid, narrowing;
+    cv::Point2f predictedCenter, predictedError;
     
     bool fiducialsValid;
     CoordList pixelFiducials;
+    PeakFinder peakFinder;
+
+    int fiducialWindow;
+    CoordList trackedFiducials;
+    IndexList trackedIDs;
+    float fiducialLevel, fiducialFloor;
+    unsigned int fullSearchFiducials;
+    cv::Mat windowCorrelation;
+    unsigned long fullSearches, windowSearches;
 
     bool fiducialIDsValid;
     IndexList fiducialIDs;
@@ -159,12 +256,37 @@ private:
     std::vector<float> mapping;
 
     bool frameProcessed;
+    bool mappingPending;
 
     std::list<float> slopes;
 };
 
 
 cv::Range SafeRange(int start, int stop, int size);
-void LinearFit(const std::vector<float> &x, const std::vector<float> &y, std::vector<float> &fit);
+//The whole pixels from start to end, clipped to [0, size)
+cv::Range ClipRange(float start, float end, int size);
+//Finds where the K pixels of chord cross threshold, storing the index of the
+//first pixel above it for rising edges and the negated index of the last pixel
+//above it for falling edges.  edges must have room for K values.
+//Returns the number of edges.
+int FindThresholdEdges(const unsigned char *chord, int K, unsigned char threshold, int *edges);
+//Finds the pairs (k, l), k < l, of points whose x coordinates (or y if not
+//alongX) differ by more than low and less than high, sorted by k then l
+void FindSpacedPairs(const CoordList &points, bool alongX, float low, float high, IndexList &pairs);
+//Assigns the IDs of fiducials from the spacing of neighboring pairs, with
+//-100 for IDs that can't be determined
+void IdentifyFiducials(const CoordList &fiducials, float spacing, float tolerance,
+                       const DistanceTable &mTable, const DistanceTable &nTable, IndexList &IDs);
+//Finds the minimum and maximum of an 8-bit image, while summing each
+//factor x factor block of it into the CV_16UC1 decimated, in one pass.
+//factor is at most 16.
+void DecimateMinMax(const cv::Mat &image, int factor, cv::Mat &decimated, unsigned char &min, unsigned char &max);
+//Finds the centroid of the blocks of decimated above threshold, narrowing
+//to a box around the disk of the given radius, in blocks.  Returns false if
+//no block is above threshold.
+bool FindCoarseCenter(const cv::Mat &decimated, unsigned int threshold, float radius, cv::Point2f &center);
+//Copies columns cols of an 8-bit image into the rows of chords, for the
+//image rows in rows only
+void GatherColumns(const cv::Mat &image, const std::vector<int> &cols, cv::Mat &chords, cv::Range rows);
 int matchFindFiducials(cv::InputArray, cv::InputArray, int , cv::Point2f*, int);
 void matchKernel(cv::OutputArray);
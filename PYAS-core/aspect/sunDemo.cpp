@@ -1,6 +1,14 @@
 #define MAX_THREADS 20
 #define SAVE_LOCATION "/mnt/disk2/" // location for saving full images locally
 #define REPORT_FOCUS false
+#define SOLUTION_MAX_RATE 10 // Hz, most solutions per second sent to CTL
+#define MAPPING_INTERVAL 2 // frames per fiducial and mapping solution, the others only find the center
+#define LOCK_MEMORY true // lock all pages into memory so real-time threads do not page fault
+#define SELFTEST_FRAMES 16 // synthetic frames rendered ahead for the latency self-test
+#define SELFTEST_SECONDS 10 // default length of each phase of the latency self-test
+#define COMMAND_FAST_HANDLERS 2 // handler threads for commands that finish at once
+#define COMMAND_SLOW_HANDLERS 1 // handler threads for commands that take a while, like sending an image
+#define COMMAND_LANE_DEPTH   16 // commands waiting in each lane before more are refused
 
 //Default camera settings
 #define CAMERA_EXPOSURE 15000 // microseconds, was 4500 microseconds in first Sun test
@@ -12,16 +20,19 @@
 #define CAMERA_YOFFSET 0
 
 //Sleep settings (seconds)
-#define SLEEP_SOLUTION         1 // period for providing solutions to CTL
+#define SLEEP_SOLUTION         1 // longest wait for a new solution before checking for stop
 #define SLEEP_SAVE             5 // period for saving full images locally
 #define SLEEP_LOG_TEMPERATURE 10 // period for logging temperature locally
 #define SLEEP_CAMERA_CONNECT   1 // waits for errors while connecting to camera
-#define SLEEP_KILL             2 // waits when killing all threads
+#define SLEEP_TM_REPORT       60 // period for reporting telemetry throughput
 
 //Sleep settings (microseconds)
-#define USLEEP_CMD_SEND     5000 // period for popping off the command queue
-#define USLEEP_TM_SEND     50000 // period for popping off the telemetry queue
+#define USLEEP_CMD_SEND     5000 // longest wait on the command queue before checking for stop
+#define USLEEP_TM_SEND     50000 // longest wait on the telemetry queue before checking for stop
+#define USLEEP_MAIN      1000000 // backstop wait on the received command queue, SIGINT wakes it directly
 #define USLEEP_TM_GENERIC 250000 // period for adding generic telemetry packets to queue
+#define USLEEP_KILL       250000 // longest wait for a thread to stop before cancelling it, enough for the camera to see Interrupt() and stop
+#define USLEEP_CMD_HANDLE 100000 // longest wait on a command lane before checking for stop
 
 #define SAS1_MAC_ADDRESS "00:20:9d:23:26:b9"
 #define SAS2_MAC_ADDRESS "00:20:9d:23:5c:9e"
@@ -52,6 +63,7 @@
 #define TM_SAS_GENERIC 0x70
 #define TM_SAS_IMAGE   0x82
 #define TM_SAS_TAG     0x83
+#define TM_SAS_TIMING  0x84
 
 //HEROES commands, CTL/FDR to SAS
 #define HKEY_CTL_START_TRACKING  0x1000
@@ -80,6 +92,7 @@
 
 //Getting commands
 #define SKEY_REQUEST_IMAGE       0x0210
+#define SKEY_REQUEST_TIMING      0x0220
 
 #include <cstring>
 #include <stdio.h>      /* for printf() and fprintf() */
@@ -87,11 +100,13 @@
 #include <stdlib.h>     /* for atoi() and exit() */
 #include <unistd.h>     /* for sleep()  */
 #include <signal.h>     /* for signal() */
+#include <errno.h>      /* for ETIMEDOUT and EINTR */
 #include <math.h>       /* for testing only, remove when done */
 #include <ctime>        /* time_t, struct tm, time, gmtime */
 #include <opencv.hpp>
 #include <iostream>
 #include <string>
+#include <utility>
 
 #include "UDPSender.hpp"
 #include "UDPReceiver.hpp"
@@ -102,9 +117,16 @@
 #include "types.hpp"
 #include "TCPSender.hpp"
 #include "ImperxStream.hpp"
+#include "FrameSource.hpp"
 #include "processing.hpp"
 #include "compression.hpp"
 #include "utilities.hpp"
+#include "FramePool.hpp"
+#include "PeriodicTask.hpp"
+#include "RealTime.hpp"
+#include "Supervisor.hpp"
+#include "CommandLane.hpp"
+#include "Reactor.hpp"
 
 // global declarations
 uint16_t command_sequence_number = 0;
@@ -121,30 +143,41 @@ bool acknowledgedCTL = true; // have we acknowledged the last command from CTL?
 CommandQueue recvd_command_queue;
 TelemetryPacketQueue tm_packet_queue;
 CommandPacketQueue cm_packet_queue;
-ImagePacketQueue im_packet_queue;
+CommandLane fastCommands("FastCommands", COMMAND_LANE_DEPTH); // SAS commands for the handler pool
+CommandLane slowCommands("SlowCommands", COMMAND_LANE_DEPTH); // kept apart so they cannot hold up the rest
+TCPSender imageSender(IP_FDR, (unsigned short) PORT_IMAGE); // persistent image downlink
 
 // related to threads
-unsigned int stop_message[MAX_THREADS];
-pthread_t threads[MAX_THREADS];
-bool started[MAX_THREADS];
-int tid_listen = 0;
+void wake_dispatcher( void );
+Supervisor supervisor(MAX_THREADS, wake_dispatcher); // wakes main to restart a worker that fails
+int tid_network = 0; // the network thread, which kill_all_workers() leaves running
 pthread_attr_t attr;
-pthread_mutex_t mutexImage;
 pthread_mutex_t mutexProcess;
+pthread_mutex_t mutexDownlink;
+pthread_cond_t condSolution; // with mutexProcess, signalled on a new solution or a tracking change
 
 struct Thread_data{
     int  thread_id;
-    uint16_t command_key;
-    uint8_t command_num_vars;
-    uint16_t command_vars[15];
 };
 struct Thread_data thread_data[MAX_THREADS];
 
 sig_atomic_t volatile g_running = 1;
+LatencyStats dispatchLatency; // from command packet receipt to handler start
+LatencyStats solutionLatency; // from exposure to solution packet on the wire
+LatencyStats restartDowntime; // from asking the workers to stop to all of them running again
+
+//Schedules of the periodic threads, whose timing is sent on SKEY_REQUEST_TIMING
+PeriodicTask telemetryTask("TelemetryPackager", USLEEP_TM_GENERIC);
+PeriodicTask temperatureTask("SaveTemperatures", SLEEP_LOG_TEMPERATURE*1000000L);
+PeriodicTask saveImageTask("SaveImage", SLEEP_SAVE*1000000L);
+PeriodicTask *periodicTasks[] = {&telemetryTask, &temperatureTask, &saveImageTask};
+#define NUM_PERIODIC_TASKS (int)(sizeof(periodicTasks)/sizeof(periodicTasks[0]))
 
 int sas_id;
 
-cv::Mat frame;
+FramePool framePool; // camera frames, shared without copying
+FrameSource *frameSource; // the camera, or a stand-in chosen on the command line
+int sourceFrameTime; // microseconds between frames from the source, 0 for as fast as possible
 
 Aspect aspect;
 AspectCode runResult;
@@ -152,12 +185,13 @@ Transform solarTransform;
 
 uint8_t frameMin, frameMax;
 cv::Point2f pixelCenter, screenCenter, error;
+cv::Point2f predictedCenter, predictedError; // where the tracker expected pixelCenter, zero if it had no track
+timespec solutionTime; // capture time (CLOCK_REALTIME, middle of the exposure) of the frame pixelCenter came from
+uint32_t solutionCount = 0; // frames that have produced a pixelCenter
 CoordList limbs, pixelFiducials, screenFiducials;
 IndexList ids;
 std::vector<float> mapping;
 
-HeaderData keys;
-
 bool staleFrame;
 Flag procReady, saveReady;
 int runtime = 10;
@@ -168,7 +202,6 @@ int16_t preampGain = CAMERA_PREAMPGAIN;
 timespec frameRate = {0,100000000L};
 int cameraReady = 0;
 
-timespec frameTime;
 long int frameCount = 0;
 
 float camera_temperature;
@@ -183,20 +216,53 @@ void identifySAS();
 void *CameraStreamThread( void * threadargs);
 void *ImageProcessThread(void *threadargs);
 void *TelemetrySenderThread(void *threadargs);
-void *SBCInfoThread(void *threadargs);
 void *SaveTemperaturesThread(void *threadargs);
 void *SaveImageThread(void *threadargs);
 void *TelemetryPackagerThread(void *threadargs);
-void *listenForCommandsThread(void *threadargs);
+void *NetworkThread(void *threadargs);
+void *SignalThread(void *threadargs);
 void *CommandSenderThread( void *threadargs );
 void *CommandPackagerThread( void *threadargs );
 void queue_cmd_proc_ack_tmpacket( uint16_t error_code );
-uint16_t cmd_send_image_to_ground( int camera_id );
-void *commandHandlerThread(void *threadargs);
+void queue_timing_tmpacket( void );
+uint16_t cmd_send_image_to_ground( int camera_id, int stopFd );
+void *FastCommandThread(void *threadargs);
+void *SlowCommandThread(void *threadargs);
+void handle_sas_command(const SASCommand &command, long tid);
 void cmd_process_heroes_command(uint16_t heroes_command);
 void cmd_process_sas_command(uint16_t sas_command, Command &command);
 void start_all_workers( void );
-void start_thread(void *(*start_routine) (void *), const Thread_data *tdata);
+int start_thread(void *(*start_routine) (void *), const Thread_data *tdata, bool restart = false);
+const ThreadConfig &thread_config(void *(*routine) (void *));
+int latency_selftest(int seconds);
+
+//Scheduling of the threads started by start_thread().  The camera and image
+//processing share CPU 1 at the highest priorities, commands run at lower
+//real-time priorities anywhere, and housekeeping, including the commands
+//that take a while, stays on CPU 0 at normal priority.  Threads not listed
+//here get the last.
+struct ThreadEntry
+{
+    void *(*routine)(void *);
+    ThreadConfig config;
+};
+ThreadEntry threadTable[] = {
+    {CameraStreamThread,      {"CameraStream",      SCHED_FIFO,  80, 0x2, 256*1024}},
+    {ImageProcessThread,      {"ImageProcess",      SCHED_FIFO,  70, 0x2, 256*1024}},
+    {CommandPackagerThread,   {"CommandPackager",   SCHED_FIFO,  60, 0x0,  64*1024}},
+    {CommandSenderThread,     {"CommandSender",     SCHED_FIFO,  60, 0x0,  64*1024}},
+    {NetworkThread,           {"Network",           SCHED_FIFO,  50, 0x0,  64*1024}},
+    {FastCommandThread,       {"FastCommands",      SCHED_FIFO,  45, 0x0,  64*1024}},
+    {SlowCommandThread,       {"SlowCommands",      SCHED_OTHER,  0, 0x1,        0}},
+    {TelemetryPackagerThread, {"TelemetryPackager", SCHED_OTHER,  0, 0x1,        0}},
+    {TelemetrySenderThread,   {"TelemetrySender",   SCHED_OTHER,  0, 0x1,        0}},
+    {SaveImageThread,         {"SaveImage",         SCHED_OTHER,  0, 0x1,        0}},
+    {SaveTemperaturesThread,  {"SaveTemperatures",  SCHED_OTHER,  0, 0x1,        0}},
+    {NULL,                    {"Default",           SCHED_OTHER,  0, 0x0,        0}}
+};
+//main(), which dispatches commands and restarts the workers, is above them
+//all so that the workers it has already started cannot hold it up
+ThreadConfig dispatcherConfig = {"Dispatcher", SCHED_FIFO, 90, 0x0, 64*1024};
 
 void sig_handler(int signum)
 {
@@ -206,27 +272,63 @@ void sig_handler(int signum)
     }
 }
 
+//SIGINT is blocked in every other thread, so it is only ever delivered here
+//Handling it wakes the main command dispatcher immediately
+void *SignalThread(void *threadargs)
+{
+    sigset_t *set = (sigset_t *)threadargs;
+    int signum;
+
+    while(g_running){
+        if (sigwait(set, &signum) != 0) continue;
+        sig_handler(signum);
+        recvd_command_queue.wake();
+    }
+
+    return NULL;
+}
+
+//Releases a mutex held by a thread that is cancelled while waiting
+void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+void wake_dispatcher( void ){
+    recvd_command_queue.wake();
+}
+
+//Every worker but the network thread is asked to stop at once, and the ones
+//blocked somewhere other than on their stop tokens are woken, so that
+//stopping them all takes about as long as the slowest, and only one that
+//ignores the request is cancelled
 void kill_all_workers( void ){
     for(int i = 0; i < MAX_THREADS; i++ ){
-        if ((i != tid_listen) && started[i]) {
-            stop_message[i] = 1;
-        }
+        if (i != tid_network) supervisor.request(i);
     }
-    sleep(SLEEP_KILL);
+    tm_packet_queue.wake();
+    cm_packet_queue.wake();
+    fastCommands.wake();
+    slowCommands.wake();
+    frameSource->Interrupt();
+    pthread_mutex_lock(&mutexProcess);
+    pthread_cond_broadcast(&condSolution);
+    pthread_mutex_unlock(&mutexProcess);
+
     for(int i = 0; i < MAX_THREADS; i++ ){
-        if ((i != tid_listen) && started[i]) {
-            printf("Quitting thread %i, quitting status is %i\n", i, pthread_cancel(threads[i]));
-            started[i] = false;
+        if (i != tid_network) {
+            int status = supervisor.join(i, USLEEP_KILL);
+            if (status >= 0) printf("Quitting thread %i, quitting status is %i\n", i, status);
         }
     }
 }
 
 void kill_all_threads( void){
-    if (started[tid_listen]) {
-        stop_message[tid_listen] = 1;
-        kill_all_workers();
-        printf("Quitting thread %i, quitting status is %i\n", tid_listen, pthread_cancel(threads[tid_listen]));
-        started[tid_listen] = false;
+    if (tid_network >= 0) supervisor.request(tid_network);
+    kill_all_workers();
+    if (tid_network >= 0) {
+        int status = supervisor.join(tid_network, USLEEP_KILL);
+        if (status >= 0) printf("Quitting thread %i, quitting status is %i\n", tid_network, status);
     }
 }
 
@@ -262,12 +364,13 @@ void *CameraStreamThread( void * threadargs)
     long tid = (long)((struct Thread_data *)threadargs)->thread_id;
     printf("CameraStream thread #%ld!\n", tid);
 
-    ImperxStream camera;
+    FrameSource &camera = *frameSource;
 
-    cv::Mat localFrame;
-    timespec preExposure, postExposure, timeElapsed, duration;
-    int width, height;
+    cv::Mat localFrame; // only used when every frame in the pool is in use
+    timespec captureTime;
+    cv::Size size;
     int failcount = 0;
+    time_t last_report = time(NULL);
 
     uint16_t localExposure = exposure;
     int16_t localPreampGain = preampGain;
@@ -277,12 +380,11 @@ void *CameraStreamThread( void * threadargs)
     staleFrame = true;
     while(1)
     {
-        if (stop_message[tid] == 1)
+        if (supervisor.stopping(tid))
         {
             printf("CameraStream thread #%ld exiting\n", tid);
             camera.Stop();
             camera.Disconnect();
-            started[tid] = false;
             pthread_exit( NULL );
         }
         else if (cameraReady == false)
@@ -290,26 +392,24 @@ void *CameraStreamThread( void * threadargs)
             if (camera.Connect() != 0)
             {
                 std::cout << "Error connecting to camera!\n";
-                sleep(SLEEP_CAMERA_CONNECT);
+                supervisor.token(tid).sleep(SLEEP_CAMERA_CONNECT*1000000L);
                 continue;
             }
             else
             {
-                camera.ConfigureSnap();
-                camera.SetROISize(CAMERA_XSIZE,CAMERA_YSIZE);
-                camera.SetROIOffset(CAMERA_XOFFSET,CAMERA_YOFFSET);
+                //The source paces itself at sourceFrameTime
+                camera.Configure(cv::Size(CAMERA_XSIZE,CAMERA_YSIZE), cv::Point(CAMERA_XOFFSET,CAMERA_YOFFSET), sourceFrameTime);
                 camera.SetExposure(localExposure);
                 camera.SetAnalogGain(localAnalogGain);
                 camera.SetPreAmpGain(localPreampGain);
 
-                width = camera.GetROIWidth();
-                height = camera.GetROIHeight();
-                localFrame.create(height, width, CV_8UC1);
-                if(camera.Initialize() != 0)
+                size = camera.GetROISize();
+                framePool.allocate(size.height, size.width, CV_8UC1);
+                if(camera.Initialize() != 0 || camera.StartStream() != 0)
                 {
                     std::cout << "Error initializing camera!\n";
                     //may need disconnect here
-                    sleep(SLEEP_CAMERA_CONNECT);
+                    supervisor.token(tid).sleep(SLEEP_CAMERA_CONNECT*1000000L);
                     continue;
                 }
                 cameraReady = 1;
@@ -333,28 +433,33 @@ void *CameraStreamThread( void * threadargs)
                 camera.SetAnalogGain(analogGain);
             }
 
-            clock_gettime(CLOCK_REALTIME, &preExposure);
+            //The frame is copied out of the source's buffer as it is retrieved,
+            //so frames held by consumers never starve the camera pipeline.
+            //If consumers are holding every frame in the pool, the frame is
+            //retrieved into localFrame and dropped.
+            Frame next = framePool.acquire();
+            cv::Mat &target = (next.empty() ? localFrame : next.image());
 
-            if(!camera.Snap(localFrame))
+            if(!camera.Retrieve(target, captureTime))
             {
                 failcount = 0;
-                procReady.raise();
-                saveReady.raise();
-
-                //printf("CameraStreamThread: trying to lock\n");
-                pthread_mutex_lock(&mutexImage);
-                //printf("CameraStreamThread: got lock, copying over\n");
-                localFrame.copyTo(frame);
-                frameTime = preExposure;
-                //printf("%d\n", frame.at<uint8_t>(0,0));
                 frameCount++;
-                pthread_mutex_unlock(&mutexImage);
+
+                if(!next.empty())
+                {
+                    next.keys().captureTime = captureTime;
+                    next.keys().frameCount = frameCount;
+                    next.keys().exposureTime = localExposure;
+                    framePool.publish(next);
+                    procReady.raise();
+                    saveReady.raise();
+                }
                 staleFrame = false;
 
                 //printf("camera temp is %lld\n", camera.getTemperature());
                 camera_temperature = camera.getTemperature();
             }
-            else
+            else if (!supervisor.stopping(tid))
             {
                 failcount++;
                 std::cout << "Frame failure count = " << failcount << std::endl;
@@ -368,12 +473,12 @@ void *CameraStreamThread( void * threadargs)
                     continue;
                 }
             }
-            clock_gettime(CLOCK_REALTIME, &postExposure);
-            timeElapsed = TimespecDiff(preExposure, postExposure);
-            duration.tv_sec = frameRate.tv_sec - timeElapsed.tv_sec;
-            duration.tv_nsec = frameRate.tv_nsec - timeElapsed.tv_nsec;
-//            std::cout << timeElapsed.tv_sec << " " << timeElapsed.tv_nsec << "\n";
-            nanosleep(&duration, NULL);
+
+            if (time(NULL) - last_report >= SLEEP_TM_REPORT) {
+                camera.Report("CameraStream");
+                printf("CameraStream: %lu frames dropped by the frame pool\n", framePool.getDropped());
+                last_report = time(NULL);
+            }
         }
     }
 }
@@ -388,17 +493,18 @@ void *ImageProcessThread(void *threadargs)
     uint8_t localMin, localMax;
     std::vector<float> localMapping;
     cv::Point2f localPixelCenter, localScreenCenter, localError;
-    timespec waittime;
+    cv::Point2f localPredictedCenter, localPredictedError;
+    timespec localCaptureTime;
+    AspectCode solved;
+    bool mappingFrame;
+    unsigned long processedFrames = 0;
+    long waittime = (frameRate.tv_sec*1000000 + frameRate.tv_nsec/1000)/10;
 
-    waittime.tv_sec = frameRate.tv_sec/10;
-    waittime.tv_nsec = frameRate.tv_nsec/10;
-    
     while(1)
     {
-        if (stop_message[tid] == 1)
+        if (supervisor.stopping(tid))
         {
             printf("ImageProcess thread #%ld exiting\n", tid);
-            started[tid] = false;
             pthread_exit( NULL );
         }
         
@@ -411,102 +517,121 @@ void *ImageProcessThread(void *threadargs)
                     procReady.lower();
                     break;
                 }
-                else
+                else if (supervisor.token(tid).sleep(waittime))
                 {
-                    nanosleep(&waittime, NULL);
+                    break;
                 }
             }
+            if (supervisor.stopping(tid)) continue;
     
-            //printf("ImageProcessThread: trying to lock\n");
-            if (pthread_mutex_trylock(&mutexImage) == 0)
+            //Holding current keeps the camera from reusing its buffer while
+            //aspect refers to it
+            Frame current = framePool.latest();
+            if(!current.empty())
             {
-                //printf("ImageProcessThread: got lock\n");
-                if(!frame.empty())
-                {
-                    aspect.LoadFrame(frame);
-
-                    pthread_mutex_unlock(&mutexImage);
-
-                    runResult = aspect.Run();
-                    
-                    switch(GeneralizeError(runResult))
-                    {
-                        case NO_ERROR:
-                            aspect.GetScreenFiducials(localScreenFiducials);
-                            aspect.GetScreenCenter(localScreenCenter);
-                            aspect.GetMapping(localMapping);
-
-                        case MAPPING_ERROR:
-                            aspect.GetFiducialIDs(localIds);
-
-                        case ID_ERROR:
-                            aspect.GetPixelFiducials(localPixelFiducials);
-
-                        case FIDUCIAL_ERROR:
-                            aspect.GetPixelCenter(localPixelCenter);
-                            aspect.GetPixelError(localError);
-
-                        case CENTER_ERROR:
-                            aspect.GetPixelCrossings(localLimbs);
-                            if (REPORT_FOCUS) aspect.ReportFocus();
-
-                        case LIMB_ERROR:
-                        case RANGE_ERROR:
-                            aspect.GetPixelMinMax(localMin, localMax);
-                            break;
-                        default:
-                            std::cout << "Nothing worked\n";
-                    }
+                localCaptureTime = current.keys().captureTime;
+                aspect.LoadFrame(current.image(), localCaptureTime);
 
-                    pthread_mutex_lock(&mutexProcess);
-                    switch(GeneralizeError(runResult))
-                    {
-                        case NO_ERROR:
-                            screenFiducials = localScreenFiducials;
-                            screenCenter = localScreenCenter;
-                            mapping = localMapping;
-                        case MAPPING_ERROR:
-                            ids = localIds;
-
-                        case ID_ERROR:
-                            pixelFiducials = localPixelFiducials;
-
-                        case FIDUCIAL_ERROR:
-                            pixelCenter = localPixelCenter;  
-                            error = localError;
-
-                        case CENTER_ERROR:
-                            limbs = localLimbs;
-
-                        case LIMB_ERROR:
-                        case RANGE_ERROR:
-                            frameMin = localMin;
-                            frameMax = localMax;
-                            break;
-                        default:
-                            break;
-                    }
-                    pthread_mutex_unlock(&mutexProcess);
+                //CTL only needs the center, so the fiducials and mapping
+                //are found for every MAPPING_INTERVAL-th frame processed,
+                //which is still more often than telemetry sends them
+                mappingFrame = (processedFrames++ % MAPPING_INTERVAL) == 0;
+                runResult = aspect.Run(mappingFrame ? ALL_PRODUCTS : CENTER_PRODUCTS);
+
+                //Otherwise a good frame only updates as far as the center,
+                //leaving the last mapping products in place
+                solved = GeneralizeError(runResult);
+                if (!mappingFrame && solved == NO_ERROR) solved = FIDUCIAL_ERROR;
+
+                if (aspect.GetPredictedCenter(localPredictedCenter, localPredictedError) != NO_ERROR)
+                {
+                    localPredictedCenter = cv::Point2f(0, 0);
+                    localPredictedError = cv::Point2f(0, 0);
                 }
-                else
+                
+                switch(solved)
                 {
-                    //std::cout << "Frame empty!" << std::endl;
+                    case NO_ERROR:
+                        aspect.GetScreenFiducials(localScreenFiducials);
+                        aspect.GetScreenCenter(localScreenCenter);
+                        aspect.GetMapping(localMapping);
+
+                    case MAPPING_ERROR:
+                        aspect.GetFiducialIDs(localIds);
+
+                    case ID_ERROR:
+                        aspect.GetPixelFiducials(localPixelFiducials);
+
+                    case FIDUCIAL_ERROR:
+                        aspect.GetPixelCenter(localPixelCenter);
+                        aspect.GetPixelError(localError);
+
+                    case CENTER_ERROR:
+                        aspect.GetPixelCrossings(localLimbs);
+                        if (REPORT_FOCUS) aspect.ReportFocus();
+
+                    case LIMB_ERROR:
+                    case RANGE_ERROR:
+                        aspect.GetPixelMinMax(localMin, localMax);
+                        break;
+                    default:
+                        std::cout << "Nothing worked\n";
                 }
+                current.release();
 
-                /*
-                  std::cout << ids.size() << " fiducials found:";
-                  for(uint8_t i = 0; i < ids.size() && i < 20; i++) std::cout << pixelFiducials[i];
-                  std::cout << std::endl;
+                pthread_mutex_lock(&mutexProcess);
+                predictedCenter = localPredictedCenter;
+                predictedError = localPredictedError;
+                switch(solved)
+                {
+                    case NO_ERROR:
+                        screenFiducials = localScreenFiducials;
+                        screenCenter = localScreenCenter;
+                        mapping = localMapping;
+                    case MAPPING_ERROR:
+                        ids = localIds;
+
+                    case ID_ERROR:
+                        pixelFiducials = localPixelFiducials;
+
+                    case FIDUCIAL_ERROR:
+                        pixelCenter = localPixelCenter;  
+                        error = localError;
+                        solutionTime = localCaptureTime;
+                        solutionCount++;
+                        pthread_cond_broadcast(&condSolution);
+
+                    case CENTER_ERROR:
+                        limbs = localLimbs;
+
+                    case LIMB_ERROR:
+                    case RANGE_ERROR:
+                        frameMin = localMin;
+                        frameMax = localMax;
+                        break;
+                    default:
+                        break;
+                }
+                pthread_mutex_unlock(&mutexProcess);
+            }
+            else
+            {
+                //std::cout << "Frame empty!" << std::endl;
+            }
 
-                  for(uint8_t i = 0; i < ids.size() && i < 20; i++) std::cout << ids[i];
-                  std::cout << std::endl;
+            /*
+              std::cout << ids.size() << " fiducials found:";
+              for(uint8_t i = 0; i < ids.size() && i < 20; i++) std::cout << pixelFiducials[i];
+              std::cout << std::endl;
 
-                  for(uint8_t i = 0; i < ids.size() && i < 20; i++) std::cout << screenFiducials[i];
-                  std::cout << std::endl;
+              for(uint8_t i = 0; i < ids.size() && i < 20; i++) std::cout << ids[i];
+              std::cout << std::endl;
 
-                  std::cout << "Sun center (pixels): " << pixelCenter << ", Sun center (screen): " << screenCenter << std::endl;
-                */
-            }
+              for(uint8_t i = 0; i < ids.size() && i < 20; i++) std::cout << screenFiducials[i];
+              std::cout << std::endl;
+
+              std::cout << "Sun center (pixels): " << pixelCenter << ", Sun center (screen): " << screenCenter << std::endl;
+            */
         }
     }
 }
@@ -517,56 +642,25 @@ void *TelemetrySenderThread(void *threadargs)
     printf("TelemetrySender thread #%ld!\n", tid);
 
     TelemetrySender telSender(IP_FDR, (unsigned short) PORT_TM);
+    time_t last_report = time(NULL);
 
     while(1)    // run forever
     {
-        usleep(USLEEP_TM_SEND);
+        //Drain everything that has accumulated by the time we are woken up
+        if (tm_packet_queue.wait(USLEEP_TM_SEND)) telSender.send( &tm_packet_queue );
 
-        if( !tm_packet_queue.empty() ){
-            TelemetryPacket tp(NULL);
-            tm_packet_queue >> tp;
-            telSender.send( &tp );
-            //std::cout << "TelemetrySender:" << tp << std::endl;
+        if (time(NULL) - last_report >= SLEEP_TM_REPORT) {
+            telSender.report("TelemetrySender");
+            last_report = time(NULL);
         }
 
-        if (stop_message[tid] == 1){
+        if (supervisor.stopping(tid)){
             printf("TelemetrySender thread #%ld exiting\n", tid);
-            started[tid] = false;
             pthread_exit( NULL );
         }
     }
 }
 
-void *SBCInfoThread(void *threadargs)
-{
-    long tid = (long)((struct Thread_data *)threadargs)->thread_id;
-    printf("SBCInfo thread #%ld!\n", tid);
-
-    UDPReceiver receiver(PORT_SBC_INFO);
-    receiver.init_connection();
-
-    uint16_t packet_length;
-    uint8_t *array;
-
-    while(1)
-    {
-        if (stop_message[tid] == 1)
-        {
-            printf("SBCInfo thread #%ld exiting\n", tid);
-            started[tid] = false;
-            pthread_exit( NULL );
-        }
-
-        //This call will block forever if the service is not running
-        packet_length = receiver.listen();
-        array = new uint8_t[packet_length];
-        receiver.get_packet(array);
-
-        Packet packet( array, packet_length );
-        packet >> sbc_temperature >> sbc_v105 >> sbc_v25 >> sbc_v33 >> sbc_v50 >> sbc_v120;
-    }
-}
-
 void *SaveTemperaturesThread(void *threadargs)
 {
     long tid = (long)((struct Thread_data *)threadargs)->thread_id;
@@ -587,22 +681,20 @@ void *SaveTemperaturesThread(void *threadargs)
 
     if((file = fopen(obsfilespec, "w")) == NULL){
         printf("Cannot open file\n");
-        started[tid] = false;
         pthread_exit( NULL );
     } else {
         fprintf(file, "time, camera temp, cpu temp\n");
-        sleep(SLEEP_LOG_TEMPERATURE);
+        temperatureTask.start();
         while(1)
         {
             char current_time[25];
-            if (stop_message[tid] == 1)
+            if (supervisor.stopping(tid))
             {
                 printf("SaveTemperatures thread #%ld exiting\n", tid);
                 fclose(file);
-                started[tid] = false;
                 pthread_exit( NULL );
             }
-            sleep(SLEEP_LOG_TEMPERATURE);
+            if (temperatureTask.wait(supervisor.token(tid).fd()) < 0) continue;
 
             time(&ltime);
             times = localtime(&ltime);
@@ -618,17 +710,15 @@ void *SaveImageThread(void *threadargs)
     long tid = (long)((struct Thread_data *)threadargs)->thread_id;
     printf("SaveImage thread #%ld!\n", tid);
 
-    cv::Mat localFrame;
-    long int localFrameCount;
+    HeaderData localKeys;
     std::string fitsfile;
-    timespec waittime = {1,0};
     //timespec thetimenow;
+    saveImageTask.start();
     while(1)
     {
-        if (stop_message[tid] == 1)
+        if (supervisor.stopping(tid))
         {
             printf("SaveImage thread #%ld exiting\n", tid);
-            started[tid] = false;
             pthread_exit( NULL );
         }
         if (cameraReady)
@@ -640,47 +730,35 @@ void *SaveImageThread(void *threadargs)
                     saveReady.lower();
                     break;
                 }
-                else
+                else if (supervisor.token(tid).sleep(1000000))
                 {
-                    nanosleep(&waittime, NULL);
+                    break;
                 }
             }
+            if (supervisor.stopping(tid)) continue;
 
-            //printf("SaveImageThread: trying to lock\n");
-            if (pthread_mutex_trylock(&mutexImage) == 0)
+            Frame current = framePool.latest();
+            if(!current.empty())
             {
-                //printf("ImageProcessThread: got lock\n");
-                if(!frame.empty())
-                {
-                    localFrameCount = frameCount;
-                    frame.copyTo(localFrame);
-                    keys.captureTime = frameTime;
-                    keys.frameCount = frameCount;
-                    pthread_mutex_unlock(&mutexImage);
+                localKeys = current.keys();
 
-                    keys.exposureTime = exposure;
+                char stringtemp[80];
+                char obsfilespec[128];
+                time_t ltime;
+                struct tm *times;
 
-                    char stringtemp[80];
-                    char obsfilespec[128];
-                    time_t ltime;
-                    struct tm *times;
+                //Use clock_gettime instead?
+                time(&ltime);
+                times = localtime(&ltime);
+                strftime(stringtemp,40,"%y%m%d_%H%M%S",times);
 
-                    //Use clock_gettime instead?
-                    time(&ltime);
-                    times = localtime(&ltime);
-                    strftime(stringtemp,40,"%y%m%d_%H%M%S",times);
+                sprintf(obsfilespec, "%simage_%s_%02d.fits", SAVE_LOCATION, stringtemp, (int)localKeys.frameCount);
 
-                    sprintf(obsfilespec, "%simage_%s_%02d.fits", SAVE_LOCATION, stringtemp, (int)localFrameCount);
+                printf("Saving image %s: exposure %d us, analog gain %d, preamp gain %d\n", obsfilespec, localKeys.exposureTime, analogGain, preampGain);
+                writeFITSImage(current.image(), localKeys, obsfilespec);
+                current.release();
 
-                    printf("Saving image %s: exposure %d us, analog gain %d, preamp gain %d\n", obsfilespec, exposure, analogGain, preampGain);
-                    writeFITSImage(localFrame, keys, obsfilespec);
-
-                    sleep(SLEEP_SAVE);
-                }
-                else
-                {
-                    pthread_mutex_unlock(&mutexImage);
-                }
+                saveImageTask.wait(supervisor.token(tid).fd());
             }
         }
     }
@@ -694,11 +772,15 @@ void *TelemetryPackagerThread(void *threadargs)
     unsigned char localMin, localMax;
     CoordList localLimbs, localFiducials;
     std::vector<float> localMapping;
-    cv::Point2f localCenter, localError;
+    cv::Point2f localCenter, localError, localPredictedCenter, localPredictedError;
 
+    telemetryTask.start();
     while(1)    // run forever
     {
-        usleep(USLEEP_TM_GENERIC);
+        if (telemetryTask.wait(supervisor.token(tid).fd()) < 0) {
+            printf("TelemetryPackager thread #%ld exiting\n", tid);
+            pthread_exit( NULL );
+        }
         tm_frame_sequence_number++;
 
         TelemetryPacket tp(TM_SAS_GENERIC, SOURCE_ID_SAS);
@@ -714,6 +796,8 @@ void *TelemetryPackagerThread(void *threadargs)
             localLimbs = limbs;
             localCenter = pixelCenter;
             localError = error;
+            localPredictedCenter = predictedCenter;
+            localPredictedError = predictedError;
             localFiducials = pixelFiducials;
             localMapping = mapping;
 
@@ -741,8 +825,8 @@ void *TelemetryPackagerThread(void *threadargs)
         tp << Pair3B(localError.x, localError.y);
 
         //Predicted Sun center and error
-        tp << Pair3B(0, 0);
-        tp << Pair3B(0, 0);
+        tp << Pair3B(localPredictedCenter.x, localPredictedCenter.y);
+        tp << Pair3B(localPredictedError.x, localPredictedError.y);
 
         //Number of limb crossings
         tp << (uint16_t)localLimbs.size();
@@ -789,11 +873,10 @@ void *TelemetryPackagerThread(void *threadargs)
         tp << solarTransform.calculateOffset(Pair(localCenter.x,localCenter.y));
 
         //add telemetry packet to the queue
-        tm_packet_queue << tp;
+        tm_packet_queue << std::move(tp);
             
-        if (stop_message[tid] == 1){
+        if (supervisor.stopping(tid)){
             printf("TelemetryPackager thread #%ld exiting\n", tid);
-            started[tid] = false;
             pthread_exit( NULL );
         }
     }
@@ -802,59 +885,71 @@ void *TelemetryPackagerThread(void *threadargs)
     return NULL;
 }
 
-void *listenForCommandsThread(void *threadargs)
-{  
-    long tid = (long)((struct Thread_data *)threadargs)->thread_id;
-    printf("listenForCommands thread #%ld!\n", tid);
+//Handlers for the network thread's sockets, called on that thread
+void receive_command(const uint8_t *data, unsigned int length, void *context)
+{
+    printf("NetworkThread: command packet of %u bytes\n", length);
 
-    tid_listen = tid;
+    CommandPacket command_packet( data, length );
+    command_packet.stamp();
 
-    CommandReceiver comReceiver( (unsigned short) PORT_CMD);
-    comReceiver.init_connection();
-    
-    while(1)    // run forever
-    {
-        unsigned int packet_length;
-    
-        packet_length = comReceiver.listen( );
-        printf("listenForCommandsThread: %i\n", packet_length);
-        uint8_t *packet;
-        packet = new uint8_t[packet_length];
-        comReceiver.get_packet( packet );
-    
-        CommandPacket command_packet( packet, packet_length );
+    if (command_packet.valid()){
+        printf("NetworkThread: good command packet\n");
 
-        if (command_packet.valid()){
-            printf("listenForCommandsThread: good command packet\n");
+        command_sequence_number = command_packet.getSequenceNumber();
 
-            command_sequence_number = command_packet.getSequenceNumber();
+        // add command ack packet
+        TelemetryPacket ack_tp(TM_ACK_RECEIPT, SOURCE_ID_SAS);
+        ack_tp << command_sequence_number;
+        tm_packet_queue << std::move(ack_tp);
 
-            // add command ack packet
-            TelemetryPacket ack_tp(TM_ACK_RECEIPT, SOURCE_ID_SAS);
-            ack_tp << command_sequence_number;
-            tm_packet_queue << ack_tp;
+        // update the command count
+        printf("command sequence number to %i\n", command_sequence_number);
 
-            // update the command count
-            printf("command sequence number to %i\n", command_sequence_number);
+        try { recvd_command_queue.add_packet(command_packet); }
+        catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
 
-            try { recvd_command_queue.add_packet(command_packet); }
-            catch (std::exception& e) {
-                std::cerr << e.what() << std::endl;
-            }
+    } else {
+        printf("NetworkThread: bad command packet\n");
+    }
+}
 
-        } else {
-            printf("listenForCommandsThread: bad command packet\n");
-        }
+void receive_sbc_info(const uint8_t *data, unsigned int length, void *context)
+{
+    Packet packet( data, length );
 
-        if (stop_message[tid] == 1){
-            printf("listenForCommands thread #%ld exiting\n", tid);
-            comReceiver.close_connection();
-            started[tid] = false;
-            pthread_exit( NULL );
-        }
+    try { packet >> sbc_temperature >> sbc_v105 >> sbc_v25 >> sbc_v33 >> sbc_v50 >> sbc_v120; }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
     }
+}
 
-    /* NEVER REACHED */
+//Receives commands and SBC information on one Reactor, which returns as soon
+//as the thread is asked to stop
+void *NetworkThread(void *threadargs)
+{
+    long tid = (long)((struct Thread_data *)threadargs)->thread_id;
+    printf("Network thread #%ld!\n", tid);
+
+    CommandReceiver comReceiver( (unsigned short) PORT_CMD);
+    UDPReceiver sbcReceiver( (unsigned short) PORT_SBC_INFO);
+    Reactor reactor;
+
+    comReceiver.init_connection();
+    sbcReceiver.init_connection();
+    if (reactor.add(comReceiver.get_socket(), receive_command) != 0)
+        printf("Network thread: cannot receive commands\n");
+    if (reactor.add(sbcReceiver.get_socket(), receive_sbc_info) != 0)
+        printf("Network thread: cannot receive SBC information\n");
+
+    reactor.run(supervisor.token(tid).fd());
+
+    printf("Network thread #%ld exiting\n", tid);
+    reactor.report("Network");
+    comReceiver.close_connection();
+    sbcReceiver.close_connection();
     return NULL;
 }
 
@@ -864,21 +959,31 @@ void *CommandSenderThread( void *threadargs )
     printf("CommandSender thread #%ld!\n", tid);
 
     CommandSender comSender(IP_CTL, PORT_CMD);
+    time_t last_report = time(NULL);
 
     while(1)    // run forever
     {
-        usleep(USLEEP_CMD_SEND);
-    
-        if( !cm_packet_queue.empty() ){
-            CommandPacket cp(NULL);
-            cm_packet_queue >> cp;
+        CommandPacket cp(NULL);
+        if( cm_packet_queue.pop(cp, USLEEP_CMD_SEND) ){
             comSender.send( &cp );
             //std::cout << "CommandSender: " << cp << std::endl;
+
+            //Solution packets are stamped with their exposure time
+            timespec stamp = cp.getStamp();
+            if (stamp.tv_sec != 0 || stamp.tv_nsec != 0) {
+                timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                solutionLatency.add(stamp, now);
+            }
         }
 
-        if (stop_message[tid] == 1){
+        if (time(NULL) - last_report >= SLEEP_TM_REPORT) {
+            solutionLatency.report("Solution");
+            last_report = time(NULL);
+        }
+
+        if (supervisor.stopping(tid)){
             printf("CommandSender thread #%ld exiting\n", tid);
-            started[tid] = false;
             pthread_exit( NULL );
         }
     }
@@ -891,53 +996,87 @@ void *CommandPackagerThread( void *threadargs )
     printf("CommandPackager thread #%ld!\n", tid);
 
     cv::Point2f localCenter, localError;
+    timespec localTime, deadline, nextAllowed;
+    uint32_t lastSolution = solutionCount;
+    bool fresh, outputting, tracking, acknowledge;
+
+    clock_gettime(CLOCK_MONOTONIC, &nextAllowed);
 
     while(1)    // run forever
     {
-        sleep(SLEEP_SOLUTION);
+        //Hold off until the rate limit allows another solution, then send
+        //whichever is newest
+        supervisor.token(tid).sleepUntil(nextAllowed);
+
+        //Wait for a new solution or a tracking change from CTL
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += SLEEP_SOLUTION;
+        fresh = false;
+        acknowledge = false;
+
+        //A tracking change is only a reason to wake while this SAS outputs,
+        //and stays unacknowledged until it does
+        pthread_mutex_lock(&mutexProcess);
+        pthread_cleanup_push(unlock_mutex, &mutexProcess);
+        while ((solutionCount == lastSolution) && !(isOutputting && !acknowledgedCTL) && !supervisor.stopping(tid)) {
+            if (pthread_cond_timedwait(&condSolution, &mutexProcess, &deadline) == ETIMEDOUT) break;
+        }
+        if (solutionCount != lastSolution) {
+            fresh = true;
+            lastSolution = solutionCount;
+            localCenter = pixelCenter;
+            localError = error;
+            localTime = solutionTime;
+        }
+        outputting = isOutputting;
+        tracking = isTracking;
+        if (outputting && !acknowledgedCTL) {
+            acknowledge = true;
+            acknowledgedCTL = true;
+        }
+        pthread_cleanup_pop(1);
 
-        if (isOutputting) {
-            solution_sequence_number++;
-            CommandPacket cp(TARGET_ID_CTL, solution_sequence_number);
+        if (outputting) {
+            CommandPacket cp(TARGET_ID_CTL, solution_sequence_number+1);
 
-            if (isTracking) {
-                if (!acknowledgedCTL) {
+            if (tracking) {
+                if (acknowledge) {
                     cp << (uint16_t)HKEY_SAS_TRACKING_IS_ON;
-                    acknowledgedCTL = true;
-                } else {
-                    if(pthread_mutex_trylock(&mutexProcess) == 0)
-                    {
-                        localCenter = pixelCenter;
-                        localError = error;
-
-                        pthread_mutex_unlock(&mutexProcess);
-                    } else {
-                        std::cout << "Using stale information for solution packet" << std::endl;
-                    }
-
+                } else if (fresh) {
                     cp << (uint16_t)HKEY_SAS_SOLUTION;
                     cp << solarTransform.calculateOffset(Pair(localCenter.x,localCenter.y));
                     cp << (double)0; // roll offset
                     cp << (double)0.003; // error
-                    cp << (uint32_t)0; //seconds
-                    cp << (uint16_t)0; //milliseconds
+                    cp << (uint32_t)localTime.tv_sec; //seconds
+                    cp << (uint16_t)(localTime.tv_nsec/1000000); //milliseconds
+
+                    //Stamp the packet with the middle of its exposure on the
+                    //monotonic clock so that the sender can measure the latency
+                    timespec nowReal, nowMono;
+                    clock_gettime(CLOCK_REALTIME, &nowReal);
+                    clock_gettime(CLOCK_MONOTONIC, &nowMono);
+                    cp.setStamp(TimespecDiff(TimespecDiff(localTime, nowReal), nowMono));
+
+                    nextAllowed = nowMono;
+                    nextAllowed.tv_nsec += 1000000000L/SOLUTION_MAX_RATE;
+                    nextAllowed.tv_sec += nextAllowed.tv_nsec / 1000000000L;
+                    nextAllowed.tv_nsec %= 1000000000L;
                 }
             } else { // isTracking is false
-                if (!acknowledgedCTL) {
+                if (acknowledge) {
                     cp << (uint16_t)HKEY_SAS_TRACKING_IS_OFF;
-                    acknowledgedCTL = true;
                 }
             } // isTracking
 
             //Add packet to the queue if any commands have been inserted to the packet
             if(cp.remainingBytes() > 0) {
-                cm_packet_queue << cp;
+                solution_sequence_number++;
+                cm_packet_queue << std::move(cp);
             }
         } // isOutputting
 
-        if (stop_message[tid] == 1){
+        if (supervisor.stopping(tid)){
             printf("CommandPackager thread #%ld exiting\n", tid);
-            started[tid] = false;
             pthread_exit( NULL );
         }
     }
@@ -952,117 +1091,185 @@ void queue_cmd_proc_ack_tmpacket( uint16_t error_code )
     ack_tp << command_sequence_number;
     ack_tp << latest_sas_command_key;
     ack_tp << error_code;
-    tm_packet_queue << ack_tp;
+    tm_packet_queue << std::move(ack_tp);
 }
 
-uint16_t cmd_send_image_to_ground( int camera_id )
+void queue_timing_tmpacket( void )
+{
+    TimingHistogram jitter, execution;
+    unsigned long missed;
+
+    TelemetryPacket tp(TM_SAS_TIMING, SOURCE_ID_SAS);
+    tp.setSAS(sas_id);
+    tp << (uint16_t)NUM_PERIODIC_TASKS;
+    tp << (uint16_t)TIMING_BINS;
+
+    //For each task, its period and missed deadlines, then the count, mean,
+    //max, and bins of its jitter and then of its execution time
+    for (int k = 0; k < NUM_PERIODIC_TASKS; k++) {
+        periodicTasks[k]->report();
+        periodicTasks[k]->getStatistics(jitter, execution, missed);
+        tp << (uint32_t)periodicTasks[k]->getPeriod();
+        tp << (uint32_t)missed;
+        for (int h = 0; h < 2; h++) {
+            const TimingHistogram &histogram = h ? execution : jitter;
+            tp << (uint32_t)histogram.count;
+            tp << (float)histogram.mean();
+            tp << (float)histogram.max;
+            for (int b = 0; b < TIMING_BINS; b++)
+                tp << (uint16_t)std::min(histogram.bins[b], 65535UL);
+        }
+    }
+    tm_packet_queue << std::move(tp);
+}
+
+//A handler cancelled partway through an image must neither keep the others
+//out nor leave the rest of the image to be followed by the next one
+void abandon_downlink(void *arg)
+{
+    imageSender.close_connection();
+    pthread_mutex_unlock(&mutexDownlink);
+}
+
+//Sending stops when stopFd becomes readable, closing the connection
+uint16_t cmd_send_image_to_ground( int camera_id, int stopFd )
 {
     // camera_id refers to 0 PYAS, 1 is RAS (if valid)
     uint16_t error_code = 0;
-    cv::Mat localFrame;
-    HeaderData localKeys;
 
-    TCPSender tcpSndr(IP_FDR, (unsigned short) PORT_IMAGE);
-    int ret = tcpSndr.init_connection();
-    if (ret > 0){
-        if (pthread_mutex_trylock(&mutexImage) == 0){
-            if( !frame.empty() ){
-                frame.copyTo(localFrame);
-                localKeys = keys;
-            }
-            pthread_mutex_unlock(&mutexImage);
-        }
-        if( !localFrame.empty() ){
+    // only one image can be on the way down at a time
+    pthread_mutex_lock(&mutexDownlink);
+    pthread_cleanup_push(abandon_downlink, NULL);
+
+    int ret = imageSender.init_connection();
+    if (ret >= 0){
+        Frame current = framePool.latest();
+        error_code = 1;
+        if( !current.empty() ){
             //1 for SAS-1/PYAS, 2 for SAS-2/PYAS, 6 for SAS-2/RAS
             uint8_t camera = sas_id+4*camera_id;
 
-            uint16_t numXpixels = localFrame.cols;
-            uint16_t numYpixels = localFrame.rows;
-            uint32_t totalpixels = numXpixels*numYpixels;
-
-            //Copy localFrame to a C array
-            uint8_t *array = new uint8_t[totalpixels];
-
-            uint16_t rows = (localFrame.isContinuous() ? 1 : localFrame.rows);
-            uint32_t cols = totalpixels/rows;
+            //Pool frames are allocated whole, so they are continuous and can be
+            //sent directly from their buffers
+            //The sections and the tags share one timestamp
+            cv::Mat &image = current.image();
+            timeval now;
+            gettimeofday(&now, NULL);
+            int sections = imageSender.send_image(camera, image.cols, image.rows, image.ptr<uint8_t>(0), now, stopFd);
+
+            if (sections >= 0) {
+                //Add FITS header tags
+                uint32_t temp = current.keys().exposureTime;
+                ImageTagPacket itp(camera, &temp, TLONG, "EXPOSURE", "Exposure time (msec)");
+                itp.setTimeAndFinish(now);
+                imageSender.send_packet( &itp );
+
+                std::cout << "Sent " << sections+1 << " packets\n";
+            } else { error_code = 2; }
+        }
+    } else { error_code = 2; }
 
-            for (int j = 0; j < rows; j++) {
-                memcpy(array+j*cols, localFrame.ptr<uint8_t>(j), cols);
-            }
+    pthread_cleanup_pop(0);
+    pthread_mutex_unlock(&mutexDownlink);
 
-            im_packet_queue.add_array(camera, numXpixels, numYpixels, array);
+    return error_code;
+}
+        
+//Handles the commands of lane until stopped
+void *serve_commands(void *threadargs, CommandLane &lane)
+{
+    long tid = (long)((struct Thread_data *)threadargs)->thread_id;
+    printf("%s thread #%ld!\n", lane.getName(), tid);
 
-            delete array;
+    SASCommand command;
+    timespec started;
 
-            //Add FITS header tags
-            uint32_t temp = localKeys.exposureTime;
-            im_packet_queue << ImageTagPacket(camera, &temp, TLONG, "EXPOSURE", "Exposure time (msec)");
+    while(1)
+    {
+        if (supervisor.stopping(tid)){
+            printf("%s thread #%ld exiting\n", lane.getName(), tid);
+            pthread_exit( NULL );
+        }
 
-            //Make sure to synchronize all the timestamps
-            im_packet_queue.synchronize();
+        if (lane.pop(command, USLEEP_CMD_HANDLE)){
+            clock_gettime(CLOCK_MONOTONIC, &started);
+            handle_sas_command(command, tid);
+            lane.finished(command, started);
+        }
+    }
 
-            std::cout << "Sending " << im_packet_queue.size() << " packets\n";
+    /* NEVER REACHED */
+    return NULL;
+}
 
-            ImagePacket im(NULL);
-            while(!im_packet_queue.empty()) {
-                im_packet_queue >> im;
-                tcpSndr.send_packet( &im );
-            }
+void *FastCommandThread(void *threadargs)
+{
+    return serve_commands(threadargs, fastCommands);
+}
 
-        }
-        tcpSndr.close_connection();
-        error_code = 1;
-    } else { error_code = 2; }
-    return error_code;
+void *SlowCommandThread(void *threadargs)
+{
+    return serve_commands(threadargs, slowCommands);
 }
-        
-void *commandHandlerThread(void *threadargs)
+
+void handle_sas_command(const SASCommand &command, long tid)
 {
-    long tid = (long)((struct Thread_data *)threadargs)->thread_id;
-    struct Thread_data *my_data;
     uint16_t error_code = 0;
-    my_data = (struct Thread_data *) threadargs;
 
-    switch( my_data->command_key & 0x0FFF)
+    switch( command.key & 0x0FFF)
     {
         case SKEY_REQUEST_IMAGE:
             {
-                error_code = cmd_send_image_to_ground( 0 );
+                error_code = cmd_send_image_to_ground( 0, supervisor.token(tid).fd() );
+                queue_cmd_proc_ack_tmpacket( error_code );
+            }
+            break;
+        case SKEY_REQUEST_TIMING:
+            {
+                queue_timing_tmpacket();
+                fastCommands.report();
+                slowCommands.report();
                 queue_cmd_proc_ack_tmpacket( error_code );
             }
             break;
         case SKEY_SET_EXPOSURE:    // set exposure time
             {
-                if( (my_data->command_vars[0] > 0) && (my_data->command_num_vars == 1)) exposure = my_data->command_vars[0];
+                if( (command.vars[0] > 0) && (command.num_vars == 1)) exposure = command.vars[0];
                 std::cout << "Requested exposure time is: " << exposure << std::endl;
                 queue_cmd_proc_ack_tmpacket( error_code );
             }
             break;
         case SKEY_SET_PREAMPGAIN:    // set preamp gain
             {
-                if( my_data->command_num_vars == 1) preampGain = (int16_t)my_data->command_vars[0];
+                if( command.num_vars == 1) preampGain = (int16_t)command.vars[0];
                 std::cout << "Requested preamp gain is: " << preampGain << std::endl;
                 queue_cmd_proc_ack_tmpacket( error_code );
             }
             break;
         case SKEY_SET_ANALOGGAIN:    // set analog gain
             {
-                if( my_data->command_num_vars == 1) analogGain = my_data->command_vars[0];
+                if( command.num_vars == 1) analogGain = command.vars[0];
                 std::cout << "Requested analog gain is: " << analogGain << std::endl;
                 queue_cmd_proc_ack_tmpacket( error_code );
             }
             break;
         case SKEY_SET_TARGET:    // set new solar target
-            solarTransform.set_solar_target(Pair((int16_t)my_data->command_vars[0], (int16_t)my_data->command_vars[1]));
+            solarTransform.set_solar_target(Pair((int16_t)command.vars[0], (int16_t)command.vars[1]));
             break;
         case SKEY_START_OUTPUTTING:
             {
+                //Wakes the packager for a tracking change still to acknowledge
+                pthread_mutex_lock(&mutexProcess);
                 isOutputting = true;
+                pthread_cond_broadcast(&condSolution);
+                pthread_mutex_unlock(&mutexProcess);
             }
             break;
         case SKEY_STOP_OUTPUTTING:
             {
+                pthread_mutex_lock(&mutexProcess);
                 isOutputting = false;
+                pthread_mutex_unlock(&mutexProcess);
             }
             break;
         default:
@@ -1071,9 +1278,6 @@ void *commandHandlerThread(void *threadargs)
                 queue_cmd_proc_ack_tmpacket( error_code );
             }
     }
-
-    started[tid] = false;
-    return NULL;
 }
 
 void cmd_process_heroes_command(uint16_t heroes_command)
@@ -1081,14 +1285,20 @@ void cmd_process_heroes_command(uint16_t heroes_command)
     if ((heroes_command & 0xFF00) == 0x1000) {
         switch(heroes_command) {
             case HKEY_CTL_START_TRACKING: // start tracking
+                pthread_mutex_lock(&mutexProcess);
                 isTracking = true;
                 acknowledgedCTL = false;
                 // need to send 0x1100 command packet
+                pthread_cond_broadcast(&condSolution);
+                pthread_mutex_unlock(&mutexProcess);
                 break;
             case HKEY_CTL_STOP_TRACKING: // stop tracking
+                pthread_mutex_lock(&mutexProcess);
                 isTracking = false;
                 acknowledgedCTL = false;
                 // need to send 0x1101 command packet
+                pthread_cond_broadcast(&condSolution);
+                pthread_mutex_unlock(&mutexProcess);
                 break;
             case HKEY_FDR_SAS_CMD: // SAS command, so do nothing here
                 break;
@@ -1098,39 +1308,115 @@ void cmd_process_heroes_command(uint16_t heroes_command)
     } else printf("Not a HEROES-to-SAS command\n");
 }
 
-void start_thread(void *(*routine) (void *), const Thread_data *tdata)
+//Returns the thread's slot, or -1 if it could not be started
+int start_thread(void *(*routine) (void *), const Thread_data *tdata, bool restart)
 {
-    int i = 0;
-    while (started[i] == true) {
-        i++;
-        if (i == MAX_THREADS) return; //should probably thrown an exception
-    }
+    int i = supervisor.reserve();
+    if (i < 0) return -1; //should probably thrown an exception
 
     //Copy the thread data to a global to prevent deallocation
     if (tdata != NULL) memcpy(&thread_data[i], tdata, sizeof(Thread_data));
     thread_data[i].thread_id = i;
 
-    stop_message[i] = 0;
-
-    int rc = pthread_create(&threads[i], NULL, routine, &thread_data[i]);
+    int rc = supervisor.start(i, routine, &thread_data[i], thread_config(routine), restart);
     if (rc != 0) {
         printf("ERROR; return code from pthread_create() is %d\n", rc);
-    } else started[i] = true;
+        return -1;
+    }
 
-    return;
+    return i;
+}
+
+const ThreadConfig &thread_config(void *(*routine) (void *))
+{
+    int i = 0;
+    while (threadTable[i].routine != NULL && threadTable[i].routine != routine) i++;
+    return threadTable[i].config;
+}
+
+//Processes pre-rendered synthetic frames at the frame rate in a thread with
+//ImageProcess's settings, until running is lowered
+struct SelfTest
+{
+    std::vector<cv::Mat> frames;
+    PeriodicTask *task;
+    volatile bool running;
+};
+
+void *SelfTestThread(void *threadargs)
+{
+    SelfTest *test = (SelfTest *)threadargs;
+    Aspect localAspect;
+    timespec captureTime;
+    unsigned long processedFrames = 0;
+
+    test->task->start();
+    while (test->running)
+    {
+        test->task->wait();
+        clock_gettime(CLOCK_REALTIME, &captureTime);
+        localAspect.LoadFrame(test->frames[processedFrames % test->frames.size()], captureTime);
+        localAspect.Run((processedFrames % MAPPING_INTERVAL) == 0 ? ALL_PRODUCTS : CENTER_PRODUCTS);
+        processedFrames++;
+    }
+    return NULL;
+}
+
+//Reports the jitter and execution time of frame processing for seconds,
+//first on an idle machine and then with every CPU loaded
+int latency_selftest(int seconds)
+{
+    SyntheticSun sun;
+    SelfTest test;
+    timespec captureTime;
+    pthread_t thread;
+    BackgroundLoad load;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    PeriodicTask unloaded("Unloaded", sourceFrameTime), loaded("Loaded", sourceFrameTime);
+    PeriodicTask *phases[] = {&unloaded, &loaded};
+
+    sun.SetDrift(20);
+    sun.SetExposure(exposure);
+    sun.Configure(cv::Size(CAMERA_XSIZE, CAMERA_YSIZE), cv::Point(CAMERA_XOFFSET, CAMERA_YOFFSET), 0);
+    sun.Initialize();
+    sun.StartStream();
+    test.frames.resize(SELFTEST_FRAMES);
+    for (int k = 0; k < SELFTEST_FRAMES; k++) sun.Retrieve(test.frames[k], captureTime);
+    sun.Stop();
+
+    for (int k = 0; k < 2; k++)
+    {
+        if (phases[k] == &loaded) load.start(cpus);
+        printf("Self-test: processing frames every %d us for %d s, %s\n", sourceFrameTime, seconds,
+               phases[k] == &loaded ? "with every CPU loaded" : "unloaded");
+
+        test.task = phases[k];
+        test.running = true;
+        if (CreateThread(&thread, thread_config(ImageProcessThread), SelfTestThread, &test) != 0) {
+            printf("ERROR; could not create the self-test thread\n");
+            return -1;
+        }
+        sleep(seconds);
+        test.running = false;
+        pthread_join(thread, NULL);
+        load.stop();
+        phases[k]->report();
+    }
+    return 0;
 }
 
 void cmd_process_sas_command(uint16_t sas_command, Command &command)
 {
-    Thread_data tdata;
+    SASCommand pending;
 
     if ((sas_command & (sas_id << 12)) != 0) {
-        tdata.command_key = sas_command;
-        tdata.command_num_vars = sas_command & 0x000F;
+        pending.key = sas_command;
+        pending.num_vars = sas_command & 0x000F;
+        pending.received = command.getStamp();
 
-        for(int i = 0; i < tdata.command_num_vars; i++){
+        for(int i = 0; i < pending.num_vars; i++){
             try {
-              command >> tdata.command_vars[i];
+              command >> pending.vars[i];
             } catch (std::exception& e) {
                std::cerr << e.what() << std::endl;
             }
@@ -1148,80 +1434,149 @@ void cmd_process_sas_command(uint16_t sas_command, Command &command)
                 break;
             case SKEY_RESTART_THREADS:    // (re)start all worker threads
                 {
+                    timespec begin, end;
+                    clock_gettime(CLOCK_MONOTONIC, &begin);
                     kill_all_threads();
 
-                    start_thread(listenForCommandsThread, NULL);
+                    tid_network = start_thread(NetworkThread, NULL, true);
                     start_all_workers();
+                    clock_gettime(CLOCK_MONOTONIC, &end);
+                    restartDowntime.add(begin, end);
+                    restartDowntime.report("Thread restart");
                     queue_cmd_proc_ack_tmpacket( 1 );
                 }
                 break;
+            case SKEY_REQUEST_IMAGE:    // takes a while, so kept out of the way of the rest
+                {
+                    if (!slowCommands.push(pending)) {
+                        printf("Command 0x%04x refused, %s is full\n", sas_command, slowCommands.getName());
+                        queue_cmd_proc_ack_tmpacket( 0xfffe );    // handlers busy!
+                    }
+                }
+                break;
             default:
                 {
-                    start_thread(commandHandlerThread, &tdata);
+                    if (!fastCommands.push(pending)) {
+                        printf("Command 0x%04x refused, %s is full\n", sas_command, fastCommands.getName());
+                        queue_cmd_proc_ack_tmpacket( 0xfffe );    // handlers busy!
+                    }
                 }
         } //switch
     } else printf("Not the intended SAS for this command\n");
 }
 
 void start_all_workers( void ){
-    start_thread(TelemetryPackagerThread, NULL);
-    start_thread(CommandPackagerThread, NULL);
-    start_thread(TelemetrySenderThread, NULL);
-    start_thread(CommandSenderThread, NULL);
-    start_thread(CameraStreamThread, NULL);
-    start_thread(ImageProcessThread, NULL);
-    start_thread(SaveImageThread, NULL);
-    start_thread(SaveTemperaturesThread, NULL);
-    start_thread(SBCInfoThread, NULL);
+    start_thread(TelemetryPackagerThread, NULL, true);
+    start_thread(CommandPackagerThread, NULL, true);
+    start_thread(TelemetrySenderThread, NULL, true);
+    start_thread(CommandSenderThread, NULL, true);
+    start_thread(CameraStreamThread, NULL, true);
+    start_thread(ImageProcessThread, NULL, true);
+    start_thread(SaveImageThread, NULL, true);
+    start_thread(SaveTemperaturesThread, NULL, true);
+    for (int k = 0; k < COMMAND_FAST_HANDLERS; k++) start_thread(FastCommandThread, NULL, true);
+    for (int k = 0; k < COMMAND_SLOW_HANDLERS; k++) start_thread(SlowCommandThread, NULL, true);
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {  
+    // the camera by default, or a stand-in for running without one:
+    //   sunDemo replay <directory> [frame time in ms, 0 for as fast as possible]
+    //   sunDemo synthetic [frame time in ms, 0 for as fast as possible]
+    // or to measure the latency of frame processing instead of running:
+    //   sunDemo selftest [seconds for each phase]
+    sourceFrameTime = frameRate.tv_sec*1000000 + frameRate.tv_nsec/1000;
+    if (LOCK_MEMORY && LockMemory() != 0) printf("Could not lock memory, pages may be swapped\n");
+    if (argc == 1) {
+        frameSource = new ImperxStream;
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "replay") == 0) {
+        frameSource = new ReplaySource(argv[2]);
+        if (argc == 4) sourceFrameTime = atoi(argv[3])*1000;
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "synthetic") == 0) {
+        SyntheticSun *sun = new SyntheticSun;
+        sun->SetDrift(20);
+        frameSource = sun;
+        if (argc == 3) sourceFrameTime = atoi(argv[2])*1000;
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "selftest") == 0) {
+        return latency_selftest(argc == 3 ? atoi(argv[2]) : SELFTEST_SECONDS);
+    } else {
+        printf("Usage: %s [replay <directory> [ms] | synthetic [ms] | selftest [s]]\n", argv[0]);
+        return -1;
+    }
+
     // to catch a Ctrl-C and clean up
-    signal(SIGINT, &sig_handler);
+    // SIGINT is blocked here before any threads are created so that every
+    // thread inherits the mask, and only the signal thread receives it
+    static sigset_t signal_set;
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signal_set, NULL);
+
+    pthread_t signal_thread;
+    if (pthread_create(&signal_thread, NULL, SignalThread, &signal_set) != 0) {
+        printf("ERROR; could not create the signal thread\n");
+        return -1;
+    }
+    pthread_detach(signal_thread);
+    ConfigureThread(dispatcherConfig);
 
     identifySAS();
     if (sas_id == 1) isOutputting = true;
 
-    pthread_mutex_init(&mutexImage, NULL);
     pthread_mutex_init(&mutexProcess, NULL);
+    pthread_mutex_init(&mutexDownlink, NULL);
+
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&condSolution, &condattr);
+    pthread_condattr_destroy(&condattr);
 
     /* Create worker threads */
     printf("In main: creating threads\n");
 
-    for(int i = 0; i < MAX_THREADS; i++ ){
-        started[0] = false;
-    }
-
-    // start the listen for commands thread right away
-    start_thread(listenForCommandsThread, NULL);
+    // start the network thread right away
+    tid_network = start_thread(NetworkThread, NULL, true);
     start_all_workers();
 
     while(g_running){
-        // check if new command have been added to command queue and service them
-        if (!recvd_command_queue.empty()){
+        // block until a new command has been added to command queue and service it
+        Command command;
+        if (recvd_command_queue.pop(command, USLEEP_MAIN)){
+            timespec now, latency;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            latency = TimespecDiff(command.getStamp(), now);
+            dispatchLatency.add(latency.tv_sec*1e6 + latency.tv_nsec/1e3);
+
             printf("size of queue: %zu\n", recvd_command_queue.size());
-            Command command;
-            command = Command();
-            recvd_command_queue >> command;
 
             latest_heroes_command_key = command.get_heroes_command();
             latest_sas_command_key = command.get_sas_command();
-            printf("Received command key 0x%x/0x%x\n", latest_heroes_command_key, latest_sas_command_key);
+            printf("Received command key 0x%x/0x%x, dispatched after %ld us\n", latest_heroes_command_key, latest_sas_command_key, latency.tv_sec*1000000 + latency.tv_nsec/1000);
 
             cmd_process_heroes_command(latest_heroes_command_key);
             if(latest_heroes_command_key == HKEY_FDR_SAS_CMD) {
                 cmd_process_sas_command(latest_sas_command_key, command);
             }
         }
+
+        // workers that failed wake us, so they are restarted within milliseconds
+        supervisor.restartFailed();
     }
 
     /* Last thing that main() should do */
     printf("Quitting and cleaning up.\n");
+    dispatchLatency.report("Command dispatch");
+    solutionLatency.report("Solution");
+    restartDowntime.report("Thread restart");
+    fastCommands.report();
+    slowCommands.report();
+    for (int k = 0; k < NUM_PERIODIC_TASKS; k++) periodicTasks[k]->report();
     /* wait for threads to finish */
     kill_all_threads();
-    pthread_mutex_destroy(&mutexImage);
     pthread_mutex_destroy(&mutexProcess);
+    pthread_mutex_destroy(&mutexDownlink);
+    pthread_cond_destroy(&condSolution);
     pthread_exit(NULL);
 
     return 0;
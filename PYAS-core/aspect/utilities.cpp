@@ -62,6 +62,57 @@ bool Flag::check()
     return temp;
 }
 
+LatencyStats::LatencyStats()
+{
+    pthread_mutex_init(&mutex, NULL);
+    count = 0;
+    sum = min = max = 0;
+}
+
+LatencyStats::~LatencyStats()
+{
+    pthread_mutex_destroy(&mutex);
+}
+
+void LatencyStats::add(timespec start, timespec end)
+{
+    timespec diff = TimespecDiff(start, end);
+    add(diff.tv_sec*1e6 + diff.tv_nsec/1e3);
+}
+
+void LatencyStats::add(double usec)
+{
+    pthread_mutex_lock(&mutex);
+    if ((count == 0) || (usec < min)) min = usec;
+    if ((count == 0) || (usec > max)) max = usec;
+    sum += usec;
+    count++;
+    pthread_mutex_unlock(&mutex);
+}
+
+long LatencyStats::getCount()
+{
+    long temp;
+    pthread_mutex_lock(&mutex);
+    temp = count;
+    pthread_mutex_unlock(&mutex);
+    return temp;
+}
+
+void LatencyStats::report(const char *name)
+{
+    pthread_mutex_lock(&mutex);
+    if (count > 0) {
+        printf("%s latency: %ld samples, mean %.1f us, min %.1f us, max %.1f us\n",
+               name, count, sum/count, min, max);
+    } else {
+        printf("%s latency: no samples\n", name);
+    }
+    count = 0;
+    sum = min = max = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
 timespec TimespecDiff(timespec start, timespec end)
 {
     timespec diff;
@@ -31,6 +31,23 @@ private:
     pthread_mutex_t mutex;
 };
 
+//Accumulates latency samples (in microseconds) between reports
+class LatencyStats
+{
+public:
+    LatencyStats();
+    ~LatencyStats();
+    void add(timespec start, timespec end);
+    void add(double usec);
+    long getCount();
+    //Prints the count, mean, min, and max since the last report, then resets
+    void report(const char *name);
+private:
+    long count;
+    double sum, min, max;
+    pthread_mutex_t mutex;
+};
+
 timespec TimespecDiff(timespec start, timespec end);
 const std::string nanoString(long tv_nsec);
 void DrawCross(cv::Mat &image, cv::Point2f point, cv::Scalar color, int length, int thickness, int resolution);